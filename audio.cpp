@@ -0,0 +1,133 @@
+#include "audio.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+
+namespace scpak
+{
+    namespace
+    {
+        const double pi = 3.14159265358979323846;
+        // zero crossings of the sinc on either side of the center
+        const int zeroCrossings = 16;
+        // fraction of the lower Nyquist frequency that is passed
+        const double passband = 0.95;
+        const std::size_t maxCoefficients = std::size_t(1) << 24;
+
+        std::int64_t gcd(std::int64_t a, std::int64_t b)
+        {
+            while (b != 0)
+            {
+                std::int64_t r = a % b;
+                a = b;
+                b = r;
+            }
+            return a;
+        }
+
+        // Blackman windowed sinc, d in input samples
+        double kernel(double d, double cutoff, double halfWidth)
+        {
+            if (std::fabs(d) >= halfWidth)
+                return 0;
+            double x = pi * cutoff * d;
+            double sinc = x == 0 ? 1 : std::sin(x) / x;
+            double w = pi * d / halfWidth;
+            double window = 0.42 + 0.5 * std::cos(w) + 0.08 * std::cos(2 * w);
+            return cutoff * sinc * window;
+        }
+
+        std::int16_t toSample(float value)
+        {
+            long rounded = std::lround(value);
+            return static_cast<std::int16_t>(std::min(32767L, std::max(-32768L, rounded)));
+        }
+    }
+
+    std::vector<std::int16_t> downmixToMono(const std::int16_t *samples, std::size_t frameCount, int channelCount)
+    {
+        std::vector<std::int16_t> mono(frameCount);
+        for (std::size_t i = 0; i < frameCount; ++i)
+        {
+            int sum = 0;
+            for (int c = 0; c < channelCount; ++c)
+                sum += samples[i * channelCount + c];
+            mono[i] = static_cast<std::int16_t>(sum / channelCount);
+        }
+        return mono;
+    }
+
+    Resampler::Resampler(int inputRate, int outputRate)
+    {
+        if (inputRate <= 0 || outputRate <= 0)
+            throw std::runtime_error("invalid sample rate");
+        std::int64_t divisor = gcd(inputRate, outputRate);
+        m_up = outputRate / divisor;
+        m_down = inputRate / divisor;
+
+        double cutoff = passband * std::min(1.0, static_cast<double>(m_up) / m_down);
+        double halfWidth = zeroCrossings / cutoff;
+        m_taps = 2 * static_cast<int>(std::ceil(halfWidth));
+        m_taps = (m_taps + 7) / 8 * 8;
+        if (static_cast<std::size_t>(m_up) * m_taps > maxCoefficients)
+            throw std::runtime_error("unsupported sample rate conversion");
+
+        // phase p puts the output between input samples i and i + 1 at
+        // i + p / m_up; tap k reads input sample i - m_taps / 2 + 1 + k
+        m_phases.resize(static_cast<std::size_t>(m_up) * m_taps);
+        for (std::int64_t p = 0; p < m_up; ++p)
+        {
+            float *row = &m_phases[static_cast<std::size_t>(p) * m_taps];
+            double sum = 0;
+            for (int k = 0; k < m_taps; ++k)
+            {
+                double d = k - m_taps / 2 + 1 - static_cast<double>(p) / m_up;
+                double h = kernel(d, cutoff, halfWidth);
+                row[k] = static_cast<float>(h);
+                sum += h;
+            }
+            // unity gain for constant signals in every phase
+            for (int k = 0; k < m_taps; ++k)
+                row[k] = static_cast<float>(row[k] / sum);
+        }
+    }
+
+    std::size_t Resampler::outputFrames(std::size_t frameCount) const
+    {
+        return static_cast<std::size_t>((static_cast<std::int64_t>(frameCount) * m_up + m_down - 1) / m_down);
+    }
+
+    void Resampler::process(const std::int16_t *input, std::size_t frameCount, int channelCount, std::int16_t *output) const
+    {
+        std::size_t outputCount = outputFrames(frameCount);
+        std::size_t before = m_taps / 2 - 1;
+        std::vector<float> channel(frameCount + m_taps, 0.0f);
+        for (int c = 0; c < channelCount; ++c)
+        {
+            for (std::size_t i = 0; i < frameCount; ++i)
+                channel[before + i] = input[i * channelCount + c];
+
+            std::int64_t position = 0, phase = 0;
+            for (std::size_t n = 0; n < outputCount; ++n)
+            {
+                const float *h = &m_phases[static_cast<std::size_t>(phase) * m_taps];
+                // padded by before, so this is input sample position - before
+                const float *x = &channel[static_cast<std::size_t>(position)];
+                // eight independent sums per step keep the loop free of a
+                // serial dependency, so it is compiled to vector instructions
+                // without reordering the additions of a single sum
+                float sums[8] = { 0 };
+                for (int k = 0; k < m_taps; k += 8)
+                    for (int j = 0; j < 8; ++j)
+                        sums[j] += h[k + j] * x[k + j];
+                float value = ((sums[0] + sums[4]) + (sums[1] + sums[5])) + ((sums[2] + sums[6]) + (sums[3] + sums[7]));
+                output[n * channelCount + c] = toSample(value);
+
+                phase += m_down;
+                position += phase / m_up;
+                phase %= m_up;
+            }
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace scpak
+{
+    // Interleaved 16-bit PCM frames to one channel, averaging all channels.
+    std::vector<std::int16_t> downmixToMono(const std::int16_t *samples, std::size_t frameCount, int channelCount);
+
+    // Windowed sinc resampler for interleaved 16-bit PCM. The ratio of the
+    // rates is reduced to outputRate/inputRate = L/M and one filter phase
+    // is kept for each of the L output positions between two input
+    // samples, so no kernel is evaluated while processing. The cutoff sits
+    // a little below the lower of the two Nyquist frequencies.
+    class Resampler
+    {
+    public:
+        Resampler(int inputRate, int outputRate);
+
+        // frames written by process() for frameCount input frames
+        std::size_t outputFrames(std::size_t frameCount) const;
+        // output must hold outputFrames(frameCount) * channelCount samples
+        void process(const std::int16_t *input, std::size_t frameCount, int channelCount, std::int16_t *output) const;
+    private:
+        std::int64_t m_up;
+        std::int64_t m_down;
+        int m_taps; // per phase, a multiple of 8
+        std::vector<float> m_phases; // m_up rows of m_taps coefficients
+    };
+}
@@ -0,0 +1,1002 @@
+#include "corpus.h"
+#include "pakfile.h"
+#include "pack.h"
+#include "unpack.h"
+#include "native.h"
+#include "paklz.h"
+#include "roundtrip.h"
+#include "merge.h"
+#include "pakstats.h"
+#include "texture.h"
+#include "audio.h"
+#include "libscpak.h"
+#include "tinyxml2/tinyxml2.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <map>
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <algorithm>
+#include <random>
+#include <cstring>
+#include <iterator>
+#include <atomic>
+#include <new>
+
+using namespace std;
+using namespace scpak;
+
+// every allocation of the process, so loads can be checked to make none
+// per item beyond their payloads
+static atomic<long> allocationCount(0);
+
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    void *p = malloc(size != 0 ? size : 1);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+namespace
+{
+    class Stopwatch
+    {
+    public:
+        Stopwatch() : m_start(chrono::steady_clock::now()) { }
+
+        double elapsed() const
+        {
+            return chrono::duration<double>(chrono::steady_clock::now() - m_start).count();
+        }
+    private:
+        chrono::steady_clock::time_point m_start;
+    };
+
+    struct Measurement
+    {
+        double best = numeric_limits<double>::max();
+        double total = 0;
+        int runs = 0;
+        double bytes = 0;
+        long items = 0;
+        long allocations = -1;
+    };
+
+    // keeps measurements in the order they were first recorded
+    class Report
+    {
+    public:
+        void record(const string &name, double seconds, double bytes, long items, long allocations = -1)
+        {
+            auto it = m_index.find(name);
+            if (it == m_index.end())
+            {
+                it = m_index.insert(make_pair(name, m_results.size())).first;
+                m_results.push_back(make_pair(name, Measurement()));
+            }
+            Measurement &m = m_results[it->second].second;
+            m.best = min(m.best, seconds);
+            m.total += seconds;
+            ++m.runs;
+            m.bytes = bytes;
+            m.items = items;
+            m.allocations = allocations;
+        }
+
+        void writeJson(ostream &out, const bench::CorpusSpec &spec, int repeat) const
+        {
+            out << "{" << endl;
+            out << "  \"scpak_version\": \"" << Version << "\"," << endl;
+            out << "  \"repeat\": " << repeat << "," << endl;
+            out << "  \"corpus\": {\"seed\": " << spec.seed
+                << ", \"textures\": " << spec.textureCount
+                << ", \"texture_sizes\": [";
+            for (size_t i = 0; i < spec.textureSizes.size(); ++i)
+                out << (i ? ", " : "") << spec.textureSizes[i];
+            out << "], \"mipmap_level\": " << spec.mipmapLevel
+                << ", \"fonts\": " << spec.fontCount
+                << ", \"font_glyphs\": " << spec.fontGlyphCount
+                << ", \"font_atlas_size\": " << spec.fontAtlasSize
+                << ", \"sounds\": " << spec.soundCount
+                << ", \"sound_seconds\": " << spec.soundSeconds
+                << ", \"xml\": " << spec.xmlCount
+                << ", \"xml_size\": " << spec.xmlSize
+                << ", \"strings\": " << spec.stringCount
+                << ", \"raw\": " << spec.rawCount
+                << ", \"raw_size\": " << spec.rawSize << "}," << endl;
+            out << "  \"results\": [" << endl;
+            for (size_t i = 0; i < m_results.size(); ++i)
+            {
+                const string &name = m_results[i].first;
+                const Measurement &m = m_results[i].second;
+                double best = m.best > 0 ? m.best : 1e-9;
+                out << "    {\"name\": \"" << name << "\""
+                    << ", \"seconds\": " << m.best
+                    << ", \"mean_seconds\": " << m.total / m.runs
+                    << ", \"bytes\": " << static_cast<long long>(m.bytes)
+                    << ", \"items\": " << m.items
+                    << ", \"mb_per_s\": " << m.bytes / best / 1e6
+                    << ", \"items_per_s\": " << m.items / best;
+                if (m.allocations >= 0)
+                    out << ", \"allocations\": " << m.allocations;
+                out << "}" << (i + 1 < m_results.size() ? "," : "") << endl;
+            }
+            out << "  ]" << endl;
+            out << "}" << endl;
+        }
+    private:
+        vector<pair<string, Measurement>> m_results;
+        map<string, size_t> m_index;
+    };
+
+    struct TypeTiming
+    {
+        double seconds = 0;
+        double bytes = 0;
+        long items = 0;
+    };
+    typedef map<string, TypeTiming> TypeTimings;
+
+    packer_type timedPacker(TypeTimings &timings, packer_type packer)
+    {
+        return [&timings, packer](const string &inputDir, PakItem &item, const string &meta)
+        {
+            Stopwatch watch;
+            packer(inputDir, item, meta);
+            TypeTiming &timing = timings[item.type.str()];
+            timing.seconds += watch.elapsed();
+            timing.bytes += item.length;
+            ++timing.items;
+        };
+    }
+
+    unpacker_type timedUnpacker(TypeTimings &timings, unpacker_type unpacker)
+    {
+        return [&timings, unpacker](const string &outputDir, const PakItem &item)
+        {
+            Stopwatch watch;
+            string meta = unpacker(outputDir, item);
+            TypeTiming &timing = timings[item.type.str()];
+            timing.seconds += watch.elapsed();
+            timing.bytes += item.length;
+            ++timing.items;
+            return meta;
+        };
+    }
+
+    void recordTimings(Report &report, const string &prefix, const TypeTimings &timings)
+    {
+        for (const auto &entry : timings)
+            report.record(prefix + entry.first, entry.second.seconds, entry.second.bytes, entry.second.items);
+    }
+
+    PakFile benchPack(Report &report, const string &corpusDir)
+    {
+        TypeTimings timings;
+        map<string, packer_type> packers;
+        auto packString = [](const string &inputDir, PakItem &item, const string &meta) { pack_string(inputDir, item); };
+        packers["System.String"] = timedPacker(timings, packString);
+        packers["System.Xml.Linq.XElement"] = timedPacker(timings, packString);
+        packers["Engine.Graphics.Texture2D"] = timedPacker(timings,
+            [](const string &inputDir, PakItem &item, const string &meta) { pack_texture(inputDir, item, meta); });
+        packers["Engine.Media.BitmapFont"] = timedPacker(timings,
+            [](const string &inputDir, PakItem &item, const string &meta) { pack_bitmapFont(inputDir, item); });
+        packers["Engine.Audio.SoundBuffer"] = timedPacker(timings,
+            [](const string &inputDir, PakItem &item, const string &meta) { pack_soundBuffer(inputDir, item); });
+        packer_type defaultPacker = timedPacker(timings,
+            [](const string &inputDir, PakItem &item, const string &meta) { pack_raw(inputDir, item); });
+
+        Stopwatch watch;
+        PakFile pak = pack(corpusDir, packers, defaultPacker);
+        double seconds = watch.elapsed();
+
+        double bytes = 0;
+        for (const PakItem &item : pak.contents())
+            bytes += item.length;
+        report.record("pack/total", seconds, bytes, static_cast<long>(pak.contents().size()));
+        recordTimings(report, "pack/", timings);
+        return pak;
+    }
+
+    void benchUnpack(Report &report, const PakFile &pak, const string &outputDir)
+    {
+        TypeTimings timings;
+        map<string, unpacker_type> unpackers;
+        auto unpackString = [](const string &outputDir, const PakItem &item) { unpack_string(outputDir, item); return string(); };
+        unpackers["System.String"] = timedUnpacker(timings, unpackString);
+        unpackers["System.Xml.Linq.XElement"] = timedUnpacker(timings, unpackString);
+        unpackers["Engine.Graphics.Texture2D"] = timedUnpacker(timings,
+            [](const string &outputDir, const PakItem &item) { return unpack_texture(outputDir, item); });
+        unpackers["Engine.Media.BitmapFont"] = timedUnpacker(timings,
+            [](const string &outputDir, const PakItem &item) { unpack_bitmapFont(outputDir, item); return string(); });
+        unpackers["Engine.Audio.SoundBuffer"] = timedUnpacker(timings,
+            [](const string &outputDir, const PakItem &item) { unpack_soundBuffer(outputDir, item); return string(); });
+        unpacker_type defaultUnpacker = timedUnpacker(timings,
+            [](const string &outputDir, const PakItem &item) { unpack_raw(outputDir, item); return string(); });
+
+        Stopwatch watch;
+        unpack(pak, outputDir, unpackers, defaultUnpacker);
+        double seconds = watch.elapsed();
+
+        double bytes = 0;
+        for (const PakItem &item : pak.contents())
+            bytes += item.length;
+        report.record("unpack/total", seconds, bytes, static_cast<long>(pak.contents().size()));
+        recordTimings(report, "unpack/", timings);
+
+        // whole unpacks through each file writer backend
+        const char *backends[] = { "sync", "threads", "io_uring" };
+        for (const char *backend : backends)
+        {
+            UnpackOptions options;
+            options.unpackText = options.unpackBitmapFont = options.unpackTexture = options.unpackSound = true;
+            parseFileWriterBackend(backend, options.writeBackend);
+            Stopwatch backendWatch;
+            unpack(pak, outputDir, options);
+            report.record(string("unpack/writer/") + backend, backendWatch.elapsed(), bytes, static_cast<long>(pak.contents().size()));
+        }
+    }
+
+    // allocations a load may make however many items the pak has
+    const long maxLoadAllocations = 16;
+
+    void checkAllocations(const char *what, long allocations, long limit)
+    {
+        if (allocations > limit)
+            throw runtime_error(string(what) + " made " + to_string(allocations) + " allocations, expected at most "
+                + to_string(limit));
+    }
+
+    void benchSaveLoad(Report &report, PakFile &pak, const string &pakPath)
+    {
+        double bytes = 0;
+        for (const PakItem &item : pak.contents())
+            bytes += item.length;
+        long items = static_cast<long>(pak.contents().size());
+        {
+            Stopwatch watch;
+            ofstream fout(pakPath, ios::binary);
+            pak.save(fout);
+            fout.close();
+            report.record("pakfile/save", watch.elapsed(), bytes, items);
+        }
+        {
+            // one allocation per payload, names and types share the
+            // directory block
+            Stopwatch watch;
+            ifstream fin(pakPath, ios::binary);
+            PakFile loaded;
+            long before = allocationCount;
+            loaded.load(fin);
+            long allocations = allocationCount - before;
+            report.record("pakfile/load", watch.elapsed(), bytes, items, allocations);
+            checkAllocations("pakfile/load", allocations, items + maxLoadAllocations);
+        }
+        {
+            Stopwatch watch;
+            ifstream fin(pakPath, ios::binary);
+            PakFile loaded;
+            long before = allocationCount;
+            loaded.load(fin, true);
+            long allocations = allocationCount - before;
+            report.record("pakfile/load_arena", watch.elapsed(), bytes, items, allocations);
+            checkAllocations("pakfile/load_arena", allocations, maxLoadAllocations);
+        }
+        {
+            // the smallest mip level of every texture, bytes counts what is read
+            Stopwatch watch;
+            ifstream fin(pakPath, ios::binary);
+            PakFile loaded;
+            loaded.loadDirectory(fin);
+            double read = static_cast<double>(fin.tellg());
+            long textures = 0;
+            for (const PakItem &item : loaded.contents())
+            {
+                if (item.typeId != ItemType::Texture2D)
+                    continue;
+                TextureHeader header = readTextureHeader(loaded, fin, item);
+                read += TextureHeader::size + readMipmapLevel(loaded, fin, item, header, header.mipmapLevel - 1).size();
+                ++textures;
+            }
+            report.record("pakfile/thumbnails", watch.elapsed(), read, textures);
+        }
+        {
+            // payloads in an order unrelated to the directory, as after
+            // edits or merges, read from disk rather than the page cache
+            // where it can be dropped
+            PakLayout shuffled;
+            for (const PakItem &item : pak.contents())
+                shuffled.accessOrder.push_back(item.name.str());
+            shuffle(shuffled.accessOrder.begin(), shuffled.accessOrder.end(), mt19937(1));
+            string shuffledPath = pakPath + ".shuffled";
+            {
+                ofstream fout(shuffledPath, ios::binary);
+                pak.save(fout, shuffled);
+            }
+            bool cold = evictFromPageCache(shuffledPath);
+            Stopwatch watch;
+            PakFile loaded;
+            loaded.load(shuffledPath);
+            report.record(cold ? "pakfile/load_cold_shuffled" : "pakfile/load_shuffled", watch.elapsed(), bytes, items);
+        }
+        {
+            // the pak over itself, every item is replaced
+            Stopwatch watch;
+            MergeResult result = mergePaks({ pakPath, pakPath }, pakPath + ".merged");
+            report.record("pakfile/merge", watch.elapsed(), static_cast<double>(result.payloadBytes), items);
+        }
+        {
+            // directory and headers only, the bytes are those described
+            Stopwatch watch;
+            ifstream fin(pakPath, ios::binary);
+            PakFile directory;
+            directory.loadDirectory(fin);
+            PakStats stats = analyzePak(directory, fin);
+            report.record("pakfile/stats", watch.elapsed(), static_cast<double>(stats.payloadBytes), items);
+        }
+    }
+
+    void benchCompress(Report &report, const string &pakPath)
+    {
+        string lzPath = pakPath + ".lz";
+        double bytes = static_cast<double>(getFileSize(pakPath.c_str()));
+        {
+            Stopwatch watch;
+            ifstream fin(pakPath, ios::binary);
+            ofstream fout(lzPath, ios::binary);
+            compressPak(fin, fout);
+            fout.close();
+            report.record("lz/compress", watch.elapsed(), bytes, 1);
+        }
+        {
+            Stopwatch watch;
+            ifstream fin(lzPath, ios::binary);
+            ofstream fout(pakPath + ".raw", ios::binary);
+            decompressPak(fin, fout);
+            fout.close();
+            report.record("lz/decompress", watch.elapsed(), bytes, 1);
+        }
+        {
+            Stopwatch watch;
+            ifstream fin(lzPath, ios::binary);
+            LzInputStream stream(fin);
+            PakFile loaded;
+            loaded.load(stream, true);
+            report.record("lz/load_arena", watch.elapsed(), bytes, static_cast<long>(loaded.contents().size()));
+        }
+    }
+
+    void checkStatus(scpak_status status, const char *call)
+    {
+        if (status != SCPAK_OK)
+            throw runtime_error(string(call) + " failed: " + scpak_last_error());
+    }
+
+    // decodes every texture (all levels), sound and font through the C
+    // API, as an embedding program would; returns the bytes decoded
+    double decodeThroughCApi(const scpak_pak *pak)
+    {
+        double bytes = 0;
+        vector<unsigned char> buffer;
+        vector<scpak_glyph> glyphs;
+        size_t count = scpak_entry_count(pak);
+        for (size_t i = 0; i < count; ++i)
+        {
+            scpak_entry entry;
+            checkStatus(scpak_get_entry(pak, i, &entry), "scpak_get_entry");
+            size_t found;
+            checkStatus(scpak_find_entry(pak, entry.name, &found), "scpak_find_entry");
+            const void *payload;
+            size_t length;
+            checkStatus(scpak_get_payload(pak, i, &payload, &length), "scpak_get_payload");
+            if (length != entry.length)
+                throw runtime_error(string("payload length mismatch for ") + entry.name);
+            if (entry.type_id == SCPAK_TYPE_TEXTURE2D)
+            {
+                scpak_texture_info info;
+                checkStatus(scpak_get_texture_info(pak, i, &info), "scpak_get_texture_info");
+                for (int level = 0; level < max(1, info.mipmap_levels); ++level)
+                {
+                    size_t size = static_cast<size_t>(max(1, info.width >> level)) * max(1, info.height >> level) * 4;
+                    buffer.resize(size);
+                    checkStatus(scpak_decode_texture(pak, i, level, buffer.data(), size), "scpak_decode_texture");
+                    bytes += size;
+                }
+            }
+            else if (entry.type_id == SCPAK_TYPE_SOUNDBUFFER)
+            {
+                scpak_sound_info info;
+                checkStatus(scpak_get_sound_info(pak, i, &info), "scpak_get_sound_info");
+                if (info.compressed)
+                    continue;
+                buffer.resize(info.pcm_bytes);
+                checkStatus(scpak_decode_sound(pak, i, buffer.data(), buffer.size()), "scpak_decode_sound");
+                bytes += info.pcm_bytes;
+            }
+            else if (entry.type_id == SCPAK_TYPE_BITMAPFONT)
+            {
+                scpak_font_info info;
+                checkStatus(scpak_get_font_info(pak, i, &info), "scpak_get_font_info");
+                glyphs.resize(info.glyph_count);
+                buffer.resize(static_cast<size_t>(info.atlas_width) * info.atlas_height * 4);
+                checkStatus(scpak_decode_font(pak, i, glyphs.data(), glyphs.size(), buffer.data(), buffer.size()), "scpak_decode_font");
+                bytes += buffer.size();
+            }
+        }
+        return bytes;
+    }
+
+    // the C API of libscpak, which scpak itself does not go through
+    void benchLibrary(Report &report, const string &pakPath)
+    {
+        long items = 0;
+        {
+            Stopwatch watch;
+            scpak_pak *pak;
+            checkStatus(scpak_open(pakPath.c_str(), SCPAK_OPEN_MMAP, &pak), "scpak_open");
+            items = static_cast<long>(scpak_entry_count(pak));
+            double bytes;
+            try
+            {
+                bytes = decodeThroughCApi(pak);
+            }
+            catch (...)
+            {
+                scpak_close(pak);
+                throw;
+            }
+            scpak_close(pak);
+            report.record("libscpak/decode_mmap", watch.elapsed(), bytes, items);
+        }
+        {
+            ifstream fin(pakPath, ios::binary);
+            vector<char> data((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+            Stopwatch watch;
+            scpak_pak *pak;
+            checkStatus(scpak_open_memory(data.data(), data.size(), &pak), "scpak_open_memory");
+            double bytes;
+            try
+            {
+                bytes = decodeThroughCApi(pak);
+            }
+            catch (...)
+            {
+                scpak_close(pak);
+                throw;
+            }
+            scpak_close(pak);
+            report.record("libscpak/decode_memory", watch.elapsed(), bytes, items);
+        }
+    }
+
+    void benchRoundTrip(Report &report, const PakFile &pak)
+    {
+        double bytes = 0;
+        for (const PakItem &item : pak.contents())
+            bytes += item.length;
+        UnpackOptions unpackOptions;
+        unpackOptions.unpackText = unpackOptions.unpackBitmapFont = unpackOptions.unpackTexture = unpackOptions.unpackSound = true;
+        PackOptions packOptions;
+        packOptions.packText = packOptions.packTexture = packOptions.packFont = packOptions.packSound = true;
+        Stopwatch watch;
+        roundTrip(pak, unpackOptions, packOptions);
+        report.record("roundtrip/total", watch.elapsed(), bytes, static_cast<long>(pak.contents().size()));
+    }
+
+    void benchBinaryIO(Report &report)
+    {
+        const int count = 1 << 20;
+        vector<byte> buffer(static_cast<size_t>(count) * 8);
+        volatile int sink = 0;
+
+        {
+            Stopwatch watch;
+            MemoryBinaryWriter writer(buffer.data());
+            for (int i = 0; i < count; ++i)
+                writer.writeInt(i);
+            report.record("binaryio/memory_write_int32", watch.elapsed(), count * 4.0, count);
+        }
+        {
+            Stopwatch watch;
+            MemoryBinaryReader reader(buffer.data());
+            for (int i = 0; i < count; ++i)
+                sink += reader.readInt32();
+            report.record("binaryio/memory_read_int32", watch.elapsed(), count * 4.0, count);
+        }
+        {
+            Stopwatch watch;
+            MemoryBinaryWriter writer(buffer.data());
+            for (int i = 0; i < count; ++i)
+                writer.write7BitEncodedInt(i * 37);
+            report.record("binaryio/memory_write_7bit_int", watch.elapsed(), writer.position, count);
+        }
+        {
+            Stopwatch watch;
+            MemoryBinaryReader reader(buffer.data());
+            for (int i = 0; i < count; ++i)
+                sink += reader.read7BitEncodedInt();
+            report.record("binaryio/memory_read_7bit_int", watch.elapsed(), reader.position, count);
+        }
+        {
+            Stopwatch watch;
+            MemoryBinaryWriter writer(buffer.data());
+            for (int i = 0; i < count; ++i)
+                writer.writeUtf8Char(i % 0x10000);
+            report.record("binaryio/memory_write_utf8_char", watch.elapsed(), writer.position, count);
+        }
+        {
+            Stopwatch watch;
+            MemoryBinaryReader reader(buffer.data());
+            for (int i = 0; i < count; ++i)
+                sink += reader.readUtf8Char();
+            report.record("binaryio/memory_read_utf8_char", watch.elapsed(), reader.position, count);
+        }
+
+        const int stringCount = count / 16;
+        const string value = "Textures/Blocks/SomeBlockTexture";
+        {
+            Stopwatch watch;
+            MemoryBinaryWriter writer(buffer.data());
+            for (int i = 0; i < stringCount; ++i)
+                writer.writeString(value);
+            report.record("binaryio/memory_write_string", watch.elapsed(), writer.position, stringCount);
+        }
+        {
+            Stopwatch watch;
+            MemoryBinaryReader reader(buffer.data());
+            for (int i = 0; i < stringCount; ++i)
+                sink += static_cast<int>(reader.readString().length());
+            report.record("binaryio/memory_read_string", watch.elapsed(), reader.position, stringCount);
+        }
+
+        stringstream stream;
+        {
+            Stopwatch watch;
+            StreamBinaryWriter writer(&stream);
+            for (int i = 0; i < count; ++i)
+                writer.writeInt(i);
+            report.record("binaryio/stream_write_int32", watch.elapsed(), count * 4.0, count);
+        }
+        {
+            Stopwatch watch;
+            StreamBinaryReader reader(&stream);
+            for (int i = 0; i < count; ++i)
+                sink += reader.readInt32();
+            report.record("binaryio/stream_read_int32", watch.elapsed(), count * 4.0, count);
+        }
+    }
+
+    void benchMipmap(Report &report, const bench::CorpusSpec &spec)
+    {
+        for (int size : spec.textureSizes)
+        {
+            int level = 0;
+            for (int s = size; s > 0; s /= 2)
+                ++level;
+            vector<unsigned char> image(static_cast<size_t>(calcMipmapSize(size, size, level)) * 4);
+            for (size_t i = 0; i < static_cast<size_t>(size) * size * 4; ++i)
+                image[i] = static_cast<unsigned char>(i * 7 + i / 4093);
+            Stopwatch watch;
+            generateMipmap(size, size, level, image.data());
+            report.record("mipmap/" + to_string(size), watch.elapsed(), static_cast<double>(image.size()), 1);
+        }
+    }
+
+    void benchResample(Report &report, const bench::CorpusSpec &spec)
+    {
+        int frames = static_cast<int>(spec.soundSampleRate * spec.soundSeconds);
+        vector<int16_t> samples(static_cast<size_t>(frames) * 2);
+        for (size_t i = 0; i < samples.size(); ++i)
+            samples[i] = static_cast<int16_t>(i * 7919 + i / 4093);
+        for (int rate : { spec.soundSampleRate / 2, 48000 })
+        {
+            Stopwatch watch;
+            Resampler resampler(spec.soundSampleRate, rate);
+            vector<int16_t> output(resampler.outputFrames(frames) * 2);
+            resampler.process(samples.data(), frames, 2, output.data());
+            report.record("resample/" + to_string(rate), watch.elapsed(), samples.size() * 2.0, 1);
+        }
+    }
+
+    // elements, attributes and text of a parsed document in order;
+    // comments and the whitespace between tags are not part of it
+    void describeXml(const tinyxml2::XMLNode *node, string &out)
+    {
+        for (const tinyxml2::XMLNode *child = node->FirstChild(); child != nullptr; child = child->NextSibling())
+        {
+            if (const tinyxml2::XMLElement *element = child->ToElement())
+            {
+                out += string("<") + element->Name();
+                for (const tinyxml2::XMLAttribute *attribute = element->FirstAttribute(); attribute != nullptr; attribute = attribute->Next())
+                    out += string(" ") + attribute->Name() + "=[" + attribute->Value() + "]";
+                out += ">";
+                describeXml(child, out);
+                out += "</>";
+            }
+            else if (const tinyxml2::XMLText *text = child->ToText())
+                out += string("[") + text->Value() + "]";
+        }
+    }
+
+    // Minifies XML that is easy to get wrong and checks that the result
+    // parses and means the same, or is the source unchanged where
+    // minifying is not safe.
+    void checkMinify(const string &dir)
+    {
+        struct Sample
+        {
+            const char *name;
+            const char *text;
+            bool verbatim;
+        };
+        static const Sample samples[] = {
+            { "comments", "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n<Database>\r\n  <!-- blocks -->\r\n"
+                "  <Block Name=\"Dirt\" Value='2' Description=\"a &amp; b\"/>\r\n  <Block Name=\"Sand\">\r\n"
+                "    <!-- nested -->\r\n    <Sound>step</Sound>\r\n  </Block>\r\n</Database>\r\n", false },
+            { "mixed", "<Text>Press <Key>Q</Key> to\n  quit, &lt;or&gt; <b>not</b>.<!-- hint --></Text>", false },
+            { "single_quoted", "<Items>\n  <Item Text='say \"hi\"' Other=\"x\"/>\n</Items>", true },
+            { "malformed", "<Items>\n  <Item>\n</Items>", true },
+        };
+        if (!pathExists(dir.c_str()))
+            createDirectory(dir.c_str());
+        for (const Sample &sample : samples)
+        {
+            {
+                ofstream fout(dir + pathsep + sample.name + ".xml", ios::binary);
+                fout << sample.text;
+            }
+            PakItem item;
+            item.name = sample.name;
+            item.type = "System.Xml.Linq.XElement";
+            pack_xmlMinified(dir + pathsep, item, nullptr);
+            MemoryBinaryReader reader(item.payload(), static_cast<size_t>(item.length));
+            string packed = reader.readString();
+            string what = string("minify check ") + sample.name + ": ";
+            if (sample.verbatim)
+            {
+                if (packed != sample.text)
+                    throw runtime_error(what + "not kept verbatim");
+                continue;
+            }
+            if (packed.find("<!--") != string::npos || packed.length() >= strlen(sample.text))
+                throw runtime_error(what + "not minified");
+            tinyxml2::XMLDocument source(false, tinyxml2::PRESERVE_WHITESPACE), result(false, tinyxml2::PRESERVE_WHITESPACE);
+            if (source.Parse(sample.text) != tinyxml2::XML_SUCCESS || result.Parse(packed.data(), packed.length()) != tinyxml2::XML_SUCCESS)
+                throw runtime_error(what + "does not parse");
+            string expected, actual;
+            describeXml(&source, expected);
+            describeXml(&result, actual);
+            if (actual != expected)
+                throw runtime_error(what + "content changed");
+        }
+    }
+
+    // Sparse files covering the 32-bit limits of the pak format: a pak
+    // whose last payload ends at the largest offset it can have must load
+    // and unpack, inputs and contents past the limit must be refused before
+    // anything is read. Only the few bytes written take space on disk.
+    void expect(bool condition, const string &what)
+    {
+        if (!condition)
+            throw runtime_error("large file check failed: " + what);
+        cout << "ok: " << what << endl;
+    }
+
+    const PakItem &findItem(const PakFile &pak, const string &name)
+    {
+        for (const PakItem &item : pak.contents())
+            if (item.name == name)
+                return item;
+        throw runtime_error("no item " + name);
+    }
+
+    void writeNearLimitPak(const string &path, const vector<byte> &tail, int64_t &tailOffset)
+    {
+        ofstream fout(path, ios::binary | ios::trunc);
+        PakHeader header;
+        header.contentCount = 2;
+        fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        StreamBinaryWriter writer(&fout);
+        tailOffset = maxPakOffset - static_cast<int64_t>(tail.size());
+        // the filler runs from offset 4 up to the marker of the tail
+        writer.writeString("Large/filler");
+        writer.writeString("System.Byte[]");
+        writer.writeInt(4);
+        writer.writeInt(static_cast<int>(tailOffset - 8));
+        writer.writeString("Large/tail");
+        writer.writeString("System.Byte[]");
+        writer.writeInt(static_cast<int>(tailOffset));
+        writer.writeInt(static_cast<int>(tail.size()));
+        int64_t contentOffset = fout.tellp();
+        header.contentOffset = static_cast<int32_t>(contentOffset);
+        static const char marker[] = { '\xDE', '\xAD', '\xBE', '\xEF' };
+        fout.write(marker, 4);
+        fout.seekp(contentOffset + tailOffset - 4);
+        fout.write(marker, 4);
+        fout.write(reinterpret_cast<const char*>(tail.data()), tail.size());
+        fout.seekp(0);
+        fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!fout)
+            throw runtime_error("cannot write " + path);
+    }
+
+    void checkLargeFiles(const string &dir)
+    {
+        if (!pathExists(dir.c_str()))
+            createDirectory(dir.c_str());
+        string pakPath = dir + pathsep + "near_limit.pak";
+        vector<byte> tail(4096);
+        for (size_t i = 0; i < tail.size(); ++i)
+            tail[i] = static_cast<byte>(i * 7 + 1);
+        int64_t tailOffset;
+        writeNearLimitPak(pakPath, tail, tailOffset);
+        expect(getFileSize(pakPath.c_str()) > maxPakOffset, "pak larger than 2 GiB written");
+
+        {
+            ifstream fin(pakPath, ios::binary);
+            PakFile pak;
+            pak.loadDirectory(fin);
+            const PakItem &item = findItem(pak, "Large/tail");
+            vector<byte> data(tail.size());
+            pak.readRange(fin, item, 0, data.data(), data.size());
+            expect(item.offset == tailOffset && data == tail, "directory load reads the item at the offset limit");
+        }
+        ItemFilter tailOnly;
+        tailOnly.includeNames.push_back("Large/tail");
+        {
+            PakFile pak;
+            pak.load(pakPath, tailOnly);
+            const PakItem &item = findItem(pak, "Large/tail");
+            expect(vector<byte>(item.payload(), item.payload() + item.length) == tail, "filtered load reads the item at the offset limit");
+
+            string unpackDir = dir + pathsep + "near_limit";
+            UnpackOptions options;
+            options.filter = tailOnly;
+            unpack(pak, unpackDir, options);
+            string unpacked = unpackDir + pathsep + "Large/tail";
+            ifstream fin(unpacked, ios::binary);
+            vector<byte> data((istreambuf_iterator<char>(fin)), istreambuf_iterator<char>());
+            expect(data == tail, "unpacked item at the offset limit");
+        }
+        {
+            PakFile pak;
+            pak.loadMapped(pakPath);
+            const PakItem &item = findItem(pak, "Large/tail");
+            expect(vector<byte>(item.payload(), item.payload() + item.length) == tail, "mapped load reads the item at the offset limit");
+        }
+        remove(pakPath.c_str());
+
+        // a 3 GiB input file, refused by its size
+        string inputDir = dir + pathsep + "oversized";
+        if (!pathExists(inputDir.c_str()))
+            createDirectory(inputDir.c_str());
+        {
+            ofstream meta(inputDir + pathsep + "scpak.meta");
+            meta << "huge:System.Byte[]:" << endl;
+            ofstream fout(inputDir + pathsep + "huge", ios::binary | ios::trunc);
+            fout.seekp((int64_t(3) << 30) - 1);
+            fout.put(0);
+        }
+        bool refused = false;
+        Stopwatch watch;
+        try
+        {
+            packAll(inputDir);
+        }
+        catch (const exception &e)
+        {
+            refused = string(e.what()).find("too large") != string::npos;
+        }
+        remove((inputDir + pathsep + "huge").c_str());
+        expect(refused && watch.elapsed() < 10, "3 GiB input refused before reading it");
+
+        // payloads that fit one by one but not together
+        PakFile pak;
+        byte dummy = 0;
+        for (int i = 0; i < 2; ++i)
+        {
+            PakItem item;
+            item.name = "half" + to_string(i);
+            item.type = "System.Byte[]";
+            item.length = maxPakOffset / 2 + 1;
+            item.view = &dummy; // never read, save() checks sizes first
+            pak.addItem(move(item));
+        }
+        ostringstream out;
+        refused = false;
+        try
+        {
+            pak.save(out);
+        }
+        catch (const BadPakException &)
+        {
+            refused = true;
+        }
+        expect(refused && out.str().empty(), "contents past the offset limit refused before writing");
+    }
+
+    void printUsage(const char *programName)
+    {
+        cout << "Usage: " << programName << " [options]" << endl;
+        cout << "Options:" << endl;
+        cout << "  --seed N               corpus random seed (default 1)" << endl;
+        cout << "  --scale F              multiply every item count by F" << endl;
+        cout << "  --textures N           number of Texture2D items" << endl;
+        cout << "  --texture-sizes A,B,.. edge lengths used round-robin for textures" << endl;
+        cout << "  --mips N               mipmap levels per texture, 0 for a full chain" << endl;
+        cout << "  --fonts N              number of BitmapFont items" << endl;
+        cout << "  --glyphs N             glyphs per font" << endl;
+        cout << "  --atlas N              font atlas edge length" << endl;
+        cout << "  --sounds N             number of SoundBuffer items" << endl;
+        cout << "  --sound-seconds F      length of every sound" << endl;
+        cout << "  --xml N                number of XElement items" << endl;
+        cout << "  --xml-size N           approximate bytes per XElement item" << endl;
+        cout << "  --strings N            number of String items" << endl;
+        cout << "  --raw N                number of raw items" << endl;
+        cout << "  --raw-size N           bytes per raw item" << endl;
+        cout << "  --repeat N             run every measurement N times (default 3)" << endl;
+        cout << "  --work-dir DIR         where the corpus and outputs go (default scpak_bench)" << endl;
+        cout << "  --output FILE          write the JSON report to FILE instead of stdout" << endl;
+        cout << "  --generate DIR         only generate a corpus in DIR and pack it to DIR.pak" << endl;
+        cout << "  --check-large-files DIR" << endl;
+        cout << "                         only check paks and inputs at the 32-bit limits, with sparse files in DIR" << endl;
+    }
+
+    vector<int> parseIntList(const string &value)
+    {
+        vector<int> result;
+        stringstream ss(value);
+        string part;
+        while (getline(ss, part, ','))
+            result.push_back(stoi(part));
+        return result;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bench::CorpusSpec spec;
+    int repeat = 3;
+    string workDir = "scpak_bench";
+    string outputPath;
+    string generateDir;
+    string largeFilesDir;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            cerr << "error: missing value for " << arg << endl;
+            return 1;
+        }
+        string value = argv[++i];
+        if (arg == "--seed")
+            spec.seed = static_cast<uint32_t>(stoul(value));
+        else if (arg == "--scale")
+            spec.scale(stof(value));
+        else if (arg == "--textures")
+            spec.textureCount = stoi(value);
+        else if (arg == "--texture-sizes")
+            spec.textureSizes = parseIntList(value);
+        else if (arg == "--mips")
+            spec.mipmapLevel = stoi(value);
+        else if (arg == "--fonts")
+            spec.fontCount = stoi(value);
+        else if (arg == "--glyphs")
+            spec.fontGlyphCount = stoi(value);
+        else if (arg == "--atlas")
+            spec.fontAtlasSize = stoi(value);
+        else if (arg == "--sounds")
+            spec.soundCount = stoi(value);
+        else if (arg == "--sound-seconds")
+            spec.soundSeconds = stof(value);
+        else if (arg == "--xml")
+            spec.xmlCount = stoi(value);
+        else if (arg == "--xml-size")
+            spec.xmlSize = stoi(value);
+        else if (arg == "--strings")
+            spec.stringCount = stoi(value);
+        else if (arg == "--raw")
+            spec.rawCount = stoi(value);
+        else if (arg == "--raw-size")
+            spec.rawSize = stoi(value);
+        else if (arg == "--repeat")
+            repeat = max(1, stoi(value));
+        else if (arg == "--work-dir")
+            workDir = value;
+        else if (arg == "--output")
+            outputPath = value;
+        else if (arg == "--generate")
+            generateDir = value;
+        else if (arg == "--check-large-files")
+            largeFilesDir = value;
+        else
+        {
+            cerr << "error: unrecognized command line option " << arg << endl;
+            return 1;
+        }
+    }
+    if (spec.textureSizes.empty())
+    {
+        cerr << "error: --texture-sizes must not be empty" << endl;
+        return 1;
+    }
+
+    try
+    {
+        if (!largeFilesDir.empty())
+        {
+            checkLargeFiles(largeFilesDir);
+            return 0;
+        }
+        if (!generateDir.empty())
+        {
+            bench::generateCorpus(generateDir, spec);
+            PakFile pak = packAll(generateDir);
+            ofstream fout(generateDir + ".pak", ios::binary);
+            pak.save(fout);
+            return 0;
+        }
+
+        Report report;
+        if (!pathExists(workDir.c_str()))
+            createDirectory(workDir.c_str());
+        string corpusDir = workDir + pathsep + "corpus";
+        string pakPath = workDir + pathsep + "corpus.pak";
+        string unpackDir = workDir + pathsep + "unpacked";
+
+        {
+            Stopwatch watch;
+            bench::generateCorpus(corpusDir, spec);
+            report.record("corpus/generate", watch.elapsed(), 0, 0);
+        }
+        checkMinify(workDir + pathsep + "minify");
+        for (int run = 0; run < repeat; ++run)
+        {
+            PakFile pak = benchPack(report, corpusDir);
+            benchSaveLoad(report, pak, pakPath);
+            benchCompress(report, pakPath);
+            benchLibrary(report, pakPath);
+            benchRoundTrip(report, pak);
+            benchUnpack(report, pak, unpackDir);
+            benchBinaryIO(report);
+            benchMipmap(report, spec);
+            benchResample(report, spec);
+        }
+
+        if (outputPath.empty())
+            report.writeJson(cout, spec, repeat);
+        else
+        {
+            ofstream fout(outputPath);
+            report.writeJson(fout, spec, repeat);
+        }
+    }
+    catch (const exception &e)
+    {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    catch (const BaseException &e)
+    {
+        cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
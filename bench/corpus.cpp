@@ -0,0 +1,274 @@
+#include "corpus.h"
+#include "scpak.h"
+#include "native.h"
+#include "wav.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "stb/stb_image_write.h"
+
+
+namespace scpak
+{
+    namespace bench
+    {
+        void CorpusSpec::scale(float factor)
+        {
+            auto scaleCount = [factor](int &count)
+            {
+                count = std::max(1, static_cast<int>(count * factor + 0.5f));
+            };
+            scaleCount(textureCount);
+            scaleCount(fontCount);
+            scaleCount(soundCount);
+            scaleCount(xmlCount);
+            scaleCount(stringCount);
+            scaleCount(rawCount);
+        }
+
+        namespace
+        {
+            // xorshift32, good enough for filler data and fully deterministic
+            class Random
+            {
+            public:
+                explicit Random(std::uint32_t seed) : m_state(seed != 0 ? seed : 0x9E3779B9u) { }
+
+                std::uint32_t next()
+                {
+                    m_state ^= m_state << 13;
+                    m_state ^= m_state >> 17;
+                    m_state ^= m_state << 5;
+                    return m_state;
+                }
+
+                int range(int n)
+                {
+                    return static_cast<int>(next() % static_cast<std::uint32_t>(n));
+                }
+            private:
+                std::uint32_t m_state;
+            };
+
+            const char *words[] = {
+                "block", "terrain", "furnace", "sapling", "creature", "cactus", "granite", "bucket",
+                "lantern", "pumpkin", "sandstone", "trapdoor", "electric", "leaves", "diamond", "water"
+            };
+            const int wordCount = sizeof(words) / sizeof(words[0]);
+
+            void ensureDirectory(const std::string &root, const std::string &relative)
+            {
+                std::string path = root;
+                std::size_t p = 0;
+                while (p != std::string::npos)
+                {
+                    std::size_t next = relative.find('/', p);
+                    path += pathsep + relative.substr(p, next - p);
+                    if (!pathExists(path.c_str()))
+                        createDirectory(path.c_str());
+                    p = next == std::string::npos ? next : next + 1;
+                }
+            }
+
+            std::vector<byte> makeImage(Random &random, int width, int height)
+            {
+                std::vector<byte> image(static_cast<std::size_t>(width) * height * 4);
+                std::uint32_t base = random.next();
+                for (int y = 0; y < height; ++y)
+                    for (int x = 0; x < width; ++x)
+                    {
+                        byte *pixel = image.data() + (static_cast<std::size_t>(y) * width + x) * 4;
+                        std::uint32_t noise = random.next();
+                        pixel[0] = static_cast<byte>(x * 255 / width + (noise & 15));
+                        pixel[1] = static_cast<byte>(y * 255 / height + ((noise >> 4) & 15));
+                        pixel[2] = static_cast<byte>(base + ((noise >> 8) & 63));
+                        pixel[3] = static_cast<byte>(255 - ((noise >> 16) & 3));
+                    }
+                return image;
+            }
+
+            void writeImage(const std::string &fileName, Random &random, int width, int height)
+            {
+                std::vector<byte> image = makeImage(random, width, height);
+                if (!stbi_write_tga(fileName.c_str(), width, height, 4, image.data()))
+                    throw std::runtime_error("cannot write " + fileName);
+            }
+
+            void writeFont(const std::string &baseName, Random &random, const CorpusSpec &spec)
+            {
+                int atlas = spec.fontAtlasSize;
+                int cellsPerRow = static_cast<int>(std::ceil(std::sqrt(static_cast<double>(spec.fontGlyphCount))));
+                float cell = 1.0f / cellsPerRow;
+
+                std::ofstream fList(baseName + ".lst");
+                fList << spec.fontGlyphCount << std::endl;
+                for (int i = 0; i < spec.fontGlyphCount; ++i)
+                {
+                    float u = (i % cellsPerRow) * cell;
+                    float v = (i / cellsPerRow) * cell;
+                    float glyphWidth = cell * (0.5f + random.range(50) / 100.0f);
+                    fList << 32 + i << '\t'
+                        << u << '\t' << v << '\t'
+                        << u + glyphWidth << '\t' << v + cell << '\t'
+                        << 0 << '\t' << random.range(3) << '\t'
+                        << glyphWidth * atlas << std::endl;
+                }
+                fList << cell * atlas << std::endl;
+                fList << 1 << '\t' << 0 << std::endl;
+                fList << 1 << std::endl;
+                fList << 63 << std::endl;
+
+                writeImage(baseName + ".tga", random, atlas, atlas);
+            }
+
+            void writeSound(const std::string &fileName, Random &random, const CorpusSpec &spec)
+            {
+                static const int channelCount = 2;
+                int frames = static_cast<int>(spec.soundSampleRate * spec.soundSeconds);
+                std::vector<std::int16_t> samples(static_cast<std::size_t>(frames) * channelCount);
+                double frequency = 110.0 + random.range(880);
+                for (int i = 0; i < frames; ++i)
+                {
+                    double tone = std::sin(2 * 3.14159265358979 * frequency * i / spec.soundSampleRate);
+                    int noise = random.range(512) - 256;
+                    samples[i * 2] = static_cast<std::int16_t>(tone * 12000 + noise);
+                    samples[i * 2 + 1] = static_cast<std::int16_t>(tone * 9000 - noise);
+                }
+
+                WavHeader header;
+                WavHeader::SetMagicValues(header);
+                header.channelCount = channelCount;
+                header.sampleRate = spec.soundSampleRate;
+                header.bitsPerSample = 16;
+                header.blockAlign = static_cast<std::uint16_t>(channelCount * header.bitsPerSample / 8);
+                header.byteRate = header.sampleRate * header.blockAlign;
+                header.subchunk2Size = static_cast<std::uint32_t>(samples.size() * sizeof(std::int16_t));
+                header.chunkSize = header.subchunk2Size + 36;
+
+                std::ofstream fout(fileName, std::ios::binary);
+                fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                fout.write(reinterpret_cast<const char*>(samples.data()), header.subchunk2Size);
+            }
+
+            void writeXml(const std::string &fileName, Random &random, const CorpusSpec &spec)
+            {
+                std::ostringstream xml;
+                xml << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n";
+                xml << "<Database>\r\n";
+                xml << "  <!-- synthetic scpak benchmark data -->\r\n";
+                xml << "  <DatabaseObjects>\r\n";
+                int index = 0;
+                while (static_cast<int>(xml.tellp()) < spec.xmlSize)
+                {
+                    xml << "    <Folder Name=\"" << words[random.range(wordCount)] << index << "\" Guid=\""
+                        << std::hex << random.next() << "-" << random.next() << std::dec << "\">\r\n";
+                    int parameters = 2 + random.range(6);
+                    for (int i = 0; i < parameters; ++i)
+                        xml << "      <Parameter Name=\"" << words[random.range(wordCount)]
+                            << "\" Value=\"" << random.range(100000) << "\" Type=\"int\" />\r\n";
+                    if (random.range(4) == 0)
+                        xml << "      <!-- " << words[random.range(wordCount)] << " settings -->\r\n";
+                    xml << "    </Folder>\r\n";
+                    ++index;
+                }
+                xml << "  </DatabaseObjects>\r\n";
+                xml << "</Database>\r\n";
+
+                std::ofstream fout(fileName, std::ios::binary);
+                std::string content = xml.str();
+                fout.write(content.data(), content.length());
+            }
+
+            void writeText(const std::string &fileName, Random &random, const CorpusSpec &spec)
+            {
+                std::ofstream fout(fileName, std::ios::binary);
+                int written = 0;
+                while (written < spec.stringSize)
+                {
+                    const char *word = words[random.range(wordCount)];
+                    fout << word << (random.range(12) == 0 ? "\r\n" : " ");
+                    written += static_cast<int>(std::string(word).length()) + 1;
+                }
+            }
+
+            void writeRaw(const std::string &fileName, Random &random, const CorpusSpec &spec)
+            {
+                // first half noise, second half a repeating pattern, roughly
+                // like the mixed compressibility of models and shaders
+                std::vector<byte> data(spec.rawSize);
+                std::size_t half = data.size() / 2;
+                for (std::size_t i = 0; i < half; ++i)
+                    data[i] = static_cast<byte>(random.next());
+                for (std::size_t i = half; i < data.size(); ++i)
+                    data[i] = static_cast<byte>(i % 61);
+                std::ofstream fout(fileName, std::ios::binary);
+                fout.write(reinterpret_cast<const char*>(data.data()), data.size());
+            }
+        }
+
+        void generateCorpus(const std::string &dirPath, const CorpusSpec &spec)
+        {
+            Random random(spec.seed);
+            if (!pathExists(dirPath.c_str()))
+                createDirectory(dirPath.c_str());
+            std::string root = dirPath + pathsep;
+            std::ofstream meta(root + PakInfoFileName);
+
+            ensureDirectory(dirPath, "Textures/Bench");
+            for (int i = 0; i < spec.textureCount; ++i)
+            {
+                int size = spec.textureSizes[i % spec.textureSizes.size()];
+                int level = spec.mipmapLevel;
+                if (level == 0)
+                    for (int s = size; s > 0; s /= 2)
+                        ++level;
+                std::string name = "Textures/Bench/texture" + std::to_string(i);
+                writeImage(root + name + ".tga", random, size, size);
+                meta << name << ":Engine.Graphics.Texture2D:0 " << level << std::endl;
+            }
+
+            ensureDirectory(dirPath, "Fonts");
+            for (int i = 0; i < spec.fontCount; ++i)
+            {
+                std::string name = "Fonts/Font" + std::to_string(i);
+                writeFont(root + name, random, spec);
+                meta << name << ":Engine.Media.BitmapFont:" << std::endl;
+            }
+
+            ensureDirectory(dirPath, "Audio/Bench");
+            for (int i = 0; i < spec.soundCount; ++i)
+            {
+                std::string name = "Audio/Bench/sound" + std::to_string(i);
+                writeSound(root + name + ".wav", random, spec);
+                meta << name << ":Engine.Audio.SoundBuffer:" << std::endl;
+            }
+
+            ensureDirectory(dirPath, "Database");
+            for (int i = 0; i < spec.xmlCount; ++i)
+            {
+                std::string name = "Database/Database" + std::to_string(i);
+                writeXml(root + name + ".xml", random, spec);
+                meta << name << ":System.Xml.Linq.XElement:" << std::endl;
+            }
+
+            ensureDirectory(dirPath, "Lang");
+            for (int i = 0; i < spec.stringCount; ++i)
+            {
+                std::string name = "Lang/string" + std::to_string(i);
+                writeText(root + name + ".txt", random, spec);
+                meta << name << ":System.String:" << std::endl;
+            }
+
+            ensureDirectory(dirPath, "Models");
+            for (int i = 0; i < spec.rawCount; ++i)
+            {
+                std::string name = "Models/model" + std::to_string(i);
+                writeRaw(root + name, random, spec);
+                meta << name << ":Engine.Graphics.Model:" << std::endl;
+            }
+        }
+    }
+}
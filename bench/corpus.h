@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace scpak
+{
+    namespace bench
+    {
+        // describes a synthetic content tree; the same spec and seed always
+        // produce byte-identical files
+        struct CorpusSpec
+        {
+            std::uint32_t seed = 1;
+
+            int textureCount = 48;
+            std::vector<int> textureSizes = { 64, 256, 1024 }; // used round-robin
+            int mipmapLevel = 0; // 0 - full mip chain
+
+            int fontCount = 4;
+            int fontGlyphCount = 512;
+            int fontAtlasSize = 512;
+
+            int soundCount = 24;
+            int soundSampleRate = 44100;
+            float soundSeconds = 2.0f;
+
+            int xmlCount = 8;
+            int xmlSize = 256 * 1024;
+
+            int stringCount = 32;
+            int stringSize = 4 * 1024;
+
+            int rawCount = 32;
+            int rawSize = 64 * 1024;
+
+            void scale(float factor);
+        };
+
+        // writes the source files and scpak.meta of a content directory,
+        // which can then be packed with scpak::pack
+        void generateCorpus(const std::string &dirPath, const CorpusSpec &spec);
+    }
+}
@@ -1,5 +1,6 @@
 #include "binaryio.h"
 #include <stdexcept>
+#include <limits>
 
 namespace scpak
 {
@@ -125,10 +126,20 @@ namespace scpak
     {
         position = 0;
         m_buffer = buffer;
+        m_size = std::numeric_limits<std::size_t>::max();
+    }
+
+    MemoryBinaryReader::MemoryBinaryReader(const byte *buffer, std::size_t size)
+    {
+        position = 0;
+        m_buffer = buffer;
+        m_size = size;
     }
 
     byte MemoryBinaryReader::readByte()
     {
+        if (position >= m_size)
+            throw std::runtime_error("read past end of buffer");
         return m_buffer[position++];
     }
 
@@ -260,7 +271,12 @@ namespace scpak
 
     void BinaryWriter::writeString(const std::string &value)
     {
-        write7BitEncodedInt(value.length());
-        writeBytes(value.length(), reinterpret_cast<const byte*>(value.data()));
+        writeString(value.data(), value.length());
+    }
+
+    void BinaryWriter::writeString(const char *value, std::size_t length)
+    {
+        write7BitEncodedInt(static_cast<int>(length));
+        writeBytes(static_cast<int>(length), reinterpret_cast<const byte*>(value));
     }
 }
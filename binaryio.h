@@ -39,11 +39,14 @@ namespace scpak
     {
     public:
         MemoryBinaryReader(const byte *buffer);
+        // reads past size throw instead of running off the buffer
+        MemoryBinaryReader(const byte *buffer, std::size_t size);
         unsigned position;
 
         byte readByte();
     private:
         const byte *m_buffer;
+        std::size_t m_size;
     };
 
     class BinaryWriter
@@ -57,6 +60,7 @@ namespace scpak
         int writeUtf8Char(int value);
         void writeBoolean(bool value);
         void writeString(const std::string &value);
+        void writeString(const char *value, std::size_t length);
     private:
         std::ostream *m_stream;
     };
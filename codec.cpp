@@ -0,0 +1,75 @@
+#include "codec.h"
+
+
+namespace scpak
+{
+    namespace
+    {
+        void packString(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source)
+        {
+            pack_string(inputDir, item, source);
+        }
+
+        void packXElement(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source)
+        {
+            if (options.minifyXml)
+                pack_xmlMinified(inputDir, item, options.report, source);
+            else
+                pack_string(inputDir, item, source);
+        }
+
+        void packTexture(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source)
+        {
+            pack_texture(inputDir, item, meta, source, options.textureScale);
+        }
+
+        void packBitmapFont(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source)
+        {
+            pack_bitmapFont(inputDir, item, source, options.textureScale, options.compactFonts);
+        }
+
+        void packSoundBuffer(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source)
+        {
+            pack_soundBuffer(inputDir, item, source, options.sampleRate, options.monoSound);
+        }
+
+        std::string unpackString(const std::string &outputDir, const PakItem &item, const UnpackOptions &options, FileWriter &writer)
+        {
+            unpack_string(outputDir, item, writer);
+            return "";
+        }
+
+        std::string unpackTexture(const std::string &outputDir, const PakItem &item, const UnpackOptions &options, FileWriter &writer)
+        {
+            return unpack_texture(outputDir, item, writer);
+        }
+
+        std::string unpackBitmapFont(const std::string &outputDir, const PakItem &item, const UnpackOptions &options, FileWriter &writer)
+        {
+            unpack_bitmapFont(outputDir, item, writer);
+            return "";
+        }
+
+        std::string unpackSoundBuffer(const std::string &outputDir, const PakItem &item, const UnpackOptions &options, FileWriter &writer)
+        {
+            unpack_soundBuffer(outputDir, item, writer);
+            return "";
+        }
+
+        const ItemCodec codecs[] = {
+            { nullptr, nullptr, nullptr, nullptr },
+            { &PackOptions::packText, packString, &UnpackOptions::unpackText, unpackString },
+            { &PackOptions::packText, packXElement, &UnpackOptions::unpackText, unpackString },
+            { &PackOptions::packTexture, packTexture, &UnpackOptions::unpackTexture, unpackTexture },
+            { &PackOptions::packFont, packBitmapFont, &UnpackOptions::unpackBitmapFont, unpackBitmapFont },
+            { &PackOptions::packSound, packSoundBuffer, &UnpackOptions::unpackSound, unpackSoundBuffer }
+        };
+        static_assert(sizeof(codecs) / sizeof(codecs[0]) == static_cast<std::size_t>(ItemType::Count),
+            "every item type needs a codec entry");
+    }
+
+    const ItemCodec &itemCodec(ItemType type)
+    {
+        return codecs[static_cast<int>(type)];
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "itemtype.h"
+#include "pack.h"
+#include "unpack.h"
+
+namespace scpak
+{
+    // built-in pack and unpack entry points of one item type, and the
+    // option that turns each of them on
+    struct ItemCodec
+    {
+        bool PackOptions::*packEnabled;
+        void (*pack)(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source);
+        bool UnpackOptions::*unpackEnabled;
+        std::string (*unpack)(const std::string &outputDir, const PakItem &item, const UnpackOptions &options, FileWriter &writer);
+    };
+
+    // all members are null for ItemType::Other
+    const ItemCodec &itemCodec(ItemType type);
+}
@@ -0,0 +1,111 @@
+#include "filesource.h"
+#include "native.h"
+#include "trace.h"
+#include <fstream>
+#include <stdexcept>
+
+
+namespace scpak
+{
+    namespace
+    {
+        class DiskFileSource : public FileSource
+        {
+        public:
+            bool exists(const std::string &path) override
+            {
+                return pathExists(path.c_str());
+            }
+
+            std::int64_t size(const std::string &path) override
+            {
+                return getFileSize(path.c_str());
+            }
+
+            std::vector<byte> read(const std::string &path) override
+            {
+                TraceScope scope("io", "read");
+                std::ifstream file(path, std::ios::binary);
+                if (!file)
+                    throw std::runtime_error("cannot open " + path);
+                file.seekg(0, std::ios::end);
+                std::streamoff size = file.tellg();
+                file.seekg(0, std::ios::beg);
+                std::vector<byte> data(static_cast<std::size_t>(size));
+                if (!file.read(reinterpret_cast<char*>(data.data()), size))
+                    throw std::runtime_error("failed to read " + path);
+                return data;
+            }
+        };
+
+        class MappedFileSource : public DiskFileSource
+        {
+        public:
+            // below this a read is cheaper than setting up a mapping
+            static const std::int64_t minMappedSize = 64 * 1024;
+
+            bool map(const std::string &path, FileView &view) override
+            {
+                if (getFileSize(path.c_str()) < minMappedSize)
+                    return false;
+                TraceScope scope("io", "map");
+                std::shared_ptr<MappedFile> mapping;
+                try
+                {
+                    mapping = std::make_shared<MappedFile>(path.c_str());
+                }
+                catch (const std::runtime_error &)
+                {
+                    // e.g. out of mappings, read() still works
+                    return false;
+                }
+                view.data = mapping->data();
+                view.size = mapping->size();
+                view.owner = mapping;
+                return true;
+            }
+        };
+    }
+
+    FileSource &diskFileSource()
+    {
+        static DiskFileSource source;
+        return source;
+    }
+
+    FileSource &mappedFileSource()
+    {
+        static MappedFileSource source;
+        return source;
+    }
+
+    bool MemoryFileSource::exists(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_files.count(path) != 0;
+    }
+
+    std::int64_t MemoryFileSource::size(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_files.find(path);
+        if (it == m_files.end())
+            throw std::runtime_error("cannot open " + path);
+        return static_cast<std::int64_t>(it->second.size());
+    }
+
+    std::vector<byte> MemoryFileSource::read(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_files.find(path);
+        if (it == m_files.end())
+            throw std::runtime_error("cannot open " + path);
+        return it->second;
+    }
+
+    void MemoryFileSource::add(const std::string &path, std::vector<byte> data)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_files[path] = std::move(data);
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+#include "scpak.h"
+
+namespace scpak
+{
+    // bytes of a file that stay valid for as long as owner is alive
+    struct FileView
+    {
+        const byte *data = nullptr;
+        std::size_t size = 0;
+        std::shared_ptr<const void> owner;
+    };
+
+    // Where packers read their input files from: the filesystem, or files
+    // held in memory, e.g. by a round trip that never touches the disk.
+    class FileSource
+    {
+    public:
+        virtual ~FileSource() { }
+
+        virtual bool exists(const std::string &path) = 0;
+        // size in bytes without reading the file, so that packers can refuse
+        // what does not fit a pak before loading it
+        virtual std::int64_t size(const std::string &path) = 0;
+        // the whole file, throws std::runtime_error if it cannot be read
+        virtual std::vector<byte> read(const std::string &path) = 0;
+        // the whole file without copying it, if the source can; packers fall
+        // back to read() when this returns false
+        virtual bool map(const std::string &path, FileView &view)
+        {
+            return false;
+        }
+    };
+
+    // reads files from disk, stateless and shared by all threads
+    FileSource &diskFileSource();
+    // reads files from disk too, but maps the larger ones so that packed
+    // items can point into them instead of holding a copy. A mapped file
+    // must not be truncated while items use it, so this is for one-shot
+    // packs, not for items that are cached across edits.
+    FileSource &mappedFileSource();
+
+    class MemoryFileSource : public FileSource
+    {
+    public:
+        bool exists(const std::string &path) override;
+        std::int64_t size(const std::string &path) override;
+        std::vector<byte> read(const std::string &path) override;
+
+        void add(const std::string &path, std::vector<byte> data);
+    private:
+        std::mutex m_mutex;
+        std::map<std::string, std::vector<byte>> m_files;
+    };
+}
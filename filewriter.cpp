@@ -0,0 +1,504 @@
+#include "filewriter.h"
+#include "trace.h"
+#include <fstream>
+#include <stdexcept>
+#include <exception>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <initializer_list>
+
+#if defined(__linux__) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  define SCPAK_HAVE_IO_URING
+# endif
+#endif
+
+#ifdef SCPAK_HAVE_IO_URING
+# include <linux/io_uring.h>
+# include <sys/syscall.h>
+# include <sys/mman.h>
+# include <sys/uio.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <cerrno>
+#endif
+
+
+namespace scpak
+{
+    bool parseFileWriterBackend(const std::string &text, FileWriterBackend &backend)
+    {
+        if (text == "sync")
+            backend = FileWriterBackend::Sync;
+        else if (text == "threads")
+            backend = FileWriterBackend::Threads;
+        else if (text == "io_uring")
+            backend = FileWriterBackend::IoUring;
+        else
+            return false;
+        return true;
+    }
+
+    namespace
+    {
+        void writeFile(const OutputFile &file, DirectoryCache *directories)
+        {
+            TraceScope scope("io", "write file", file.path);
+            std::string relativePath = directories != nullptr ? directories->relative(file.path) : std::string();
+            if (!relativePath.empty())
+            {
+                WritePart parts[] = { { file.data.data(), file.data.size() }, { file.view, file.viewSize } };
+                directories->writeFile(relativePath, parts, file.view != nullptr ? 2 : 1);
+                return;
+            }
+            std::ofstream fout(file.path, std::ios::binary);
+            if (!fout)
+                throw std::runtime_error("cannot open " + file.path);
+            fout.write(reinterpret_cast<const char*>(file.data.data()), file.data.size());
+            if (file.view != nullptr)
+                fout.write(reinterpret_cast<const char*>(file.view), file.viewSize);
+            if (!fout)
+                throw std::runtime_error("failed to write " + file.path);
+        }
+
+        class SyncFileWriter : public FileWriter
+        {
+        public:
+            explicit SyncFileWriter(DirectoryCache *directories) : m_directories(directories) { }
+
+            virtual void write(OutputFile file)
+            {
+                writeFile(file, m_directories);
+            }
+
+            virtual void flush() { }
+
+            virtual const char *name() const
+            {
+                return "sync";
+            }
+        private:
+            DirectoryCache *m_directories;
+        };
+
+        class ThreadPoolFileWriter : public FileWriter
+        {
+        public:
+            ThreadPoolFileWriter(int queueDepth, const char *name, DirectoryCache *directories) :
+                m_queueDepth(static_cast<std::size_t>(std::max(1, queueDepth))), m_name(name), m_directories(directories),
+                m_busy(0), m_stopping(false)
+            {
+                unsigned threadCount = std::max(2u, std::thread::hardware_concurrency());
+                threadCount = std::min(threadCount, static_cast<unsigned>(m_queueDepth));
+                for (unsigned i = 0; i < threadCount; ++i)
+                    m_threads.emplace_back(&ThreadPoolFileWriter::run, this, i);
+            }
+
+            ~ThreadPoolFileWriter()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stopping = true;
+                }
+                m_queued.notify_all();
+                for (std::thread &thread : m_threads)
+                    thread.join();
+            }
+
+            virtual void write(OutputFile file)
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done.wait(lock, [this]() { return m_queue.size() < m_queueDepth; });
+                m_queue.push_back(std::move(file));
+                m_queued.notify_one();
+            }
+
+            virtual void flush()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done.wait(lock, [this]() { return m_queue.empty() && m_busy == 0; });
+                if (m_error)
+                {
+                    std::exception_ptr error = m_error;
+                    m_error = nullptr;
+                    std::rethrow_exception(error);
+                }
+            }
+
+            virtual const char *name() const
+            {
+                return m_name;
+            }
+        private:
+            void run(unsigned index)
+            {
+                Trace::setThreadName("writer " + std::to_string(index));
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true)
+                {
+                    m_queued.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+                    if (m_queue.empty())
+                        return;
+                    OutputFile file = std::move(m_queue.front());
+                    m_queue.pop_front();
+                    ++m_busy;
+                    lock.unlock();
+                    std::exception_ptr error;
+                    try
+                    {
+                        writeFile(file, m_directories);
+                    }
+                    catch (...)
+                    {
+                        error = std::current_exception();
+                    }
+                    lock.lock();
+                    if (error && !m_error)
+                        m_error = error;
+                    --m_busy;
+                    m_done.notify_all();
+                }
+            }
+
+            std::size_t m_queueDepth;
+            const char *m_name;
+            DirectoryCache *m_directories;
+            std::mutex m_mutex;
+            std::condition_variable m_queued;
+            std::condition_variable m_done;
+            std::deque<OutputFile> m_queue;
+            std::vector<std::thread> m_threads;
+            int m_busy;
+            bool m_stopping;
+            std::exception_ptr m_error;
+        };
+
+#ifdef SCPAK_HAVE_IO_URING
+        // Minimal io_uring ring on top of the raw system calls, so that
+        // liburing is not needed. Only the calling thread touches the ring.
+        class IoUring
+        {
+        public:
+            IoUring() : m_fd(-1), m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED), m_sqes(MAP_FAILED), m_pending(0) { }
+
+            ~IoUring()
+            {
+                if (m_sqes != MAP_FAILED)
+                    munmap(m_sqes, m_sqesSize);
+                if (m_cqRing != MAP_FAILED && m_cqRing != m_sqRing)
+                    munmap(m_cqRing, m_cqRingSize);
+                if (m_sqRing != MAP_FAILED)
+                    munmap(m_sqRing, m_sqRingSize);
+                if (m_fd != -1)
+                    close(m_fd);
+            }
+
+            IoUring(const IoUring &) = delete;
+            IoUring &operator=(const IoUring &) = delete;
+
+            // false if the kernel has no io_uring (or forbids it) or lacks
+            // the operations used here
+            bool open(unsigned entries)
+            {
+                io_uring_params params;
+                std::memset(&params, 0, sizeof(params));
+                m_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+                if (m_fd < 0)
+                    return false;
+                m_entries = params.sq_entries;
+
+                m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+                m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+                bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+                if (singleMap)
+                    m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+                m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+                if (m_sqRing == MAP_FAILED)
+                    return false;
+                m_cqRing = singleMap ? m_sqRing :
+                    mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+                if (m_cqRing == MAP_FAILED)
+                    return false;
+                m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+                m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+                if (m_sqes == MAP_FAILED)
+                    return false;
+
+                char *sq = static_cast<char*>(m_sqRing);
+                m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+                m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+                m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+                m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+                char *cq = static_cast<char*>(m_cqRing);
+                m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+                m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+                m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+                m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+                return supports({ IORING_OP_OPENAT, IORING_OP_WRITEV, IORING_OP_CLOSE });
+            }
+
+            unsigned entries() const
+            {
+                return m_entries;
+            }
+
+            // the returned entry is zeroed, the ring must not be full
+            io_uring_sqe *next()
+            {
+                unsigned tail = *m_sqTail + m_pending;
+                unsigned index = tail & m_sqMask;
+                m_sqArray[index] = index;
+                ++m_pending;
+                io_uring_sqe *sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+                std::memset(sqe, 0, sizeof(*sqe));
+                return sqe;
+            }
+
+            // submits every prepared entry and calls complete(user_data, res)
+            // for each of their completions
+            template<typename Complete>
+            void run(const Complete &complete)
+            {
+                unsigned count = m_pending;
+                __atomic_store_n(m_sqTail, *m_sqTail + m_pending, __ATOMIC_RELEASE);
+                m_pending = 0;
+                unsigned submitted = 0;
+                unsigned completed = 0;
+                while (completed < count)
+                {
+                    long result = syscall(__NR_io_uring_enter, m_fd, count - submitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                    if (result < 0)
+                    {
+                        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                            continue;
+                        throw std::runtime_error("io_uring_enter failed: " + std::string(std::strerror(errno)));
+                    }
+                    submitted += static_cast<unsigned>(result);
+                    unsigned head = *m_cqHead;
+                    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+                    for (; head != tail; ++head, ++completed)
+                    {
+                        const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+                        complete(cqe.user_data, cqe.res);
+                    }
+                    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+                }
+            }
+        private:
+            bool supports(std::initializer_list<int> ops)
+            {
+                std::vector<char> buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+                io_uring_probe *probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+                if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+                    return false;
+                for (int op : ops)
+                    if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+                        return false;
+                return true;
+            }
+
+            int m_fd;
+            unsigned m_entries;
+            void *m_sqRing;
+            void *m_cqRing;
+            void *m_sqes;
+            std::size_t m_sqRingSize;
+            std::size_t m_cqRingSize;
+            std::size_t m_sqesSize;
+            unsigned *m_sqHead;
+            unsigned *m_sqTail;
+            unsigned m_sqMask;
+            unsigned *m_sqArray;
+            unsigned *m_cqHead;
+            unsigned *m_cqTail;
+            unsigned m_cqMask;
+            io_uring_cqe *m_cqes;
+            unsigned m_pending;
+        };
+
+        // Collects up to a ring's worth of files, then opens all of them,
+        // writes all of them and closes all of them, one io_uring_enter per
+        // step, instead of three blocking system calls per file.
+        class IoUringFileWriter : public FileWriter
+        {
+        public:
+            explicit IoUringFileWriter(DirectoryCache *directories) : m_directories(directories) { }
+
+            bool open(int queueDepth)
+            {
+                if (!m_ring.open(static_cast<unsigned>(std::max(1, queueDepth))))
+                    return false;
+                m_queue.reserve(m_ring.entries());
+                return true;
+            }
+
+            virtual void write(OutputFile file)
+            {
+                m_queue.push_back(std::move(file));
+                if (m_queue.size() == m_ring.entries())
+                    flush();
+            }
+
+            virtual void flush()
+            {
+                if (m_queue.empty())
+                    return;
+                std::vector<OutputFile> batch;
+                batch.swap(m_queue);
+                m_queue.reserve(m_ring.entries());
+                writeBatch(batch);
+            }
+
+            virtual const char *name() const
+            {
+                return "io_uring";
+            }
+        private:
+            struct FileState
+            {
+                std::shared_ptr<DirectoryHandle> parent;
+                std::string leaf;
+                int fd = -1;
+                int error = 0;
+                std::size_t written = 0;
+                iovec parts[2];
+            };
+
+            void writeBatch(const std::vector<OutputFile> &batch)
+            {
+                TraceScope scope("io", "write batch", std::to_string(batch.size()) + " files");
+                std::vector<FileState> states(batch.size());
+
+                for (std::size_t i = 0; i < batch.size(); ++i)
+                {
+                    FileState &state = states[i];
+                    std::string relativePath = m_directories != nullptr ? m_directories->relative(batch[i].path) : std::string();
+                    if (!relativePath.empty())
+                        state.parent = m_directories->parentOf(relativePath, state.leaf);
+                    io_uring_sqe *sqe = m_ring.next();
+                    sqe->opcode = IORING_OP_OPENAT;
+                    sqe->fd = state.parent ? state.parent->fd : AT_FDCWD;
+                    sqe->addr = reinterpret_cast<std::uintptr_t>(state.parent ? state.leaf.c_str() : batch[i].path.c_str());
+                    sqe->len = 0666;
+                    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+                    sqe->user_data = i;
+                }
+                m_ring.run([&](std::uint64_t i, int res)
+                {
+                    if (res < 0)
+                        states[i].error = -res;
+                    else
+                        states[i].fd = res;
+                });
+
+                // regular files are normally written in full, but keep
+                // resubmitting the rest of short writes
+                bool remaining = true;
+                while (remaining)
+                {
+                    remaining = false;
+                    for (std::size_t i = 0; i < batch.size(); ++i)
+                    {
+                        FileState &state = states[i];
+                        const OutputFile &file = batch[i];
+                        std::size_t total = file.data.size() + file.viewSize;
+                        if (state.error != 0 || state.fd < 0 || state.written == total)
+                            continue;
+                        int partCount = 0;
+                        if (state.written < file.data.size())
+                        {
+                            state.parts[partCount].iov_base = const_cast<byte*>(file.data.data() + state.written);
+                            state.parts[partCount].iov_len = file.data.size() - state.written;
+                            ++partCount;
+                        }
+                        if (file.viewSize != 0)
+                        {
+                            std::size_t viewWritten = state.written > file.data.size() ? state.written - file.data.size() : 0;
+                            state.parts[partCount].iov_base = const_cast<byte*>(file.view + viewWritten);
+                            state.parts[partCount].iov_len = file.viewSize - viewWritten;
+                            ++partCount;
+                        }
+                        io_uring_sqe *sqe = m_ring.next();
+                        sqe->opcode = IORING_OP_WRITEV;
+                        sqe->fd = state.fd;
+                        sqe->addr = reinterpret_cast<std::uintptr_t>(state.parts);
+                        sqe->len = partCount;
+                        sqe->off = state.written;
+                        sqe->user_data = i;
+                        remaining = true;
+                    }
+                    if (!remaining)
+                        break;
+                    m_ring.run([&](std::uint64_t i, int res)
+                    {
+                        if (res < 0)
+                            states[i].error = -res;
+                        else if (res == 0)
+                            states[i].error = EIO;
+                        else
+                            states[i].written += static_cast<std::size_t>(res);
+                    });
+                }
+
+                bool closing = false;
+                for (std::size_t i = 0; i < batch.size(); ++i)
+                    if (states[i].fd >= 0)
+                    {
+                        io_uring_sqe *sqe = m_ring.next();
+                        sqe->opcode = IORING_OP_CLOSE;
+                        sqe->fd = states[i].fd;
+                        sqe->user_data = i;
+                        closing = true;
+                    }
+                if (closing)
+                    m_ring.run([&](std::uint64_t i, int res)
+                    {
+                        if (res < 0 && states[i].error == 0)
+                            states[i].error = -res;
+                    });
+
+                for (std::size_t i = 0; i < batch.size(); ++i)
+                    if (states[i].error != 0)
+                        throw std::runtime_error("failed to write " + batch[i].path + ": " + std::strerror(states[i].error));
+            }
+
+            DirectoryCache *m_directories;
+            IoUring m_ring;
+            std::vector<OutputFile> m_queue;
+        };
+#endif
+    }
+
+    void MemoryFileWriter::write(OutputFile file)
+    {
+        if (file.view != nullptr)
+            file.data.insert(file.data.end(), file.view, file.view + file.viewSize);
+        m_target.add(file.path, std::move(file.data));
+    }
+
+    std::unique_ptr<FileWriter> createFileWriter(FileWriterBackend backend, int queueDepth, DirectoryCache *directories)
+    {
+        switch (backend)
+        {
+        case FileWriterBackend::Sync:
+            return std::unique_ptr<FileWriter>(new SyncFileWriter(directories));
+        case FileWriterBackend::IoUring:
+        {
+#ifdef SCPAK_HAVE_IO_URING
+            std::unique_ptr<IoUringFileWriter> writer(new IoUringFileWriter(directories));
+            if (writer->open(queueDepth))
+                return std::move(writer);
+#endif
+            return std::unique_ptr<FileWriter>(new ThreadPoolFileWriter(queueDepth, "threads (io_uring unavailable)", directories));
+        }
+        default:
+            return std::unique_ptr<FileWriter>(new ThreadPoolFileWriter(queueDepth, "threads", directories));
+        }
+    }
+}
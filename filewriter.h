@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#include "scpak.h"
+#include "memtrack.h"
+#include "native.h"
+#include "filesource.h"
+
+namespace scpak
+{
+    enum class FileWriterBackend
+    {
+        Sync,     // write every file before returning, like plain ofstreams
+        Threads,  // hand files to a pool of writer threads
+        IoUring   // batch open/write/close through io_uring, Threads if unavailable
+    };
+
+    // parses "sync", "threads" or "io_uring", returns false otherwise
+    bool parseFileWriterBackend(const std::string &text, FileWriterBackend &backend);
+
+    // One file to be (over)written: data followed by the view, if any.
+    // The view is not owned and must stay valid until the writer is flushed;
+    // it lets payloads be written straight from the pak.
+    struct OutputFile
+    {
+        std::string path;
+        std::vector<byte> data;
+        const byte *view = nullptr;
+        std::size_t viewSize = 0;
+        TrackedBytes memory{MemoryCategory::ItemBuffer};
+    };
+
+    class FileWriter
+    {
+    public:
+        virtual ~FileWriter() { }
+
+        // queues a file, blocks while queueDepth files are already pending
+        virtual void write(OutputFile file) = 0;
+        // waits until every queued file is on disk, throws the first failure
+        virtual void flush() = 0;
+        // backend actually in use, after any fallback
+        virtual const char *name() const = 0;
+    };
+
+    // keeps written files in target instead of on disk, e.g. so that packers
+    // can read them back through it
+    class MemoryFileWriter : public FileWriter
+    {
+    public:
+        explicit MemoryFileWriter(MemoryFileSource &target) : m_target(target) { }
+
+        void write(OutputFile file) override;
+        void flush() override { }
+        const char *name() const override { return "memory"; }
+    private:
+        MemoryFileSource &m_target;
+    };
+
+    // files below the root of directories are created relative to its
+    // cached directory handles, it must outlive the writer
+    std::unique_ptr<FileWriter> createFileWriter(FileWriterBackend backend, int queueDepth = 64,
+        DirectoryCache *directories = nullptr);
+}
@@ -0,0 +1,207 @@
+#include "font.h"
+#include "binaryio.h"
+#include <stdexcept>
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+
+
+namespace scpak
+{
+    namespace
+    {
+        const int atlasBorder = 1;
+        const int maxAtlasSize = 1 << 15;
+        // texture coordinates within this many pixels of a pixel edge are on it
+        const double edgeTolerance = 1e-3;
+
+        struct AtlasRect
+        {
+            int x0, y0, x1, y1; // in the source atlas, border included
+            int x, y; // placement in the compacted atlas
+
+            int width() const { return x1 - x0; }
+            int height() const { return y1 - y0; }
+        };
+
+        int nextPowerOfTwo(int n)
+        {
+            int p = 1;
+            while (p < n)
+                p *= 2;
+            return p;
+        }
+
+        // shelves of rectangles sorted by decreasing height, left to right
+        bool placeOnShelves(std::vector<AtlasRect> &rects, const std::vector<std::size_t> &order, int width, int height)
+        {
+            int x = 0, y = 0, shelfHeight = 0;
+            for (std::size_t i : order)
+            {
+                AtlasRect &rect = rects[i];
+                if (x + rect.width() > width)
+                {
+                    y += shelfHeight;
+                    x = 0;
+                    shelfHeight = 0;
+                }
+                if (y + rect.height() > height)
+                    return false;
+                rect.x = x;
+                rect.y = y;
+                x += rect.width();
+                shelfHeight = std::max(shelfHeight, rect.height());
+            }
+            return true;
+        }
+    }
+
+    BitmapFont readBitmapFont(const byte *data, std::size_t size)
+    {
+        MemoryBinaryReader reader(data, size);
+        BitmapFont font;
+        int glyphCount = reader.readInt32();
+        if (glyphCount < 0 || static_cast<std::size_t>(glyphCount) > size)
+            throw std::runtime_error("invalid glyph count");
+        font.glyphs.resize(glyphCount);
+        for (int i = 0; i < glyphCount; ++i)
+        {
+            GlyphInfo &glyph = font.glyphs[i];
+            glyph.unicode = reader.readUtf8Char();
+            glyph.texCoord1.x = reader.readSingle();
+            glyph.texCoord1.y = reader.readSingle();
+            glyph.texCoord2.x = reader.readSingle();
+            glyph.texCoord2.y = reader.readSingle();
+            glyph.offset.x = reader.readSingle();
+            glyph.offset.y = reader.readSingle();
+            glyph.width = reader.readSingle();
+        }
+        font.glyphHeight = reader.readSingle();
+        font.spacing.x = reader.readSingle();
+        font.spacing.y = reader.readSingle();
+        font.scale = reader.readSingle();
+        font.fallbackCode = reader.readUtf8Char();
+
+        font.atlas = readTextureHeader(data + reader.position, size - reader.position);
+        font.atlasOffset = reader.position + TextureHeader::size;
+        if (font.atlasOffset + static_cast<std::size_t>(font.atlas.width) * font.atlas.height * 4 > size)
+            throw std::runtime_error("truncated font atlas");
+        return font;
+    }
+
+    bool compactAtlas(std::vector<GlyphInfo> &glyphs, const byte *pixels, int width, int height, FontAtlas &compacted)
+    {
+        std::vector<AtlasRect> rects;
+        std::vector<int> glyphRects(glyphs.size(), -1);
+        std::map<std::tuple<int, int, int, int>, int> rectIndex;
+        for (std::size_t i = 0; i < glyphs.size(); ++i)
+        {
+            const GlyphInfo &glyph = glyphs[i];
+            double fx0 = std::min(glyph.texCoord1.x, glyph.texCoord2.x) * static_cast<double>(width);
+            double fx1 = std::max(glyph.texCoord1.x, glyph.texCoord2.x) * static_cast<double>(width);
+            double fy0 = std::min(glyph.texCoord1.y, glyph.texCoord2.y) * static_cast<double>(height);
+            double fy1 = std::max(glyph.texCoord1.y, glyph.texCoord2.y) * static_cast<double>(height);
+            int x0 = std::max(0, static_cast<int>(std::floor(fx0 + edgeTolerance)));
+            int x1 = std::min(width, static_cast<int>(std::ceil(fx1 - edgeTolerance)));
+            int y0 = std::max(0, static_cast<int>(std::floor(fy0 + edgeTolerance)));
+            int y1 = std::min(height, static_cast<int>(std::ceil(fy1 - edgeTolerance)));
+            // nothing is sampled from empty glyphs, they keep no pixels
+            if (x1 <= x0 || y1 <= y0)
+                continue;
+            AtlasRect rect;
+            rect.x0 = std::max(0, x0 - atlasBorder);
+            rect.y0 = std::max(0, y0 - atlasBorder);
+            rect.x1 = std::min(width, x1 + atlasBorder);
+            rect.y1 = std::min(height, y1 + atlasBorder);
+            rect.x = rect.y = 0;
+            auto inserted = rectIndex.insert(std::make_pair(std::make_tuple(rect.x0, rect.y0, rect.x1, rect.y1),
+                static_cast<int>(rects.size())));
+            if (inserted.second)
+                rects.push_back(rect);
+            glyphRects[i] = inserted.first->second;
+        }
+
+        std::int64_t area = 0;
+        int widest = 1, tallest = 1;
+        for (const AtlasRect &rect : rects)
+        {
+            area += static_cast<std::int64_t>(rect.width()) * rect.height();
+            widest = std::max(widest, rect.width());
+            tallest = std::max(tallest, rect.height());
+        }
+        std::vector<std::size_t> order(rects.size());
+        for (std::size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b)
+        {
+            if (rects[a].height() != rects[b].height())
+                return rects[a].height() > rects[b].height();
+            return rects[a].width() > rects[b].width();
+        });
+
+        // power of 2 sizes smaller than the atlas, smallest and squarest first
+        std::int64_t originalArea = static_cast<std::int64_t>(width) * height;
+        std::vector<std::pair<int, int>> sizes;
+        for (int w = nextPowerOfTwo(widest); w <= maxAtlasSize; w *= 2)
+            for (int h = nextPowerOfTwo(tallest); h <= maxAtlasSize; h *= 2)
+            {
+                std::int64_t candidate = static_cast<std::int64_t>(w) * h;
+                if (candidate >= area && candidate < originalArea)
+                    sizes.push_back(std::make_pair(w, h));
+            }
+        std::sort(sizes.begin(), sizes.end(), [](const std::pair<int, int> &a, const std::pair<int, int> &b)
+        {
+            std::int64_t areaA = static_cast<std::int64_t>(a.first) * a.second;
+            std::int64_t areaB = static_cast<std::int64_t>(b.first) * b.second;
+            if (areaA != areaB)
+                return areaA < areaB;
+            return std::abs(a.first - a.second) < std::abs(b.first - b.second);
+        });
+        auto fits = std::find_if(sizes.begin(), sizes.end(), [&](const std::pair<int, int> &size)
+        {
+            return placeOnShelves(rects, order, size.first, size.second);
+        });
+        if (fits == sizes.end())
+            return false;
+
+        compacted.width = fits->first;
+        compacted.height = fits->second;
+        compacted.pixels.assign(static_cast<std::size_t>(compacted.width) * compacted.height * 4, 0);
+        for (const AtlasRect &rect : rects)
+            for (int row = 0; row < rect.height(); ++row)
+                std::memcpy(&compacted.pixels[(static_cast<std::size_t>(rect.y + row) * compacted.width + rect.x) * 4],
+                    pixels + (static_cast<std::size_t>(rect.y0 + row) * width + rect.x0) * 4,
+                    static_cast<std::size_t>(rect.width()) * 4);
+
+        // keep the position inside the rectangle, so glyphs span the same
+        // number of pixels, fractions included
+        for (std::size_t i = 0; i < glyphs.size(); ++i)
+        {
+            GlyphInfo &glyph = glyphs[i];
+            int dx = 0, dy = 0;
+            if (glyphRects[i] >= 0)
+            {
+                const AtlasRect &rect = rects[glyphRects[i]];
+                dx = rect.x - rect.x0;
+                dy = rect.y - rect.y0;
+            }
+            else
+            {
+                dx = -static_cast<int>(std::floor(std::min(glyph.texCoord1.x, glyph.texCoord2.x) * static_cast<double>(width)));
+                dy = -static_cast<int>(std::floor(std::min(glyph.texCoord1.y, glyph.texCoord2.y) * static_cast<double>(height)));
+            }
+            auto remap = [](float coord, int size, int offset, int newSize)
+            {
+                return static_cast<float>((coord * static_cast<double>(size) + offset) / newSize);
+            };
+            glyph.texCoord1.x = remap(glyph.texCoord1.x, width, dx, compacted.width);
+            glyph.texCoord2.x = remap(glyph.texCoord2.x, width, dx, compacted.width);
+            glyph.texCoord1.y = remap(glyph.texCoord1.y, height, dy, compacted.height);
+            glyph.texCoord2.y = remap(glyph.texCoord2.y, height, dy, compacted.height);
+        }
+        return true;
+    }
+}
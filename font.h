@@ -0,0 +1,38 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+#include "scpak.h"
+#include "texture.h"
+
+namespace scpak
+{
+    // decoded Engine.Media.BitmapFont payload, except for the atlas pixels
+    struct BitmapFont
+    {
+        std::vector<GlyphInfo> glyphs;
+        float glyphHeight;
+        Vector2f spacing;
+        float scale;
+        int fallbackCode;
+        TextureHeader atlas;
+        std::size_t atlasOffset; // first atlas pixel inside the payload
+    };
+
+    BitmapFont readBitmapFont(const byte *data, std::size_t size);
+
+    // RGBA atlas pixels, width * height * 4 bytes
+    struct FontAtlas
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<byte> pixels;
+    };
+
+    // Copies the atlas rectangles the glyphs' texture coordinates cover,
+    // with a pixel of their surroundings as a border against filtering
+    // bleed, into the smallest power of 2 atlas they fit in, and rewrites
+    // the coordinates to match. Glyphs sharing a rectangle share the copy.
+    // Returns false and changes nothing if the atlas would not get smaller.
+    bool compactAtlas(std::vector<GlyphInfo> &glyphs, const byte *pixels, int width, int height, FontAtlas &compacted);
+}
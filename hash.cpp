@@ -0,0 +1,62 @@
+#include "hash.h"
+#include <cstring>
+
+
+namespace scpak
+{
+    namespace
+    {
+        const std::uint64_t prime1 = 0x9E3779B185EBCA87ull;
+        const std::uint64_t prime2 = 0xC2B2AE3D27D4EB4Full;
+
+        inline std::uint64_t mix(std::uint64_t value)
+        {
+            value ^= value >> 33;
+            value *= prime2;
+            value ^= value >> 29;
+            value *= prime1;
+            value ^= value >> 32;
+            return value;
+        }
+
+        inline std::uint64_t load64(const unsigned char *p)
+        {
+            std::uint64_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+    }
+
+    std::uint64_t hashBytes(const void *data, std::size_t size, std::uint64_t seed)
+    {
+        const unsigned char *p = static_cast<const unsigned char*>(data);
+        const unsigned char *end = p + size;
+        // four independent lanes keep the multipliers busy
+        std::uint64_t lanes[4] = { seed + prime1, seed ^ prime2, seed - prime1, ~seed };
+        while (end - p >= 32)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                lanes[i] ^= load64(p + i * 8);
+                lanes[i] *= prime1;
+                lanes[i] ^= lanes[i] >> 31;
+            }
+            p += 32;
+        }
+        std::uint64_t hash = static_cast<std::uint64_t>(size) * prime2;
+        for (int i = 0; i < 4; ++i)
+            hash = (hash ^ mix(lanes[i])) * prime1;
+        while (end - p >= 8)
+        {
+            hash = (hash ^ mix(load64(p))) * prime1;
+            p += 8;
+        }
+        if (p != end)
+        {
+            unsigned char tail[8] = { 0 };
+            std::memcpy(tail, p, end - p);
+            hash = (hash ^ mix(load64(tail) + static_cast<std::uint64_t>(end - p))) * prime2;
+        }
+        return mix(hash);
+    }
+}
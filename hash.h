@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+namespace scpak
+{
+    // Fast non-cryptographic 64-bit hash for recognizing identical content,
+    // e.g. cache keys and duplicate payloads. The .pak.lz block checksums
+    // store it, so its results must not change.
+    std::uint64_t hashBytes(const void *data, std::size_t size, std::uint64_t seed = 0);
+
+    inline std::uint64_t hashString(const std::string &value, std::uint64_t seed = 0)
+    {
+        return hashBytes(value.data(), value.length(), seed);
+    }
+}
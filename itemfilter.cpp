@@ -0,0 +1,76 @@
+#include "itemfilter.h"
+
+
+namespace scpak
+{
+    namespace
+    {
+        bool matchGlob(const char *pattern, const char *name)
+        {
+            while (*pattern != '\0')
+            {
+                if (*pattern == '*')
+                {
+                    bool anyDepth = pattern[1] == '*';
+                    pattern += anyDepth ? 2 : 1;
+                    if (anyDepth && *pattern == '/' && matchGlob(pattern + 1, name))
+                        return true;
+                    for (const char *rest = name; ; ++rest)
+                    {
+                        if (matchGlob(pattern, rest))
+                            return true;
+                        if (*rest == '\0' || (!anyDepth && *rest == '/'))
+                            return false;
+                    }
+                }
+                if (*name == '\0' || (*pattern == '?' ? *name == '/' : *pattern != *name))
+                    return false;
+                ++pattern;
+                ++name;
+            }
+            return *name == '\0';
+        }
+
+        bool matchType(const std::string &pattern, const PakString &type)
+        {
+            if (type == pattern)
+                return true;
+            // System.Xml.Linq.XElement is also called XElement
+            if (type.length() <= pattern.length())
+                return false;
+            const char *tail = type.data() + type.length() - pattern.length();
+            return tail[-1] == '.' && pattern.compare(0, pattern.length(), tail, pattern.length()) == 0;
+        }
+    }
+
+    bool matchGlob(const std::string &pattern, const std::string &name)
+    {
+        return matchGlob(pattern.c_str(), name.c_str());
+    }
+
+    bool ItemFilter::empty() const
+    {
+        return includeNames.empty() && excludeNames.empty() && includeTypes.empty() && excludeTypes.empty();
+    }
+
+    bool ItemFilter::matches(const PakString &name, const PakString &type) const
+    {
+        bool included = includeNames.empty();
+        for (const std::string &pattern : includeNames)
+            included = included || matchGlob(pattern.c_str(), name.c_str());
+        if (!included)
+            return false;
+        included = includeTypes.empty();
+        for (const std::string &pattern : includeTypes)
+            included = included || matchType(pattern, type);
+        if (!included)
+            return false;
+        for (const std::string &pattern : excludeNames)
+            if (matchGlob(pattern.c_str(), name.c_str()))
+                return false;
+        for (const std::string &pattern : excludeTypes)
+            if (matchType(pattern, type))
+                return false;
+        return true;
+    }
+}
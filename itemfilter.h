@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "pakstring.h"
+
+namespace scpak
+{
+    // matches name against a glob: * and ? do not match '/', ** matches
+    // anything including '/', and "**/" may also match nothing
+    bool matchGlob(const std::string &pattern, const std::string &name);
+
+    // Selects items by name and type. An item is selected if its name
+    // matches one of the include globs and its type one of the include
+    // types (an empty list allows everything), and no exclude matches.
+    struct ItemFilter
+    {
+        std::vector<std::string> includeNames;
+        std::vector<std::string> excludeNames;
+        // full type names, or their last part, e.g. Texture2D
+        std::vector<std::string> includeTypes;
+        std::vector<std::string> excludeTypes;
+
+        // whether every item is selected
+        bool empty() const;
+        bool matches(const PakString &name, const PakString &type) const;
+    };
+}
@@ -0,0 +1,33 @@
+#include "itemtype.h"
+#include <cstring>
+
+
+namespace scpak
+{
+    namespace
+    {
+        const char *typeNames[] = {
+            nullptr,
+            "System.String",
+            "System.Xml.Linq.XElement",
+            "Engine.Graphics.Texture2D",
+            "Engine.Media.BitmapFont",
+            "Engine.Audio.SoundBuffer"
+        };
+        static_assert(sizeof(typeNames) / sizeof(typeNames[0]) == static_cast<std::size_t>(ItemType::Count),
+            "every item type needs a name");
+    }
+
+    ItemType internItemType(const char *name, std::size_t length)
+    {
+        for (int i = 1; i < static_cast<int>(ItemType::Count); ++i)
+            if (length == std::strlen(typeNames[i]) && std::memcmp(name, typeNames[i], length) == 0)
+                return static_cast<ItemType>(i);
+        return ItemType::Other;
+    }
+
+    const char *itemTypeName(ItemType type)
+    {
+        return typeNames[static_cast<int>(type)];
+    }
+}
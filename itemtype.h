@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace scpak
+{
+    // Item types with a built-in codec. Type names are interned once when a
+    // directory or manifest is parsed, everything else dispatches on this.
+    enum class ItemType : std::uint8_t
+    {
+        Other, // no built-in codec, kept raw unless a custom codec handles it
+        String,
+        XElement,
+        Texture2D,
+        BitmapFont,
+        SoundBuffer,
+        Count
+    };
+
+    ItemType internItemType(const char *name, std::size_t length);
+    inline ItemType internItemType(const std::string &name)
+    {
+        return internItemType(name.data(), name.length());
+    }
+    // nullptr for ItemType::Other
+    const char *itemTypeName(ItemType type);
+}
@@ -0,0 +1,310 @@
+#include "libscpak.h"
+#include "pakfile.h"
+#include "texture.h"
+#include "font.h"
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <string>
+
+
+struct scpak_pak
+{
+    scpak::PakFile pak;
+};
+
+namespace
+{
+    thread_local std::string lastError;
+
+    scpak_status fail(scpak_status status, const std::string &message)
+    {
+        lastError = message;
+        return status;
+    }
+
+    // runs body, turning exceptions into status codes
+    template<typename Body>
+    scpak_status guarded(const Body &body)
+    {
+        try
+        {
+            return body();
+        }
+        catch (const scpak::BadPakException &e)
+        {
+            return fail(SCPAK_ERROR_BAD_PAK, e.what());
+        }
+        catch (const scpak::BaseException &e)
+        {
+            return fail(SCPAK_ERROR, e.what());
+        }
+        catch (const std::exception &e)
+        {
+            return fail(SCPAK_ERROR, e.what());
+        }
+    }
+
+    scpak_status getItem(const scpak_pak *pak, size_t index, scpak::ItemType type, const scpak::PakItem **item)
+    {
+        if (pak == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "pak is null");
+        if (index >= pak->pak.contents().size())
+            return fail(SCPAK_ERROR_NOT_FOUND, "entry index out of range");
+        *item = &pak->pak.contents()[index];
+        if (type != scpak::ItemType::Other && (*item)->typeId != type)
+            return fail(SCPAK_ERROR_WRONG_TYPE, "entry " + (*item)->name + " is of type " + (*item)->type);
+        return SCPAK_OK;
+    }
+}
+
+extern "C"
+{
+    const char *scpak_version(void)
+    {
+        return scpak::Version;
+    }
+
+    const char *scpak_last_error(void)
+    {
+        return lastError.c_str();
+    }
+
+    scpak_status scpak_open(const char *path, unsigned flags, scpak_pak **pak)
+    {
+        if (path == nullptr || pak == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "path and pak must not be null");
+        *pak = nullptr;
+        return guarded([&]()
+        {
+            scpak_pak *result = new scpak_pak;
+            try
+            {
+                if (flags & SCPAK_OPEN_MMAP)
+                    result->pak.loadMapped(path);
+                else
+                    result->pak.load(std::string(path), true);
+            }
+            catch (...)
+            {
+                delete result;
+                throw;
+            }
+            *pak = result;
+            return SCPAK_OK;
+        });
+    }
+
+    scpak_status scpak_open_memory(const void *data, size_t size, scpak_pak **pak)
+    {
+        if (data == nullptr || pak == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "data and pak must not be null");
+        *pak = nullptr;
+        return guarded([&]()
+        {
+            scpak_pak *result = new scpak_pak;
+            try
+            {
+                result->pak.loadView(static_cast<const scpak::byte*>(data), size, nullptr);
+            }
+            catch (...)
+            {
+                delete result;
+                throw;
+            }
+            *pak = result;
+            return SCPAK_OK;
+        });
+    }
+
+    void scpak_close(scpak_pak *pak)
+    {
+        delete pak;
+    }
+
+    size_t scpak_entry_count(const scpak_pak *pak)
+    {
+        return pak != nullptr ? pak->pak.contents().size() : 0;
+    }
+
+    scpak_status scpak_get_entry(const scpak_pak *pak, size_t index, scpak_entry *entry)
+    {
+        const scpak::PakItem *item;
+        scpak_status status = getItem(pak, index, scpak::ItemType::Other, &item);
+        if (status != SCPAK_OK)
+            return status;
+        if (entry == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "entry is null");
+        entry->name = item->name.c_str();
+        entry->type = item->type.c_str();
+        entry->type_id = static_cast<int>(item->typeId);
+        entry->length = static_cast<size_t>(item->length);
+        return SCPAK_OK;
+    }
+
+    scpak_status scpak_find_entry(const scpak_pak *pak, const char *name, size_t *index)
+    {
+        if (pak == nullptr || name == nullptr || index == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "pak, name and index must not be null");
+        const std::vector<scpak::PakItem> &contents = pak->pak.contents();
+        for (size_t i = 0; i < contents.size(); ++i)
+            if (contents[i].name == name)
+            {
+                *index = i;
+                return SCPAK_OK;
+            }
+        return fail(SCPAK_ERROR_NOT_FOUND, "no entry named " + std::string(name));
+    }
+
+    scpak_status scpak_get_payload(const scpak_pak *pak, size_t index, const void **data, size_t *length)
+    {
+        const scpak::PakItem *item;
+        scpak_status status = getItem(pak, index, scpak::ItemType::Other, &item);
+        if (status != SCPAK_OK)
+            return status;
+        if (data == nullptr || length == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "data and length must not be null");
+        *data = item->payload();
+        *length = static_cast<size_t>(item->length);
+        return SCPAK_OK;
+    }
+
+    scpak_status scpak_get_texture_info(const scpak_pak *pak, size_t index, scpak_texture_info *info)
+    {
+        const scpak::PakItem *item;
+        scpak_status status = getItem(pak, index, scpak::ItemType::Texture2D, &item);
+        if (status != SCPAK_OK)
+            return status;
+        if (info == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "info is null");
+        return guarded([&]()
+        {
+            scpak::TextureHeader header = scpak::readTextureHeader(item->payload(), item->length);
+            info->width = header.width;
+            info->height = header.height;
+            info->mipmap_levels = header.mipmapLevel;
+            return SCPAK_OK;
+        });
+    }
+
+    scpak_status scpak_decode_texture(const scpak_pak *pak, size_t index, int level, void *pixels, size_t size)
+    {
+        const scpak::PakItem *item;
+        scpak_status status = getItem(pak, index, scpak::ItemType::Texture2D, &item);
+        if (status != SCPAK_OK)
+            return status;
+        if (pixels == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "pixels is null");
+        return guarded([&]()
+        {
+            scpak::TextureHeader header = scpak::readTextureHeader(item->payload(), item->length);
+            if (level < 0 || level >= header.mipmapLevel)
+                return fail(SCPAK_ERROR_INVALID_ARGUMENT, "mipmap level out of range");
+            scpak::MipmapLevelRange range = scpak::mipmapLevelRange(header.width, header.height, level);
+            if (static_cast<long long>(size) < range.byteCount())
+                return fail(SCPAK_ERROR_BUFFER_TOO_SMALL, "pixel buffer too small");
+            if (scpak::TextureHeader::size + range.offset + range.byteCount() > item->length)
+                return fail(SCPAK_ERROR_BAD_PAK, "texture " + item->name + " is truncated");
+            std::memcpy(pixels, item->payload() + scpak::TextureHeader::size + range.offset,
+                static_cast<size_t>(range.byteCount()));
+            return SCPAK_OK;
+        });
+    }
+
+    scpak_status scpak_get_sound_info(const scpak_pak *pak, size_t index, scpak_sound_info *info)
+    {
+        const scpak::PakItem *item;
+        scpak_status status = getItem(pak, index, scpak::ItemType::SoundBuffer, &item);
+        if (status != SCPAK_OK)
+            return status;
+        if (info == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "info is null");
+        return guarded([&]()
+        {
+            scpak::MemoryBinaryReader reader(item->payload(), item->length);
+            std::memset(info, 0, sizeof(*info));
+            info->compressed = reader.readBoolean() ? 1 : 0;
+            if (info->compressed)
+                return SCPAK_OK;
+            info->channels = reader.readInt32();
+            info->sample_rate = reader.readInt32();
+            int pcmBytes = reader.readInt32();
+            if (pcmBytes < 0 || static_cast<std::int64_t>(reader.position) + pcmBytes > item->length)
+                return fail(SCPAK_ERROR_BAD_PAK, "sound " + item->name + " is truncated");
+            info->pcm_bytes = static_cast<size_t>(pcmBytes);
+            return SCPAK_OK;
+        });
+    }
+
+    scpak_status scpak_decode_sound(const scpak_pak *pak, size_t index, void *samples, size_t size)
+    {
+        scpak_sound_info info;
+        scpak_status status = scpak_get_sound_info(pak, index, &info);
+        if (status != SCPAK_OK)
+            return status;
+        if (info.compressed)
+            return fail(SCPAK_ERROR_UNSUPPORTED, "ogg compressed sounds cannot be decoded");
+        if (samples == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "samples is null");
+        if (size < info.pcm_bytes)
+            return fail(SCPAK_ERROR_BUFFER_TOO_SMALL, "sample buffer too small");
+        const scpak::PakItem &item = pak->pak.contents()[index];
+        std::memcpy(samples, item.payload() + 13, info.pcm_bytes);
+        return SCPAK_OK;
+    }
+
+    scpak_status scpak_get_font_info(const scpak_pak *pak, size_t index, scpak_font_info *info)
+    {
+        const scpak::PakItem *item;
+        scpak_status status = getItem(pak, index, scpak::ItemType::BitmapFont, &item);
+        if (status != SCPAK_OK)
+            return status;
+        if (info == nullptr)
+            return fail(SCPAK_ERROR_INVALID_ARGUMENT, "info is null");
+        return guarded([&]()
+        {
+            scpak::BitmapFont font = scpak::readBitmapFont(item->payload(), item->length);
+            info->glyph_count = static_cast<int>(font.glyphs.size());
+            info->glyph_height = font.glyphHeight;
+            info->spacing[0] = font.spacing.x;
+            info->spacing[1] = font.spacing.y;
+            info->scale = font.scale;
+            info->fallback_code = font.fallbackCode;
+            info->atlas_width = font.atlas.width;
+            info->atlas_height = font.atlas.height;
+            return SCPAK_OK;
+        });
+    }
+
+    scpak_status scpak_decode_font(const scpak_pak *pak, size_t index,
+        scpak_glyph *glyphs, size_t glyph_capacity, void *atlas, size_t atlas_size)
+    {
+        const scpak::PakItem *item;
+        scpak_status status = getItem(pak, index, scpak::ItemType::BitmapFont, &item);
+        if (status != SCPAK_OK)
+            return status;
+        return guarded([&]()
+        {
+            scpak::BitmapFont font = scpak::readBitmapFont(item->payload(), item->length);
+            size_t atlasBytes = static_cast<size_t>(font.atlas.width) * font.atlas.height * 4;
+            if ((glyphs != nullptr && glyph_capacity < font.glyphs.size()) || (atlas != nullptr && atlas_size < atlasBytes))
+                return fail(SCPAK_ERROR_BUFFER_TOO_SMALL, "glyph or atlas buffer too small");
+            if (glyphs != nullptr)
+                for (size_t i = 0; i < font.glyphs.size(); ++i)
+                {
+                    const scpak::GlyphInfo &glyph = font.glyphs[i];
+                    glyphs[i].unicode = glyph.unicode;
+                    glyphs[i].tex_coord1[0] = glyph.texCoord1.x;
+                    glyphs[i].tex_coord1[1] = glyph.texCoord1.y;
+                    glyphs[i].tex_coord2[0] = glyph.texCoord2.x;
+                    glyphs[i].tex_coord2[1] = glyph.texCoord2.y;
+                    glyphs[i].offset[0] = glyph.offset.x;
+                    glyphs[i].offset[1] = glyph.offset.y;
+                    glyphs[i].width = glyph.width;
+                }
+            if (atlas != nullptr)
+                std::memcpy(atlas, item->payload() + font.atlasOffset, atlasBytes);
+            return SCPAK_OK;
+        });
+    }
+}
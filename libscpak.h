@@ -0,0 +1,132 @@
+/*
+ * C interface of libscpak, for embedding pak reading into other programs.
+ *
+ * Every function returns SCPAK_OK or an error code; scpak_last_error()
+ * then describes the failure of the last call made on the same thread.
+ * Pointers handed out by a pak (entry names, payloads) stay valid until
+ * the pak is closed.
+ */
+#ifndef LIBSCPAK_H
+#define LIBSCPAK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(SCPAK_SHARED)
+# ifdef SCPAK_BUILDING_LIBRARY
+#  define SCPAK_API __declspec(dllexport)
+# else
+#  define SCPAK_API __declspec(dllimport)
+# endif
+#else
+# define SCPAK_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum scpak_status
+{
+    SCPAK_OK = 0,
+    SCPAK_ERROR = 1,                   /* I/O or other failure */
+    SCPAK_ERROR_INVALID_ARGUMENT = 2,
+    SCPAK_ERROR_BAD_PAK = 3,           /* not a pak, or a corrupt one */
+    SCPAK_ERROR_NOT_FOUND = 4,
+    SCPAK_ERROR_WRONG_TYPE = 5,        /* entry is not of the type the call decodes */
+    SCPAK_ERROR_UNSUPPORTED = 6,       /* e.g. ogg compressed sounds */
+    SCPAK_ERROR_BUFFER_TOO_SMALL = 7
+} scpak_status;
+
+/* values of scpak_entry.type_id, other types are SCPAK_TYPE_OTHER */
+typedef enum scpak_type
+{
+    SCPAK_TYPE_OTHER = 0,
+    SCPAK_TYPE_STRING = 1,
+    SCPAK_TYPE_XELEMENT = 2,
+    SCPAK_TYPE_TEXTURE2D = 3,
+    SCPAK_TYPE_BITMAPFONT = 4,
+    SCPAK_TYPE_SOUNDBUFFER = 5
+} scpak_type;
+
+/* scpak_open flags */
+#define SCPAK_OPEN_MMAP 1u /* map the file instead of reading payloads into memory */
+
+typedef struct scpak_pak scpak_pak;
+
+typedef struct scpak_entry
+{
+    const char *name;
+    const char *type;
+    int type_id;
+    size_t length;
+} scpak_entry;
+
+typedef struct scpak_texture_info
+{
+    int width;
+    int height;
+    int mipmap_levels;
+} scpak_texture_info;
+
+typedef struct scpak_sound_info
+{
+    int channels;
+    int sample_rate;
+    size_t pcm_bytes; /* interleaved signed 16-bit samples */
+    int compressed;   /* ogg compressed sounds cannot be decoded */
+} scpak_sound_info;
+
+typedef struct scpak_glyph
+{
+    int32_t unicode;
+    float tex_coord1[2];
+    float tex_coord2[2];
+    float offset[2];
+    float width;
+} scpak_glyph;
+
+typedef struct scpak_font_info
+{
+    int glyph_count;
+    float glyph_height;
+    float spacing[2];
+    float scale;
+    int32_t fallback_code;
+    int atlas_width;
+    int atlas_height;
+} scpak_font_info;
+
+SCPAK_API const char *scpak_version(void);
+SCPAK_API const char *scpak_last_error(void);
+
+SCPAK_API scpak_status scpak_open(const char *path, unsigned flags, scpak_pak **pak);
+/* the buffer must stay valid and unchanged until the pak is closed */
+SCPAK_API scpak_status scpak_open_memory(const void *data, size_t size, scpak_pak **pak);
+SCPAK_API void scpak_close(scpak_pak *pak);
+
+SCPAK_API size_t scpak_entry_count(const scpak_pak *pak);
+SCPAK_API scpak_status scpak_get_entry(const scpak_pak *pak, size_t index, scpak_entry *entry);
+SCPAK_API scpak_status scpak_find_entry(const scpak_pak *pak, const char *name, size_t *index);
+/* raw payload bytes without copying */
+SCPAK_API scpak_status scpak_get_payload(const scpak_pak *pak, size_t index, const void **data, size_t *length);
+
+/* decoders write into caller buffers; pass the exact sizes reported by the
+   scpak_get_*_info functions or larger */
+SCPAK_API scpak_status scpak_get_texture_info(const scpak_pak *pak, size_t index, scpak_texture_info *info);
+/* RGBA8 pixels of one mip level, width >> level by height >> level (at least 1) */
+SCPAK_API scpak_status scpak_decode_texture(const scpak_pak *pak, size_t index, int level, void *pixels, size_t size);
+
+SCPAK_API scpak_status scpak_get_sound_info(const scpak_pak *pak, size_t index, scpak_sound_info *info);
+SCPAK_API scpak_status scpak_decode_sound(const scpak_pak *pak, size_t index, void *samples, size_t size);
+
+SCPAK_API scpak_status scpak_get_font_info(const scpak_pak *pak, size_t index, scpak_font_info *info);
+/* atlas is RGBA8, atlas_width * atlas_height * 4 bytes; either output may be NULL */
+SCPAK_API scpak_status scpak_decode_font(const scpak_pak *pak, size_t index,
+    scpak_glyph *glyphs, size_t glyph_capacity, void *atlas, size_t atlas_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,219 @@
+#include "lz.h"
+#include "pakfile.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+
+namespace scpak
+{
+    namespace
+    {
+        const int minMatch = 4;
+        // the last literals and the last match start are kept away from
+        // the end of the block, as the LZ4 format requires
+        const std::size_t lastLiterals = 5;
+        const std::size_t matchFindLimit = 12;
+        const int hashBits = 14;
+        const std::size_t maxOffset = 65535;
+
+        inline std::uint32_t read32(const byte *p)
+        {
+            std::uint32_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        inline std::uint64_t read64(const byte *p)
+        {
+            std::uint64_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        inline std::uint32_t hash4(std::uint32_t value)
+        {
+            return (value * 2654435761u) >> (32 - hashBits);
+        }
+
+        // number of equal bytes at p and ref, not looking at limit and beyond
+        inline std::size_t matchLength(const byte *p, const byte *ref, const byte *limit)
+        {
+            const byte *start = p;
+            while (p + 8 <= limit)
+            {
+                std::uint64_t diff = read64(p) ^ read64(ref);
+                if (diff != 0)
+                {
+#if defined(__GNUC__) || defined(__clang__)
+                    return p - start + (__builtin_ctzll(diff) >> 3);
+#else
+                    while (*p == *ref)
+                        ++p, ++ref;
+                    return p - start;
+#endif
+                }
+                p += 8;
+                ref += 8;
+            }
+            while (p < limit && *p == *ref)
+                ++p, ++ref;
+            return p - start;
+        }
+
+        // writes a length continuation (after a 15 in the token)
+        inline bool writeLength(byte *&op, byte *end, std::size_t length)
+        {
+            while (length >= 255)
+            {
+                if (op == end)
+                    return false;
+                *op++ = 255;
+                length -= 255;
+            }
+            if (op == end)
+                return false;
+            *op++ = static_cast<byte>(length);
+            return true;
+        }
+
+        inline bool writeSequence(byte *&op, byte *end, const byte *literals, std::size_t literalCount,
+            std::size_t offset, std::size_t matchCount)
+        {
+            if (op == end)
+                return false;
+            byte *token = op++;
+            *token = static_cast<byte>((literalCount >= 15 ? 15 : literalCount) << 4);
+            if (literalCount >= 15 && !writeLength(op, end, literalCount - 15))
+                return false;
+            if (static_cast<std::size_t>(end - op) < literalCount)
+                return false;
+            std::memcpy(op, literals, literalCount);
+            op += literalCount;
+            if (matchCount == 0)
+                return true;
+            if (end - op < 2)
+                return false;
+            *op++ = static_cast<byte>(offset);
+            *op++ = static_cast<byte>(offset >> 8);
+            std::size_t matchCode = matchCount - minMatch;
+            *token |= static_cast<byte>(matchCode >= 15 ? 15 : matchCode);
+            return matchCode < 15 || writeLength(op, end, matchCode - 15);
+        }
+
+        inline std::size_t readLength(const byte *&ip, const byte *end)
+        {
+            std::size_t length = 0;
+            byte value;
+            do
+            {
+                if (ip == end)
+                    throw BadPakException("corrupt compressed block");
+                value = *ip++;
+                length += value;
+            } while (value == 255);
+            return length;
+        }
+    }
+
+    std::size_t lzCompressBound(std::size_t size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    std::size_t lzCompress(const byte *src, std::size_t size, byte *dst, std::size_t capacity)
+    {
+        byte *op = dst;
+        byte *end = dst + capacity;
+        const byte *anchor = src;
+        if (size >= matchFindLimit + 1)
+        {
+            std::vector<std::uint32_t> table(std::size_t(1) << hashBits, 0);
+            const byte *ip = src + 1;
+            const byte *limit = src + size - matchFindLimit;
+            const byte *matchLimit = src + size - lastLiterals;
+            while (ip < limit)
+            {
+                std::uint32_t value = read32(ip);
+                std::uint32_t &slot = table[hash4(value)];
+                const byte *ref = src + slot;
+                slot = static_cast<std::uint32_t>(ip - src);
+                if (ref >= ip || static_cast<std::size_t>(ip - ref) > maxOffset || read32(ref) != value)
+                {
+                    // step faster through data that does not compress
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+                while (ip > anchor && ref > src && ip[-1] == ref[-1])
+                    --ip, --ref;
+                std::size_t length = minMatch + matchLength(ip + minMatch, ref + minMatch, matchLimit);
+                if (!writeSequence(op, end, anchor, ip - anchor, ip - ref, length))
+                    return 0;
+                ip += length;
+                anchor = ip;
+                if (ip < limit)
+                    table[hash4(read32(ip - 2))] = static_cast<std::uint32_t>(ip - 2 - src);
+            }
+        }
+        if (!writeSequence(op, end, anchor, src + size - anchor, 0, 0))
+            return 0;
+        return op - dst;
+    }
+
+    void lzDecompress(const byte *src, std::size_t size, byte *dst, std::size_t dstSize)
+    {
+        const byte *ip = src;
+        const byte *ipEnd = src + size;
+        byte *op = dst;
+        byte *opEnd = dst + dstSize;
+        while (true)
+        {
+            if (ip == ipEnd)
+                throw BadPakException("corrupt compressed block");
+            byte token = *ip++;
+            std::size_t literalCount = token >> 4;
+            if (literalCount == 15)
+                literalCount += readLength(ip, ipEnd);
+            if (literalCount > static_cast<std::size_t>(ipEnd - ip) || literalCount > static_cast<std::size_t>(opEnd - op))
+                throw BadPakException("corrupt compressed block");
+            std::memcpy(op, ip, literalCount);
+            ip += literalCount;
+            op += literalCount;
+            // the last sequence has literals only
+            if (ip == ipEnd)
+                break;
+
+            if (ipEnd - ip < 2)
+                throw BadPakException("corrupt compressed block");
+            std::size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            std::size_t matchCount = token & 15;
+            if (matchCount == 15)
+                matchCount += readLength(ip, ipEnd);
+            matchCount += minMatch;
+            if (offset == 0 || offset > static_cast<std::size_t>(op - dst) || matchCount > static_cast<std::size_t>(opEnd - op))
+                throw BadPakException("corrupt compressed block");
+            const byte *match = op - offset;
+            if (offset >= matchCount)
+            {
+                std::memcpy(op, match, matchCount);
+                op += matchCount;
+            }
+            else
+            {
+                // overlapping: the bytes from match to op repeat, copy
+                // them in ever longer chunks
+                byte *matchEnd = op + matchCount;
+                while (op < matchEnd)
+                {
+                    std::size_t chunk = std::min<std::size_t>(matchEnd - op, op - match);
+                    std::memcpy(op, match, chunk);
+                    op += chunk;
+                }
+            }
+        }
+        if (op != opEnd)
+            throw BadPakException("corrupt compressed block");
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+
+#include "scpak.h"
+
+namespace scpak
+{
+    // LZ77 block codec in the LZ4 block format: byte-aligned literal runs
+    // and matches, 16-bit offsets, no entropy coding. Fast in both
+    // directions, which suits mip chains and PCM better than strong ratios.
+
+    // largest compressed size of size input bytes
+    std::size_t lzCompressBound(std::size_t size);
+    // returns the compressed size, or 0 if it would not fit in capacity
+    std::size_t lzCompress(const byte *src, std::size_t size, byte *dst, std::size_t capacity);
+    // dstSize must be the exact decompressed size; throws BadPakException
+    // on corrupt input instead of reading or writing out of bounds
+    void lzDecompress(const byte *src, std::size_t size, byte *dst, std::size_t dstSize);
+}
@@ -1,10 +1,29 @@
 #include "pakfile.h"
 #include "pack.h"
 #include "unpack.h"
+#include "watch.h"
+#include "serve.h"
+#include "paklz.h"
+#include "roundtrip.h"
+#include "merge.h"
+#include "pakstats.h"
 #include "native.h"
+#include "trace.h"
+#include "memtrack.h"
+#include "progress.h"
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <iomanip>
 
 using namespace std;
 using namespace scpak;
@@ -14,10 +33,89 @@ void printUsage(int argc, char *argv[])
     string programPath = argv[0];
     size_t i = programPath.rfind(pathsep);
     string programName = programPath.substr(i+1);
-    cout << "Usage: " << programName << " <directory> | <pakfile>" << endl;
+    cout << "Usage: " << programName << " [options] <directory> | <pakfile>" << endl;
+    cout << "       " << programName << " [options] watch <directory>" << endl;
+    cout << "         keep <directory>.pak rebuilt while files in <directory> change" << endl;
+    cout << "       " << programName << " [options] list <pakfile>" << endl;
+    cout << "       " << programName << " [options] extract <pakfile> <item> [<directory>]" << endl;
+    cout << "       " << programName << " [options] compress <pakfile>" << endl;
+    cout << "         write <pakfile>.lz for transport; .pak.lz files can be unpacked directly" << endl;
+    cout << "       " << programName << " [options] decompress <pakfile>.lz" << endl;
+    cout << "       " << programName << " [options] roundtrip <pakfile>" << endl;
+    cout << "         unpack and repack every item in memory and report those that change" << endl;
+    cout << "       " << programName << " [options] merge <pakfile> <pakfile>... -o <output>" << endl;
+    cout << "         layer paks, items of later ones replace those of the same name, no decoding" << endl;
+    cout << "       " << programName << " [options] stats <pakfile>" << endl;
+    cout << "         print sizes and estimated memory per type, directory and item, and duplicates" << endl;
+    cout << "       " << programName << " [options] serve" << endl;
+    cout << "         answer requests of --client invocations, caching paks and packed items" << endl;
+    cout << "       " << programName << " --client stats" << endl;
+    cout << "         print the cache statistics of the server" << endl;
+    cout << "Options:" << endl;
+    cout << "  --minify-xml    strip comments and whitespace from XElement items when packing" << endl;
+    cout << "  --texture-scale N" << endl;
+    cout << "                  pack textures and font atlases at 1/N of their size, N a power of 2" << endl;
+    cout << "  --compact-fonts pack only the used parts of font atlases, into the smallest atlas" << endl;
+    cout << "  --sample-rate HZ" << endl;
+    cout << "                  resample sounds to HZ when packing, e.g. 22050" << endl;
+    cout << "  --mono          downmix sounds to one channel when packing" << endl;
+    cout << "  --include GLOB  only unpack/pack items whose name matches, e.g. 'Textures/**'" << endl;
+    cout << "  --exclude GLOB  leave out items whose name matches" << endl;
+    cout << "  --type TYPE     only unpack/pack items of TYPE, e.g. System.String or XElement" << endl;
+    cout << "  --exclude-type TYPE" << endl;
+    cout << "                  leave out items of TYPE" << endl;
+    cout << "  --reference PAK when packing, take the items left out by the filters from PAK" << endl;
+    cout << "  --mip-level N   extract reads and writes only mip level N of a texture, -1 for the smallest" << endl;
+    cout << "  --group-by-type place payloads of the same type together when packing" << endl;
+    cout << "  --access-order FILE" << endl;
+    cout << "                  place payloads of the items listed in FILE first, in that order" << endl;
+    cout << "  --align N       start payloads of at least N bytes at multiples of N (e.g. 4K)" << endl;
+    cout << "  --top N         number of largest items stats lists (default 10)" << endl;
+    cout << "  --json          print stats as JSON" << endl;
+    cout << "  --verify-duplicates" << endl;
+    cout << "                  stats reads items whose samples match in full to confirm duplicates" << endl;
+    cout << "  --trace FILE    record a Chrome trace event profile (open in Perfetto) to FILE" << endl;
+    cout << "  --mem-report    print peak memory usage and the items needing the most memory" << endl;
+    cout << "  --progress      show progress, throughput and the item being worked on (on stderr)" << endl;
+    cout << "  --stats         print items, bytes and throughput per step and item type when done" << endl;
+    cout << "  --max-memory N  fail once tracked buffers exceed N bytes (K, M, G suffixes allowed)" << endl;
+    cout << "  --write-backend sync|threads|io_uring" << endl;
+    cout << "                  how unpacked files are written (default sync)" << endl;
+    cout << "  --write-queue N number of files that may be pending at once (default 64)" << endl;
+    cout << "  --threads N     threads for compress, decompress and roundtrip (default one per core)" << endl;
+    cout << "  --block-size N  compressed block size (default 1M)" << endl;
+    cout << "  --client        run the command on a running scpak serve instead" << endl;
+    cout << "  --socket PATH   socket of serve and --client (default " << defaultSocketPath() << ")" << endl;
+    cout << "  --cache-size N  memory serve may use for caching (default 512M)" << endl;
     cout << "NOTE: You can just drag&drop directory or pakfile on scpak executable";
 }
 
+// parses sizes like 1048576, 512K, 300M or 2G
+bool parseByteSize(const string &text, size_t &bytes)
+{
+    size_t end = 0;
+    unsigned long long value;
+    try
+    {
+        value = stoull(text, &end);
+    }
+    catch (const exception &)
+    {
+        return false;
+    }
+    string suffix = text.substr(end);
+    if (suffix == "K" || suffix == "k")
+        value <<= 10;
+    else if (suffix == "M" || suffix == "m")
+        value <<= 20;
+    else if (suffix == "G" || suffix == "g")
+        value <<= 30;
+    else if (!suffix.empty())
+        return false;
+    bytes = static_cast<size_t>(value);
+    return true;
+}
+
 void printVersion()
 {
 	cout << "scpak version " << scpak::Version << endl;
@@ -30,78 +128,647 @@ void printLicense()
 	cout << "The MIT License (MIT) \nCopyright (c) 2017 qnnnnez" << endl;
 }
 
+// raw or compressed pak, read into an arena; only the payloads filter
+// selects are read
+void loadPak(PakFile &pak, const string &path, unsigned threads, const ItemFilter &filter)
+{
+    if (!isPakLz(path))
+    {
+        if (filter.empty())
+            pak.load(path, true);
+        else
+            pak.load(path, filter);
+        return;
+    }
+    ifstream fin(path, ios::binary);
+    LzInputStream decompressed(fin, threads);
+    if (filter.empty())
+        pak.load(decompressed, true);
+    else
+        pak.load(decompressed, filter);
+}
+
+// directory a pak is unpacked into
+string unpackDirectoryFor(const string &path)
+{
+    size_t i = path.rfind(".pak");
+    if (i == string::npos)
+        return path + "_unpack";
+    return path.substr(0, i);
+}
+
+// Shows the running operation on stderr, redrawn in place on a terminal
+// and as a new line every few seconds otherwise, e.g. in CI logs.
+class ProgressBar : public ProgressTracker
+{
+public:
+    ProgressBar() :
+        m_terminal(isTerminal(2)),
+        m_interval(m_terminal ? 100 : 2000)
+    { }
+
+protected:
+    void changed() override
+    {
+        ProgressSnapshot snapshot = this->snapshot();
+        lock_guard<mutex> lock(m_mutex);
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (!snapshot.finished && m_drawn && now - m_lastDraw < m_interval)
+            return;
+        m_drawn = true;
+        m_lastDraw = now;
+        if (m_terminal)
+            cerr << '\r';
+        cerr << format(snapshot);
+        if (m_terminal)
+            cerr << "\033[K";
+        if (!m_terminal || snapshot.finished)
+            cerr << '\n';
+        cerr << flush;
+    }
+
+private:
+    static string format(const ProgressSnapshot &snapshot)
+    {
+        double fraction = 0;
+        if (snapshot.totalBytes > 0)
+            fraction = static_cast<double>(snapshot.bytesDone) / snapshot.totalBytes;
+        else if (snapshot.itemCount > 0)
+            fraction = static_cast<double>(snapshot.itemsDone) / snapshot.itemCount;
+        fraction = snapshot.finished ? 1 : min(1.0, fraction);
+        const int width = 20;
+        int filled = static_cast<int>(fraction * width);
+        ostringstream line;
+        line << left << setw(10) << snapshot.operation << right
+            << " [" << string(filled, '#') << string(width - filled, '-') << "] "
+            << setw(3) << static_cast<int>(fraction * 100) << "%  "
+            << snapshot.itemsDone << '/' << snapshot.itemCount << " items";
+        if (snapshot.elapsed > 0 && snapshot.bytesDone > 0)
+            line << "  " << formatBytes(snapshot.bytesDone / snapshot.elapsed) << "/s";
+        if (snapshot.finished)
+            line << "  " << fixed << setprecision(1) << snapshot.elapsed << " s";
+        else if (snapshot.eta >= 0)
+        {
+            long long eta = static_cast<long long>(snapshot.eta + 0.5);
+            line << "  ETA " << eta / 60 << ':' << setw(2) << setfill('0') << eta % 60 << setfill(' ');
+        }
+        if (!snapshot.current.empty())
+            line << "  " << snapshot.current;
+        return line.str();
+    }
+
+    bool m_terminal;
+    chrono::milliseconds m_interval;
+    mutex m_mutex;
+    bool m_drawn = false;
+    chrono::steady_clock::time_point m_lastDraw;
+};
+
 int main(int argc, char *argv[])
 {
-    string path;
+    vector<string> arguments;
     bool interactive = false;
+    string tracePath;
+    string outputPath;
+    bool memoryReport = false;
+    bool showProgress = false;
+    bool showStats = false;
+    bool extractLevel = false;
+    int mipLevel = 0;
+    size_t memoryLimit = 0;
+    bool client = false;
+    bool statsJson = false;
+    bool verifyDuplicates = false;
+    size_t topCount = 10;
+    string socketPath = defaultSocketPath();
+    LzOptions lzOptions;
+    ItemFilter filter;
+    string referencePath;
+    ServeOptions serveOptions;
+    serveOptions.log = &cout;
+    // options forwarded to the server by --client
+    vector<string> serverOptions;
+    PackOptions packOptions;
+    packOptions.packText = packOptions.packTexture = packOptions.packFont = packOptions.packSound = true;
+    UnpackOptions unpackOptions;
+    unpackOptions.unpackText = unpackOptions.unpackBitmapFont = unpackOptions.unpackTexture = unpackOptions.unpackSound = true;
     if (argc == 1)
     {
         printUsage(argc, argv);
         cout << endl;
         cout << "Enter a directory to pack or a .pak file to unpack: ";
+        string path;
         cin >> path;
+        arguments.push_back(path);
         interactive = true;
     }
 
-    else if (argc == 2)
-    {
-    	std::string cmdarg = argv[1];
-		if (cmdarg == "--help" || cmdarg == "-h")
-		{
-			printUsage(argc, argv);
-			return 0;
-		}
-		else if (cmdarg == "--version" || cmdarg == "-v")
-		{
-			printVersion();
-			return 0;
-		}
-		else if (cmdarg == "--licence" || cmdarg == "--license")
-		{
-			printLicense();
-			return 0;
-		}
-		else
-		{
-		path = argv[1];
-		}
-    }
-	else
-	{
-		cerr << "error: unrecognized command line option" <<endl;
-		return 1;
-	}
-
-
-    if (!pathExists(path.c_str()))
-    {
-        cerr << "error: file/directory " << path << " does not exists" << endl;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string cmdarg = argv[i];
+        if (cmdarg == "--help" || cmdarg == "-h")
+        {
+            printUsage(argc, argv);
+            return 0;
+        }
+        else if (cmdarg == "--version" || cmdarg == "-v")
+        {
+            printVersion();
+            return 0;
+        }
+        else if (cmdarg == "--licence" || cmdarg == "--license")
+        {
+            printLicense();
+            return 0;
+        }
+        else if (cmdarg == "--minify-xml")
+        {
+            packOptions.minifyXml = true;
+            packOptions.report = &cout;
+            serverOptions.push_back("minify-xml");
+        }
+        else if (cmdarg == "--texture-scale" && i + 1 < argc)
+        {
+            char *end;
+            long scale = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || scale < 1 || scale > 65536 || !isPowerOfTwo(static_cast<int>(scale)))
+            {
+                cerr << "error: invalid texture scale " << argv[i] << endl;
+                return 1;
+            }
+            packOptions.textureScale = static_cast<int>(scale);
+            serverOptions.push_back("texture-scale=" + to_string(scale));
+        }
+        else if (cmdarg == "--compact-fonts")
+        {
+            packOptions.compactFonts = true;
+            serverOptions.push_back("compact-fonts");
+        }
+        else if (cmdarg == "--sample-rate" && i + 1 < argc)
+        {
+            char *end;
+            long rate = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || rate < 1000 || rate > 384000)
+            {
+                cerr << "error: invalid sample rate " << argv[i] << endl;
+                return 1;
+            }
+            packOptions.sampleRate = static_cast<int>(rate);
+            serverOptions.push_back("sample-rate=" + to_string(rate));
+        }
+        else if (cmdarg == "--mono")
+        {
+            packOptions.monoSound = true;
+            serverOptions.push_back("mono-sound");
+        }
+        else if ((cmdarg == "--include" || cmdarg == "--exclude" || cmdarg == "--type" || cmdarg == "--exclude-type") && i + 1 < argc)
+        {
+            string value = argv[++i];
+            if (cmdarg == "--include")
+                filter.includeNames.push_back(value);
+            else if (cmdarg == "--exclude")
+                filter.excludeNames.push_back(value);
+            else if (cmdarg == "--type")
+                filter.includeTypes.push_back(value);
+            else
+                filter.excludeTypes.push_back(value);
+            serverOptions.push_back(cmdarg.substr(2) + "=" + value);
+        }
+        else if (cmdarg == "--reference" && i + 1 < argc)
+        {
+            referencePath = argv[++i];
+            serverOptions.push_back("reference=" + absolutePath(referencePath));
+        }
+        else if (cmdarg == "--mip-level" && i + 1 < argc)
+        {
+            char *end;
+            long level = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || level < -64 || level > 64)
+            {
+                cerr << "error: invalid mip level " << argv[i] << endl;
+                return 1;
+            }
+            extractLevel = true;
+            mipLevel = static_cast<int>(level);
+        }
+        else if (cmdarg == "--top" && i + 1 < argc)
+        {
+            char *end;
+            long count = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || count < 0)
+            {
+                cerr << "error: invalid item count " << argv[i] << endl;
+                return 1;
+            }
+            topCount = static_cast<size_t>(count);
+        }
+        else if (cmdarg == "--json")
+        {
+            statsJson = true;
+        }
+        else if (cmdarg == "--verify-duplicates")
+        {
+            verifyDuplicates = true;
+        }
+        else if (cmdarg == "--group-by-type")
+        {
+            packOptions.layout.groupByType = true;
+            serverOptions.push_back("group-by-type");
+        }
+        else if (cmdarg == "--access-order" && i + 1 < argc)
+        {
+            string orderPath = argv[++i];
+            try
+            {
+                packOptions.layout.accessOrder = readAccessOrder(orderPath);
+            }
+            catch (const exception &e)
+            {
+                cerr << "error: " << e.what() << endl;
+                return 1;
+            }
+            serverOptions.push_back("access-order=" + absolutePath(orderPath));
+        }
+        else if (cmdarg == "--align" && i + 1 < argc)
+        {
+            if (!parseByteSize(argv[++i], packOptions.layout.alignment) || packOptions.layout.alignment == 0)
+            {
+                cerr << "error: invalid alignment " << argv[i] << endl;
+                return 1;
+            }
+            serverOptions.push_back("align=" + to_string(packOptions.layout.alignment));
+        }
+        else if (cmdarg == "--trace" && i + 1 < argc)
+        {
+            tracePath = argv[++i];
+        }
+        else if (cmdarg == "--mem-report")
+        {
+            memoryReport = true;
+        }
+        else if ((cmdarg == "-o" || cmdarg == "--output") && i + 1 < argc)
+        {
+            outputPath = argv[++i];
+        }
+        else if (cmdarg == "--progress")
+        {
+            showProgress = true;
+        }
+        else if (cmdarg == "--stats")
+        {
+            showStats = true;
+        }
+        else if (cmdarg == "--max-memory" && i + 1 < argc)
+        {
+            if (!parseByteSize(argv[++i], memoryLimit) || memoryLimit == 0)
+            {
+                cerr << "error: invalid memory limit " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (cmdarg == "--write-backend" && i + 1 < argc)
+        {
+            if (!parseFileWriterBackend(argv[++i], unpackOptions.writeBackend))
+            {
+                cerr << "error: unknown write backend " << argv[i] << endl;
+                return 1;
+            }
+            serverOptions.push_back(string("write-backend=") + argv[i]);
+        }
+        else if (cmdarg == "--write-queue" && i + 1 < argc)
+        {
+            unpackOptions.writeQueueDepth = atoi(argv[++i]);
+            if (unpackOptions.writeQueueDepth <= 0)
+            {
+                cerr << "error: invalid write queue depth " << argv[i] << endl;
+                return 1;
+            }
+            serverOptions.push_back(string("write-queue=") + argv[i]);
+        }
+        else if (cmdarg == "--threads" && i + 1 < argc)
+        {
+            int threads = atoi(argv[++i]);
+            if (threads <= 0)
+            {
+                cerr << "error: invalid thread count " << argv[i] << endl;
+                return 1;
+            }
+            lzOptions.threads = threads;
+        }
+        else if (cmdarg == "--block-size" && i + 1 < argc)
+        {
+            if (!parseByteSize(argv[++i], lzOptions.blockSize) || lzOptions.blockSize == 0)
+            {
+                cerr << "error: invalid block size " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (cmdarg == "--client")
+        {
+            client = true;
+        }
+        else if (cmdarg == "--socket" && i + 1 < argc)
+        {
+            socketPath = argv[++i];
+        }
+        else if (cmdarg == "--cache-size" && i + 1 < argc)
+        {
+            if (!parseByteSize(argv[++i], serveOptions.cacheBytes))
+            {
+                cerr << "error: invalid cache size " << argv[i] << endl;
+                return 1;
+            }
+        }
+        else if (cmdarg.length() > 1 && cmdarg[0] == '-')
+        {
+            cerr << "error: unrecognized command line option " << cmdarg << endl;
+            return 1;
+        }
+        else
+        {
+            arguments.push_back(cmdarg);
+        }
+    }
+
+    // a leading command word, unless it is all there is and names an
+    // existing file or directory
+    string command;
+    const char *commands[] = { "watch", "list", "extract", "serve", "stats", "compress", "decompress", "roundtrip", "merge" };
+    if (!arguments.empty() && find(begin(commands), end(commands), arguments[0]) != end(commands)
+        && !(arguments.size() == 1 && pathExists(arguments[0].c_str())))
+    {
+        command = arguments[0];
+        arguments.erase(arguments.begin());
+    }
+    // stats of the server cache through --client, of a pak otherwise
+    bool noArguments = command == "serve" || (command == "stats" && client);
+    size_t minimumArguments = noArguments ? 0 : command == "extract" ? 2 : 1;
+    size_t maximumArguments = noArguments ? 0 : command == "extract" ? 3 : command == "merge" ? arguments.size() : 1;
+    if (arguments.size() < minimumArguments || arguments.size() > maximumArguments)
+    {
+        cerr << "error: wrong number of arguments, see --help" << endl;
         return 1;
     }
-    if (isDirectory(path.c_str()))
+    if (client && (command == "watch" || command == "serve" || command == "compress" || command == "decompress" || command == "roundtrip" || command == "merge"))
     {
-        ofstream fout(path + ".pak", ios::binary);
-
-        PakFile pak = packAll(path);
-        pak.save(fout);
+        cerr << "error: " << command << " cannot run through the server" << endl;
+        return 1;
+    }
+    if ((command == "merge") != !outputPath.empty())
+    {
+        cerr << "error: merge needs -o <output>, and only merge takes it" << endl;
+        return 1;
+    }
+    if (extractLevel && (client || command != "extract"))
+    {
+        cerr << "error: --mip-level only works with a local extract" << endl;
+        return 1;
+    }
+    if (client && command == "stats" && (statsJson || verifyDuplicates || !filter.empty()))
+    {
+        cerr << "error: --json, --verify-duplicates and filters only work with a local stats" << endl;
+        return 1;
+    }
+    string path = arguments.empty() ? string() : arguments[0];
+    packOptions.filter = filter;
+    unpackOptions.filter = filter;
 
-        fout.close();
+    for (size_t i = 0; i < (command == "merge" ? arguments.size() : noArguments ? 0 : 1); ++i)
+        if (!pathExists(arguments[i].c_str()))
+        {
+            cerr << "error: file/directory " << arguments[i] << " does not exists" << endl;
+            return 1;
+        }
+    if (!tracePath.empty())
+    {
+        Trace::start();
+        Trace::setThreadName("main");
     }
-    else if (isNormalFile(path.c_str()))
+    if (memoryReport || memoryLimit != 0)
+        MemoryTracker::start(memoryLimit, memoryReport ? 10 : 0);
+    // a plain tracker is enough for --stats, the bar also draws
+    unique_ptr<ProgressTracker> progress;
+    if (showProgress)
+        progress.reset(new ProgressBar);
+    else if (showStats)
+        progress.reset(new ProgressTracker);
+    Progress::setObserver(progress.get());
+    int status = 0;
+    try
     {
-        size_t i = path.rfind(".pak");
-        string directoryName;
-        if (i == string::npos)
-            directoryName = path + "_unpack";
-        else
-            directoryName = path.substr(0, i);
-        ifstream fin(path, ios::binary);
-        PakFile pak;
+        if (client)
+        {
+            vector<string> request;
+            if (command == "stats")
+                request = { "stats" };
+            else if (command == "list")
+                request = { "list", absolutePath(path) };
+            else if (command == "extract")
+                request = { "extract", absolutePath(path), arguments[1], absolutePath(arguments.size() > 2 ? arguments[2] : ".") };
+            else if (isDirectory(path.c_str()))
+                request = { "pack", absolutePath(path), absolutePath(path + ".pak") };
+            else
+                request = { "unpack", absolutePath(path), absolutePath(unpackDirectoryFor(path)) };
+            request.insert(request.end(), serverOptions.begin(), serverOptions.end());
+            status = sendRequest(socketPath, request, cout, cerr);
+        }
+        else if (command == "serve")
+        {
+            serve(socketPath, serveOptions);
+        }
+        else if (command == "watch")
+        {
+            if (!isDirectory(path.c_str()))
+                throw runtime_error(path + " is not a directory");
+            WatchOptions watchOptions;
+            watchOptions.pack = packOptions;
+            watchOptions.log = &cout;
+            watch(path, path + ".pak", watchOptions);
+        }
+        else if (command == "compress" || command == "decompress")
+        {
+            ifstream fin(path, ios::binary);
+            string outPath;
+            if (command == "compress")
+                outPath = path + ".lz";
+            else if (path.length() > 3 && path.compare(path.length() - 3, 3, ".lz") == 0)
+                outPath = path.substr(0, path.length() - 3);
+            else
+                outPath = path + ".pak";
+            // only replace outPath once the whole file was written
+            string tempPath = outPath + ".tmp";
+            try
+            {
+                ofstream fout(tempPath, ios::binary);
+                if (!fout)
+                    throw runtime_error("cannot open " + tempPath);
+                if (command == "compress")
+                    compressPak(fin, fout, lzOptions);
+                else
+                    decompressPak(fin, fout, lzOptions.threads);
+            }
+            catch (...)
+            {
+                remove(tempPath.c_str());
+                throw;
+            }
+            if (rename(tempPath.c_str(), outPath.c_str()) != 0)
+            {
+                remove(tempPath.c_str());
+                throw runtime_error("cannot replace " + outPath);
+            }
+        }
+        else if (command == "merge")
+        {
+            for (const string &input : arguments)
+                if (isPakLz(input))
+                    throw runtime_error(input + " is compressed, decompress it first");
+            // inputs may include the output, it is only replaced at the end
+            string tempPath = outputPath + ".tmp";
+            MergeResult result;
+            try
+            {
+                result = mergePaks(arguments, tempPath);
+            }
+            catch (...)
+            {
+                remove(tempPath.c_str());
+                throw;
+            }
+            if (rename(tempPath.c_str(), outputPath.c_str()) != 0)
+            {
+                remove(tempPath.c_str());
+                throw runtime_error("cannot replace " + outputPath);
+            }
+            cout << result.items << " items, " << result.replaced << " replaced, " << result.added << " added, "
+                << formatBytes(static_cast<double>(result.payloadBytes)) << " of payloads" << endl;
+        }
+        else if (command == "stats")
+        {
+            // directory and headers only; compressed paks cannot seek back
+            ifstream fin(path, ios::binary);
+            PakFile pak;
+            if (isPakLz(path))
+                loadPak(pak, path, lzOptions.threads, filter);
+            else
+                pak.loadDirectory(fin);
+            PakStatsOptions statsOptions;
+            statsOptions.topCount = topCount;
+            statsOptions.filter = filter;
+            statsOptions.verifyDuplicates = verifyDuplicates;
+            PakStats stats = analyzePak(pak, fin, statsOptions);
+            if (statsJson)
+                writeStatsJson(cout, stats);
+            else
+                writeStatsTable(cout, stats);
+        }
+        else if (command == "roundtrip")
+        {
+            PakFile pak;
+            loadPak(pak, path, lzOptions.threads, filter);
+            vector<RoundTripResult> results = roundTrip(pak, unpackOptions, packOptions, lzOptions.threads);
+            size_t exact = 0;
+            size_t failed = 0;
+            for (const RoundTripResult &result : results)
+            {
+                cout << result.name << '\t' << result.type << '\t';
+                if (!result.error.empty())
+                {
+                    cout << "error: " << result.error << endl;
+                    ++failed;
+                }
+                else if (result.exact)
+                {
+                    cout << "ok" << endl;
+                    ++exact;
+                }
+                else
+                {
+                    cout << "differs at byte " << result.firstDifference << " (" << result.where << ")";
+                    if (result.length != result.originalLength)
+                        cout << ", length " << result.originalLength << " -> " << result.length;
+                    cout << endl;
+                }
+            }
+            cout << results.size() << " items: " << exact << " bit-exact, " << results.size() - exact - failed
+                << " differ, " << failed << " failed" << endl;
+            status = exact == results.size() ? 0 : 1;
+        }
+        else if (command == "extract" && extractLevel)
+        {
+            // the directory, the texture header and the one level is all
+            // that is read; compressed paks cannot seek back and are loaded
+            ifstream fin(path, ios::binary);
+            PakFile pak;
+            if (isPakLz(path))
+                loadPak(pak, path, lzOptions.threads, ItemFilter());
+            else
+                pak.loadDirectory(fin);
+            unpackTextureLevel(pak, fin, arguments[1], arguments.size() > 2 ? arguments[2] : ".", mipLevel);
+        }
+        else if (command == "list" || command == "extract")
+        {
+            // list needs the directory only
+            ItemFilter directoryOnly;
+            directoryOnly.excludeNames.push_back("**");
+            PakFile pak;
+            loadPak(pak, path, lzOptions.threads, command == "list" ? directoryOnly : ItemFilter());
+            if (command == "list")
+            {
+                for (const PakItem &item : pak.contents())
+                    if (filter.matches(item.name, item.type))
+                        cout << item.name << '\t' << item.type << '\t' << item.length << endl;
+            }
+            else
+                unpackItem(pak, arguments[1], arguments.size() > 2 ? arguments[2] : ".", unpackOptions);
+        }
+        else if (isDirectory(path.c_str()))
+        {
+            PakFile reference;
+            if (!referencePath.empty())
+            {
+                // mapped, so that only the payloads taken from it are read
+                if (isPakLz(referencePath))
+                    loadPak(reference, referencePath, lzOptions.threads, ItemFilter());
+                else
+                    reference.loadMapped(referencePath);
+                packOptions.reference = &reference;
+            }
+            PakFile pak = pack(path, packOptions);
+            // only truncate an existing pak once packing succeeded
+            ofstream fout(path + ".pak", ios::binary);
+            pak.save(fout, packOptions.layout);
 
-        pak.load(fin);
-        unpackAll(pak, directoryName);
+            fout.close();
+        }
+        else if (isNormalFile(path.c_str()))
+        {
+            PakFile pak;
+            loadPak(pak, path, lzOptions.threads, filter);
+            unpack(pak, unpackDirectoryFor(path), unpackOptions);
+        }
+    }
+    catch (const exception &e)
+    {
+        cerr << "error: " << e.what() << endl;
+        status = 1;
+    }
+    catch (const BaseException &e)
+    {
+        cerr << "error: " << e.what() << endl;
+        status = 1;
+    }
+    if (!tracePath.empty())
+    {
+        Trace::stop();
+        Trace::save(tracePath);
     }
+    Progress::setObserver(nullptr);
+    if (showStats)
+        progress->report(cout);
+    if (memoryReport)
+        MemoryTracker::report(cout);
     if (interactive)
         cout << "Done." << endl;
-    return 0;
+    return status;
 }
@@ -0,0 +1,250 @@
+#include "memtrack.h"
+#include "native.h"
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <sstream>
+
+
+namespace scpak
+{
+    MemoryLimitException::MemoryLimitException(const std::string &what) :
+        BaseException(), what_(what)
+    { }
+
+    const char * MemoryLimitException::what() const
+    {
+        return what_.c_str();
+    }
+
+
+    namespace
+    {
+        const int categoryCount = static_cast<int>(MemoryCategory::Count);
+        const char *categoryNames[categoryCount] = { "pak payloads", "item buffers", "image buffers" };
+
+        std::atomic<long long> currentTotal(0);
+        std::atomic<long long> peakTotal(0);
+        std::atomic<long long> currentByCategory[categoryCount];
+        std::atomic<long long> peakByCategory[categoryCount];
+        std::atomic<long long> memoryLimit(0);
+        std::atomic<bool> trackingEnabled(false);
+
+        std::mutex topItemsMutex;
+        std::vector<ItemMemoryUsage> topItemList;
+        std::size_t topItemCapacity = 0;
+
+        thread_local long long threadBytes = 0;
+        thread_local ItemMemoryScope *threadScope = nullptr;
+
+        void updatePeak(std::atomic<long long> &peak, long long value)
+        {
+            long long old = peak.load(std::memory_order_relaxed);
+            while (value > old && !peak.compare_exchange_weak(old, value, std::memory_order_relaxed))
+                ;
+        }
+
+        std::string formatBytes(long long bytes)
+        {
+            std::stringstream ss;
+            if (bytes >= 10ll * 1024 * 1024)
+                ss << bytes / (1024 * 1024) << " MiB";
+            else if (bytes >= 10 * 1024)
+                ss << bytes / 1024 << " KiB";
+            else
+                ss << bytes << " B";
+            return ss.str();
+        }
+
+        void recordItem(const std::string &name, std::size_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(topItemsMutex);
+            if (topItemCapacity == 0)
+                return;
+            if (topItemList.size() == topItemCapacity && topItemList.back().bytes >= bytes)
+                return;
+            ItemMemoryUsage usage = { name, bytes };
+            auto it = std::upper_bound(topItemList.begin(), topItemList.end(), usage,
+                [](const ItemMemoryUsage &a, const ItemMemoryUsage &b) { return a.bytes > b.bytes; });
+            topItemList.insert(it, usage);
+            if (topItemList.size() > topItemCapacity)
+                topItemList.pop_back();
+        }
+    }
+
+    void MemoryTracker::start(std::size_t limit, std::size_t topItemCount)
+    {
+        memoryLimit = static_cast<long long>(limit);
+        {
+            std::lock_guard<std::mutex> lock(topItemsMutex);
+            topItemList.clear();
+            topItemCapacity = topItemCount;
+        }
+        trackingEnabled = true;
+    }
+
+    bool MemoryTracker::enabled()
+    {
+        return trackingEnabled.load(std::memory_order_relaxed);
+    }
+
+    void MemoryTracker::allocate(MemoryCategory category, std::size_t bytes)
+    {
+        if (bytes == 0)
+            return;
+        long long amount = static_cast<long long>(bytes);
+        long long limit = memoryLimit.load(std::memory_order_relaxed);
+        long long total = currentTotal.fetch_add(amount, std::memory_order_relaxed) + amount;
+        if (limit != 0 && total > limit)
+        {
+            currentTotal.fetch_sub(amount, std::memory_order_relaxed);
+            std::stringstream ss;
+            ss << "memory limit of " << formatBytes(limit) << " exceeded: " << formatBytes(total - amount)
+                << " already in use, " << formatBytes(amount) << " more requested for " << categoryNames[static_cast<int>(category)];
+            if (threadScope != nullptr)
+                ss << " while processing " << threadScope->name();
+            throw MemoryLimitException(ss.str());
+        }
+        int index = static_cast<int>(category);
+        long long categoryTotal = currentByCategory[index].fetch_add(amount, std::memory_order_relaxed) + amount;
+        updatePeak(peakTotal, total);
+        updatePeak(peakByCategory[index], categoryTotal);
+
+        threadBytes += amount;
+        if (threadScope != nullptr)
+            threadScope->update(threadBytes);
+    }
+
+    void MemoryTracker::release(MemoryCategory category, std::size_t bytes)
+    {
+        long long amount = static_cast<long long>(bytes);
+        currentTotal.fetch_sub(amount, std::memory_order_relaxed);
+        currentByCategory[static_cast<int>(category)].fetch_sub(amount, std::memory_order_relaxed);
+        threadBytes -= amount;
+    }
+
+    std::size_t MemoryTracker::current()
+    {
+        return static_cast<std::size_t>(std::max(0ll, currentTotal.load()));
+    }
+
+    std::size_t MemoryTracker::peak()
+    {
+        return static_cast<std::size_t>(peakTotal.load());
+    }
+
+    std::size_t MemoryTracker::peak(MemoryCategory category)
+    {
+        return static_cast<std::size_t>(peakByCategory[static_cast<int>(category)].load());
+    }
+
+    std::vector<ItemMemoryUsage> MemoryTracker::topItems()
+    {
+        std::lock_guard<std::mutex> lock(topItemsMutex);
+        return topItemList;
+    }
+
+    void MemoryTracker::report(std::ostream &out)
+    {
+        out << "peak RSS: " << formatBytes(static_cast<long long>(getPeakResidentSetSize())) << std::endl;
+        out << "peak tracked: " << formatBytes(static_cast<long long>(peak())) << std::endl;
+        for (int i = 0; i < categoryCount; ++i)
+            out << "  " << categoryNames[i] << ": " << formatBytes(peakByCategory[i].load()) << std::endl;
+        std::vector<ItemMemoryUsage> items = topItems();
+        if (!items.empty())
+        {
+            out << "top items by transient memory:" << std::endl;
+            for (const ItemMemoryUsage &item : items)
+                out << "  " << formatBytes(static_cast<long long>(item.bytes)) << '\t' << item.name << std::endl;
+        }
+    }
+
+
+    ItemMemoryScope::ItemMemoryScope(const char *name) :
+        m_base(threadBytes), m_peak(0), m_parent(threadScope)
+    {
+        if (MemoryTracker::enabled())
+            m_name = name;
+        threadScope = this;
+    }
+
+    ItemMemoryScope::~ItemMemoryScope()
+    {
+        threadScope = m_parent;
+        if (MemoryTracker::enabled() && m_peak > 0)
+            recordItem(m_name, static_cast<std::size_t>(m_peak));
+    }
+
+    void ItemMemoryScope::update(long long bytes)
+    {
+        m_peak = std::max(m_peak, bytes - m_base);
+    }
+
+
+    TrackedBytes::TrackedBytes(MemoryCategory category, std::size_t bytes) :
+        m_category(category), m_bytes(0)
+    {
+        add(bytes);
+    }
+
+    TrackedBytes::TrackedBytes(const TrackedBytes &other) :
+        m_category(other.m_category), m_bytes(0)
+    {
+        add(other.m_bytes);
+    }
+
+    TrackedBytes::TrackedBytes(TrackedBytes &&other) :
+        m_category(other.m_category), m_bytes(other.m_bytes)
+    {
+        other.m_bytes = 0;
+    }
+
+    TrackedBytes &TrackedBytes::operator=(const TrackedBytes &other)
+    {
+        if (this != &other)
+        {
+            reset();
+            m_category = other.m_category;
+            add(other.m_bytes);
+        }
+        return *this;
+    }
+
+    TrackedBytes &TrackedBytes::operator=(TrackedBytes &&other)
+    {
+        if (this != &other)
+        {
+            reset();
+            m_category = other.m_category;
+            m_bytes = other.m_bytes;
+            other.m_bytes = 0;
+        }
+        return *this;
+    }
+
+    TrackedBytes::~TrackedBytes()
+    {
+        reset();
+    }
+
+    void TrackedBytes::add(std::size_t bytes)
+    {
+        MemoryTracker::allocate(m_category, bytes);
+        m_bytes += bytes;
+    }
+
+    void TrackedBytes::sub(std::size_t bytes)
+    {
+        bytes = std::min(bytes, m_bytes);
+        MemoryTracker::release(m_category, bytes);
+        m_bytes -= bytes;
+    }
+
+    void TrackedBytes::reset(std::size_t bytes)
+    {
+        if (bytes > m_bytes)
+            add(bytes - m_bytes);
+        else
+            sub(m_bytes - bytes);
+    }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+
+#include "scpak.h"
+
+namespace scpak
+{
+    enum class MemoryCategory
+    {
+        PakFile,     // payloads owned by PakFile objects
+        ItemBuffer,  // payloads being built or decoded by a packer/unpacker
+        ImageBuffer, // decoded images and other codec scratch buffers
+        Count
+    };
+
+    class MemoryLimitException : public BaseException
+    {
+    public:
+        MemoryLimitException(const std::string &what);
+        virtual const char * what() const;
+
+    private:
+        std::string what_;
+    };
+
+    struct ItemMemoryUsage
+    {
+        std::string name;
+        std::size_t bytes;
+    };
+
+    // Process-wide accounting of the big buffers scpak holds. Counters are
+    // always maintained (a couple of atomic adds per buffer); the per-item
+    // ranking is only collected after start().
+    class MemoryTracker
+    {
+    public:
+        // limit is in bytes, 0 for no limit
+        static void start(std::size_t limit, std::size_t topItemCount);
+        static bool enabled();
+
+        // throws MemoryLimitException if the limit would be exceeded
+        static void allocate(MemoryCategory category, std::size_t bytes);
+        static void release(MemoryCategory category, std::size_t bytes);
+
+        static std::size_t current();
+        static std::size_t peak();
+        static std::size_t peak(MemoryCategory category);
+        static std::vector<ItemMemoryUsage> topItems();
+
+        static void report(std::ostream &out);
+    };
+
+    // Attributes tracked allocations of the calling thread to an item while
+    // alive, remembering the highest transient usage.
+    class ItemMemoryScope
+    {
+    public:
+        // name is only copied while tracking is enabled
+        ItemMemoryScope(const char *name);
+        ~ItemMemoryScope();
+
+        ItemMemoryScope(const ItemMemoryScope &) = delete;
+        ItemMemoryScope &operator=(const ItemMemoryScope &) = delete;
+
+        const std::string &name() const { return m_name; }
+        void update(long long threadBytes);
+    private:
+        std::string m_name;
+        long long m_base;
+        long long m_peak;
+        ItemMemoryScope *m_parent;
+    };
+
+    // Accounts a number of bytes for as long as it lives. Copies account
+    // again, moves hand the bytes over.
+    class TrackedBytes
+    {
+    public:
+        explicit TrackedBytes(MemoryCategory category, std::size_t bytes = 0);
+        TrackedBytes(const TrackedBytes &other);
+        TrackedBytes(TrackedBytes &&other);
+        TrackedBytes &operator=(const TrackedBytes &other);
+        TrackedBytes &operator=(TrackedBytes &&other);
+        ~TrackedBytes();
+
+        void add(std::size_t bytes);
+        void sub(std::size_t bytes);
+        void reset(std::size_t bytes = 0);
+        std::size_t size() const { return m_bytes; }
+    private:
+        MemoryCategory m_category;
+        std::size_t m_bytes;
+    };
+}
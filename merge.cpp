@@ -0,0 +1,102 @@
+#include "merge.h"
+#include "native.h"
+#include "trace.h"
+#include "progress.h"
+#include <sstream>
+#include <unordered_map>
+#include <stdexcept>
+
+
+namespace scpak
+{
+    namespace
+    {
+        struct MergeEntry
+        {
+            const PakItem *item;
+            std::size_t source;
+        };
+    }
+
+    MergeResult mergePaks(const std::vector<std::string> &inputs, const std::string &outputPath)
+    {
+        TraceScope scope("phase", "merge");
+        std::vector<PakFile> paks(inputs.size());
+        std::vector<MergeEntry> entries;
+        std::unordered_map<PakString, std::size_t> indexes;
+        MergeResult result;
+        for (std::size_t i = 0; i < inputs.size(); ++i)
+        {
+            std::ifstream fin(inputs[i], std::ios::binary);
+            if (!fin)
+                throw std::runtime_error("cannot open " + inputs[i]);
+            paks[i].loadDirectory(fin);
+            std::int64_t fileSize = getFileSize(inputs[i].c_str());
+            for (const PakItem &item : paks[i].contents())
+            {
+                if (paks[i].contentOffset() + item.offset + item.length > fileSize)
+                    throw BadPakException(("payload of " + item.name + " is past the end of " + inputs[i]).c_str());
+                auto inserted = indexes.emplace(item.name, entries.size());
+                if (inserted.second)
+                {
+                    entries.push_back(MergeEntry{ &item, i });
+                    if (i != 0)
+                        ++result.added;
+                }
+                else
+                {
+                    entries[inserted.first->second] = MergeEntry{ &item, i };
+                    ++result.replaced;
+                }
+            }
+        }
+
+        // lengths are known, so the directory is written once with the
+        // final offsets, each payload after a DEADBEEF marker as save() does
+        std::int64_t offset = 0;
+        std::vector<std::int64_t> offsets;
+        offsets.reserve(entries.size());
+        for (const MergeEntry &entry : entries)
+        {
+            offset += 4;
+            offsets.push_back(offset);
+            offset += entry.item->length;
+            result.payloadBytes += entry.item->length;
+        }
+        if (!offsets.empty() && offsets.back() > maxPakOffset)
+            throw BadPakException("contents too large for a pak, offsets are 32-bit");
+        std::ostringstream directory;
+        StreamBinaryWriter writer(&directory);
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+            writer.writeString(entries[i].item->name.data(), entries[i].item->name.size());
+            writer.writeString(entries[i].item->type.data(), entries[i].item->type.size());
+            writer.writeInt(static_cast<int>(offsets[i]));
+            writer.writeInt(static_cast<int>(entries[i].item->length));
+        }
+        std::string directoryBytes = directory.str();
+        PakHeader header;
+        std::int64_t contentOffset = sizeof(header) + static_cast<std::int64_t>(directoryBytes.size());
+        if (contentOffset > maxPakOffset)
+            throw BadPakException("pak directory too large, offsets are 32-bit");
+        header.contentOffset = static_cast<std::int32_t>(contentOffset);
+        header.contentCount = static_cast<std::int32_t>(entries.size());
+
+        ProgressOperation progress("merge", entries.size(), result.payloadBytes);
+        FileAssembler output(outputPath);
+        for (const std::string &input : inputs)
+            output.addSource(input);
+        output.write(&header, sizeof(header));
+        output.write(directoryBytes.data(), directoryBytes.size());
+        static const byte marker[] = { 0xDE, 0xAD, 0xBE, 0xEF };
+        for (const MergeEntry &entry : entries)
+        {
+            ProgressItem itemProgress("merge", entry.item->name, entry.item->type, entry.item->length);
+            output.write(marker, sizeof(marker));
+            output.copy(entry.source, paks[entry.source].contentOffset() + entry.item->offset, entry.item->length);
+        }
+        output.finish();
+        result.items = entries.size();
+        return result;
+    }
+}
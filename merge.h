@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "pakfile.h"
+
+namespace scpak
+{
+    struct MergeResult
+    {
+        std::size_t items = 0;
+        // items of later paks that took the place of one with the same name
+        std::size_t replaced = 0;
+        std::size_t added = 0;
+        std::int64_t payloadBytes = 0;
+    };
+
+    // Layers paks over each other, e.g. mods over the base Content.pak: an
+    // item replaces the item of the same name from an earlier pak in its
+    // place in the directory, items with new names are appended. Only the
+    // directories are parsed; payloads are copied as byte ranges from the
+    // inputs into outputPath without being decoded.
+    MergeResult mergePaks(const std::vector<std::string> &inputs, const std::string &outputPath);
+}
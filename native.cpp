@@ -1,10 +1,21 @@
+#include "native.h"
 #include <string>
 #include <stdexcept>
+#include <mutex>
+#include <fstream>
+#include <unordered_set>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
 
 #if defined(__linux__) || defined(__APPLE__)
 # include <unistd.h>
 # include <sys/types.h>
 # include <sys/stat.h>
+# include <sys/resource.h>
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <cerrno>
 namespace scpak
 {
     extern const char pathsep = '/';
@@ -21,14 +32,12 @@ namespace scpak
         return access(path, F_OK) == 0;
     }
 
-    int getFileSize(const char *path)
+    std::int64_t getFileSize(const char *path)
     {
-        unsigned long filesize = -1;
         struct stat statbuf;
         if (stat(path, &statbuf) < 0)
             throw std::runtime_error("failed to get call stat: " + std::string(path));
-        filesize = statbuf.st_size;
-        return static_cast<int>(filesize);
+        return static_cast<std::int64_t>(statbuf.st_size);
     }
 
     bool isDirectory(const char *path)
@@ -46,9 +55,378 @@ namespace scpak
             throw std::runtime_error("failed to get call stat: " + std::string(path));
         return S_ISREG(statbuf.st_mode);
     }
+
+    std::size_t getPeakResidentSetSize()
+    {
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) < 0)
+            return 0;
+# if defined(__APPLE__)
+        return static_cast<std::size_t>(usage.ru_maxrss);
+# else
+        return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+# endif
+    }
+
+    bool isTerminal(int fd)
+    {
+        return isatty(fd) == 1;
+    }
+
+    std::string absolutePath(const std::string &path)
+    {
+        if (!path.empty() && path[0] == '/')
+            return path;
+        char buffer[4096];
+        if (getcwd(buffer, sizeof(buffer)) == nullptr)
+            throw std::runtime_error("failed to get current directory");
+        return std::string(buffer) + '/' + path;
+    }
+
+    MappedFile::MappedFile(const char *path) :
+        m_data(nullptr), m_size(0)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1)
+            throw std::runtime_error("failed to open file: " + std::string(path));
+        struct stat statbuf;
+        if (fstat(fd, &statbuf) < 0)
+        {
+            close(fd);
+            throw std::runtime_error("failed to get call stat: " + std::string(path));
+        }
+        if (static_cast<std::uint64_t>(statbuf.st_size) > SIZE_MAX)
+        {
+            close(fd);
+            throw std::runtime_error("file too large to map: " + std::string(path));
+        }
+        m_size = static_cast<std::size_t>(statbuf.st_size);
+        if (m_size != 0)
+        {
+            void *address = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("failed to map file: " + std::string(path));
+            }
+            m_data = static_cast<const unsigned char*>(address);
+        }
+        close(fd);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_data != nullptr)
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+    }
+
+    ReadAhead::ReadAhead(const std::string &path) :
+        m_fd(open(path.c_str(), O_RDONLY | O_CLOEXEC))
+    {
+    }
+
+    ReadAhead::~ReadAhead()
+    {
+        if (m_fd != -1)
+            close(m_fd);
+    }
+
+    void ReadAhead::sequential()
+    {
+#ifdef __linux__
+        if (m_fd != -1)
+            posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    void ReadAhead::willNeed(std::int64_t offset, std::int64_t length)
+    {
+        if (m_fd == -1 || length <= 0)
+            return;
+#ifdef __linux__
+        posix_fadvise(m_fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_WILLNEED);
+#else
+        // the advisory count is an int
+        while (length > 0)
+        {
+            struct radvisory advice;
+            advice.ra_offset = static_cast<off_t>(offset);
+            advice.ra_count = static_cast<int>(std::min<std::int64_t>(length, 1 << 30));
+            if (fcntl(m_fd, F_RDADVISE, &advice) == -1)
+                return;
+            offset += advice.ra_count;
+            length -= advice.ra_count;
+        }
+#endif
+    }
+
+    bool evictFromPageCache(const std::string &path)
+    {
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            return false;
+        // dirty pages cannot be dropped, write them first
+        fdatasync(fd);
+        bool evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+        close(fd);
+        return evicted;
+#else
+        return false;
+#endif
+    }
+    DirectoryHandle::~DirectoryHandle()
+    {
+        close(fd);
+    }
+
+    struct DirectoryCache::Impl
+    {
+        static const std::size_t maxOpenHandles = 256;
+
+        std::string root;
+        std::mutex mutex;
+        std::shared_ptr<DirectoryHandle> rootHandle;
+        // relative paths of directories known to exist
+        std::unordered_set<std::string> created;
+        std::unordered_map<std::string, std::shared_ptr<DirectoryHandle>> handles;
+
+        // creates dir if needed and returns its handle, mutex must be held
+        std::shared_ptr<DirectoryHandle> open(const std::string &dir)
+        {
+            if (dir.empty())
+                return rootHandle;
+            auto it = handles.find(dir);
+            if (it != handles.end())
+                return it->second;
+
+            std::size_t slash = dir.rfind('/');
+            std::shared_ptr<DirectoryHandle> parent = open(slash == std::string::npos ? std::string() : dir.substr(0, slash));
+            std::string leaf = slash == std::string::npos ? dir : dir.substr(slash + 1);
+            if (created.count(dir) == 0)
+            {
+                if (mkdirat(parent->fd, leaf.c_str(), 0777) == -1 && errno != EEXIST)
+                    throw std::runtime_error("failed to create directory: " + root + dir);
+                created.insert(dir);
+            }
+            int fd = openat(parent->fd, leaf.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd == -1)
+                throw std::runtime_error("failed to open directory: " + root + dir);
+            // handles still in use stay open until their users drop them
+            if (handles.size() >= maxOpenHandles)
+                handles.clear();
+            std::shared_ptr<DirectoryHandle> handle = std::make_shared<DirectoryHandle>(fd);
+            handles[dir] = handle;
+            return handle;
+        }
+    };
+
+    DirectoryCache::DirectoryCache(const std::string &root) :
+        m_impl(new Impl)
+    {
+        m_impl->root = root;
+        if (root.empty() || *root.rbegin() != pathsep)
+            m_impl->root += pathsep;
+        if (mkdir(root.c_str(), 0777) == -1 && errno != EEXIST)
+            throw std::runtime_error("failed to create directory: " + root);
+        int fd = ::open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+            throw std::runtime_error("failed to open directory: " + root);
+        m_impl->rootHandle = std::make_shared<DirectoryHandle>(fd);
+    }
+
+    void DirectoryCache::createDirectories(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        m_impl->open(path);
+    }
+
+    std::shared_ptr<DirectoryHandle> DirectoryCache::parentOf(const std::string &path, std::string &leaf)
+    {
+        std::size_t slash = path.rfind('/');
+        leaf = slash == std::string::npos ? path : path.substr(slash + 1);
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        return m_impl->open(slash == std::string::npos ? std::string() : path.substr(0, slash));
+    }
+
+    namespace
+    {
+        void writeAll(int fd, const char *data, std::size_t size, const std::string &path)
+        {
+            while (size != 0)
+            {
+                ssize_t written = ::write(fd, data, size);
+                if (written == -1 && errno == EINTR)
+                    continue;
+                if (written <= 0)
+                    throw std::runtime_error("failed to write " + path);
+                data += written;
+                size -= static_cast<std::size_t>(written);
+            }
+        }
+
+        void readAll(int fd, char *data, std::size_t size, std::int64_t offset, const std::string &path)
+        {
+            while (size != 0)
+            {
+                ssize_t count = pread(fd, data, size, static_cast<off_t>(offset));
+                if (count == -1 && errno == EINTR)
+                    continue;
+                if (count <= 0)
+                    throw std::runtime_error("failed to read " + path);
+                data += count;
+                size -= static_cast<std::size_t>(count);
+                offset += count;
+            }
+        }
+    }
+
+    struct FileAssembler::Impl
+    {
+        static const std::size_t bufferSize = 1 << 20;
+        // smaller ranges are read into the buffer, a system call each way
+        // costs more than copying them
+        static const std::int64_t minKernelCopy = 64 << 10;
+
+        std::string path;
+        int fd = -1;
+        std::vector<int> sources;
+        std::vector<std::string> sourcePaths;
+        std::vector<char> buffer;
+        bool kernelCopy = true;
+
+        void flush()
+        {
+            writeAll(fd, buffer.data(), buffer.size(), path);
+            buffer.clear();
+        }
+    };
+
+    FileAssembler::FileAssembler(const std::string &path) :
+        m_impl(new Impl)
+    {
+        m_impl->path = path;
+        m_impl->buffer.reserve(Impl::bufferSize);
+        m_impl->fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (m_impl->fd == -1)
+            throw std::runtime_error("cannot open " + path);
+    }
+
+    FileAssembler::~FileAssembler()
+    {
+        if (m_impl->fd != -1)
+            close(m_impl->fd);
+        for (int source : m_impl->sources)
+            close(source);
+    }
+
+    std::size_t FileAssembler::addSource(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            throw std::runtime_error("failed to open file: " + path);
+        m_impl->sources.push_back(fd);
+        m_impl->sourcePaths.push_back(path);
+        return m_impl->sources.size() - 1;
+    }
+
+    void FileAssembler::write(const void *data, std::size_t size)
+    {
+        if (m_impl->buffer.size() + size > Impl::bufferSize)
+            m_impl->flush();
+        if (size >= Impl::bufferSize)
+            writeAll(m_impl->fd, static_cast<const char*>(data), size, m_impl->path);
+        else
+            m_impl->buffer.insert(m_impl->buffer.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+    }
+
+    void FileAssembler::copy(std::size_t source, std::int64_t offset, std::int64_t length)
+    {
+        int in = m_impl->sources.at(source);
+        const std::string &inPath = m_impl->sourcePaths[source];
+        if (length < Impl::minKernelCopy)
+        {
+            std::size_t size = static_cast<std::size_t>(length);
+            if (m_impl->buffer.size() + size > Impl::bufferSize)
+                m_impl->flush();
+            std::size_t end = m_impl->buffer.size();
+            m_impl->buffer.resize(end + size);
+            readAll(in, m_impl->buffer.data() + end, size, offset, inPath);
+            return;
+        }
+        m_impl->flush();
+#ifdef __linux__
+        while (m_impl->kernelCopy && length > 0)
+        {
+            loff_t inOffset = offset;
+            ssize_t copied = copy_file_range(in, &inOffset, m_impl->fd, nullptr, static_cast<std::size_t>(length), 0);
+            if (copied == -1 && errno == EINTR)
+                continue;
+            if (copied == -1 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP))
+            {
+                // old kernels and some filesystem pairs, copy in user space
+                m_impl->kernelCopy = false;
+                break;
+            }
+            if (copied <= 0)
+                throw std::runtime_error("failed to copy from " + inPath);
+            offset += copied;
+            length -= copied;
+        }
+#endif
+        while (length > 0)
+        {
+            std::size_t size = static_cast<std::size_t>(std::min<std::int64_t>(length, Impl::bufferSize));
+            m_impl->buffer.resize(size);
+            readAll(in, m_impl->buffer.data(), size, offset, inPath);
+            m_impl->flush();
+            offset += size;
+            length -= size;
+        }
+    }
+
+    void FileAssembler::finish()
+    {
+        m_impl->flush();
+        int fd = m_impl->fd;
+        m_impl->fd = -1;
+        if (close(fd) == -1)
+            throw std::runtime_error("failed to write " + m_impl->path);
+    }
+
+    void DirectoryCache::writeFile(const std::string &path, const WritePart *parts, int partCount)
+    {
+        std::string leaf;
+        std::shared_ptr<DirectoryHandle> parent = parentOf(path, leaf);
+        int fd = openat(parent->fd, leaf.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (fd == -1)
+            throw std::runtime_error("cannot open " + m_impl->root + path);
+        for (int i = 0; i < partCount; ++i)
+        {
+            const char *data = static_cast<const char*>(parts[i].data);
+            std::size_t remaining = parts[i].size;
+            while (remaining != 0)
+            {
+                ssize_t written = ::write(fd, data, remaining);
+                if (written == -1 && errno == EINTR)
+                    continue;
+                if (written <= 0)
+                {
+                    close(fd);
+                    throw std::runtime_error("failed to write " + m_impl->root + path);
+                }
+                data += written;
+                remaining -= static_cast<std::size_t>(written);
+            }
+        }
+        if (close(fd) == -1)
+            throw std::runtime_error("failed to write " + m_impl->root + path);
+    }
 }
 #elif defined(_WIN32)
 # include <windows.h>
+# include <psapi.h>
+# include <io.h>
 namespace scpak
 {
     extern const char pathsep = '\\';
@@ -74,14 +452,14 @@ namespace scpak
         }
     }
 
-    int getFileSize(const char *path)
+    std::int64_t getFileSize(const char *path)
     {
         WIN32_FIND_DATA fileInfo;
         HANDLE hFind;
         hFind = FindFirstFileA(path, &fileInfo);
         if (hFind == INVALID_HANDLE_VALUE)
             throw std::runtime_error("failed to get file size: " + std::string(path));
-        int size = fileInfo.nFileSizeLow;
+        std::int64_t size = (static_cast<std::int64_t>(fileInfo.nFileSizeHigh) << 32) | fileInfo.nFileSizeLow;
         FindClose(hFind);
         return size;
     }
@@ -101,7 +479,227 @@ namespace scpak
             throw std::runtime_error("failed to get file attribute: " + std::string(path));
         return (attributes & FILE_ATTRIBUTE_NORMAL) != 0 || (attributes & FILE_ATTRIBUTE_ARCHIVE) != 0;
     }
+
+    std::size_t getPeakResidentSetSize()
+    {
+        PROCESS_MEMORY_COUNTERS counters;
+        if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return 0;
+        return counters.PeakWorkingSetSize;
+    }
+
+    bool isTerminal(int fd)
+    {
+        return _isatty(fd) != 0;
+    }
+
+    std::string absolutePath(const std::string &path)
+    {
+        char buffer[MAX_PATH];
+        DWORD length = GetFullPathNameA(path.c_str(), MAX_PATH, buffer, NULL);
+        if (length == 0 || length >= MAX_PATH)
+            throw std::runtime_error("failed to get full path: " + path);
+        return std::string(buffer, length);
+    }
+
+    MappedFile::MappedFile(const char *path) :
+        m_data(nullptr), m_size(0)
+    {
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("failed to open file: " + std::string(path));
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size))
+        {
+            CloseHandle(file);
+            throw std::runtime_error("failed to get file size: " + std::string(path));
+        }
+        if (static_cast<std::uint64_t>(size.QuadPart) > SIZE_MAX)
+        {
+            CloseHandle(file);
+            throw std::runtime_error("file too large to map: " + std::string(path));
+        }
+        m_size = static_cast<std::size_t>(size.QuadPart);
+        if (m_size != 0)
+        {
+            HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping == NULL)
+            {
+                CloseHandle(file);
+                throw std::runtime_error("failed to map file: " + std::string(path));
+            }
+            m_data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            CloseHandle(mapping);
+            if (m_data == nullptr)
+            {
+                CloseHandle(file);
+                throw std::runtime_error("failed to map file: " + std::string(path));
+            }
+        }
+        CloseHandle(file);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (m_data != nullptr)
+            UnmapViewOfFile(m_data);
+    }
+
+    // buffered reads already prefetch sequential access on Windows
+    ReadAhead::ReadAhead(const std::string &) :
+        m_fd(-1)
+    {
+    }
+
+    ReadAhead::~ReadAhead()
+    {
+    }
+
+    void ReadAhead::sequential()
+    {
+    }
+
+    void ReadAhead::willNeed(std::int64_t, std::int64_t)
+    {
+    }
+
+    bool evictFromPageCache(const std::string &)
+    {
+        return false;
+    }
+    struct DirectoryCache::Impl
+    {
+        std::string root;
+        std::mutex mutex;
+        // relative paths of directories known to exist
+        std::unordered_set<std::string> created;
+    };
+
+    DirectoryCache::DirectoryCache(const std::string &root) :
+        m_impl(new Impl)
+    {
+        m_impl->root = root;
+        if (root.empty() || *m_impl->root.rbegin() != pathsep)
+            m_impl->root += pathsep;
+        if (!CreateDirectoryA(root.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+            throw std::runtime_error("failed to create directory: " + root);
+    }
+
+    // Windows has no handle-relative creation in its documented API, so
+    // this only saves the repeated existence checks
+    void DirectoryCache::createDirectories(const std::string &path)
+    {
+        if (path.empty())
+            return;
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        std::size_t p = 0;
+        while (p != std::string::npos)
+        {
+            p = path.find('/', p + 1);
+            std::string dir = path.substr(0, p);
+            if (m_impl->created.count(dir) != 0)
+                continue;
+            std::string fullPath = m_impl->root + dir;
+            if (!CreateDirectoryA(fullPath.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+                throw std::runtime_error("failed to create directory: " + fullPath);
+            m_impl->created.insert(dir);
+        }
+    }
+
+    struct FileAssembler::Impl
+    {
+        static const std::size_t bufferSize = 1 << 20;
+
+        std::string path;
+        std::ofstream out;
+        std::vector<std::unique_ptr<std::ifstream>> sources;
+        std::vector<std::string> sourcePaths;
+        std::vector<char> buffer;
+    };
+
+    FileAssembler::FileAssembler(const std::string &path) :
+        m_impl(new Impl)
+    {
+        m_impl->path = path;
+        m_impl->out.open(path, std::ios::binary);
+        if (!m_impl->out)
+            throw std::runtime_error("cannot open " + path);
+    }
+
+    FileAssembler::~FileAssembler()
+    {
+    }
+
+    std::size_t FileAssembler::addSource(const std::string &path)
+    {
+        std::unique_ptr<std::ifstream> in(new std::ifstream(path, std::ios::binary));
+        if (!*in)
+            throw std::runtime_error("failed to open file: " + path);
+        m_impl->sources.push_back(std::move(in));
+        m_impl->sourcePaths.push_back(path);
+        return m_impl->sources.size() - 1;
+    }
+
+    void FileAssembler::write(const void *data, std::size_t size)
+    {
+        m_impl->out.write(static_cast<const char*>(data), size);
+    }
+
+    void FileAssembler::copy(std::size_t source, std::int64_t offset, std::int64_t length)
+    {
+        std::ifstream &in = *m_impl->sources.at(source);
+        in.clear();
+        in.seekg(offset, std::ios::beg);
+        while (length > 0)
+        {
+            std::size_t size = static_cast<std::size_t>(std::min<std::int64_t>(length, Impl::bufferSize));
+            m_impl->buffer.resize(size);
+            if (!in.read(m_impl->buffer.data(), size))
+                throw std::runtime_error("failed to read " + m_impl->sourcePaths[source]);
+            m_impl->out.write(m_impl->buffer.data(), size);
+            length -= size;
+        }
+    }
+
+    void FileAssembler::finish()
+    {
+        m_impl->out.close();
+        if (!m_impl->out)
+            throw std::runtime_error("failed to write " + m_impl->path);
+    }
+
+    void DirectoryCache::writeFile(const std::string &path, const WritePart *parts, int partCount)
+    {
+        std::string fullPath = m_impl->root + path;
+        std::ofstream fout(fullPath, std::ios::binary);
+        if (!fout)
+            throw std::runtime_error("cannot open " + fullPath);
+        for (int i = 0; i < partCount; ++i)
+            fout.write(static_cast<const char*>(parts[i].data), parts[i].size);
+        if (!fout)
+            throw std::runtime_error("failed to write " + fullPath);
+    }
 }
 #else
 # error scpak: Not a supported platform.
 #endif
+
+namespace scpak
+{
+    DirectoryCache::~DirectoryCache()
+    {
+    }
+
+    const std::string &DirectoryCache::root() const
+    {
+        return m_impl->root;
+    }
+
+    std::string DirectoryCache::relative(const std::string &path) const
+    {
+        const std::string &root = m_impl->root;
+        if (path.length() > root.length() && path.compare(0, root.length(), root) == 0)
+            return path.substr(root.length());
+        return std::string();
+    }
+}
@@ -1,11 +1,135 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <memory>
 
 namespace scpak
 {
     extern const char pathsep;
     void createDirectory(const char *path);
     bool pathExists(const char *path);
-    int getFileSize(const char *path);
+    std::int64_t getFileSize(const char *path);
     bool isDirectory(const char *path);
     bool isNormalFile(const char *path);
+    std::size_t getPeakResidentSetSize();
+    // whether the file descriptor (e.g. 2 for stderr) is a terminal
+    bool isTerminal(int fd);
+    // path made absolute against the current directory, need not exist
+    std::string absolutePath(const std::string &path);
+
+    // Tells the kernel which parts of a file are read next (posix_fadvise
+    // on Linux, F_RDADVISE on macOS), so that it fetches them while earlier
+    // ones are consumed. Hints are only hints: where they are not supported
+    // or the file cannot be opened, they do nothing.
+    class ReadAhead
+    {
+    public:
+        explicit ReadAhead(const std::string &path);
+        ~ReadAhead();
+        ReadAhead(const ReadAhead &) = delete;
+        ReadAhead &operator=(const ReadAhead &) = delete;
+
+        // the file is read front to back, e.g. to use a larger window
+        void sequential();
+        void willNeed(std::int64_t offset, std::int64_t length);
+    private:
+        int m_fd;
+    };
+
+    // drops the clean cached pages of a file, e.g. to measure cold reads;
+    // false where that is not supported
+    bool evictFromPageCache(const std::string &path);
+
+    // read-only mapping of a whole file
+    class MappedFile
+    {
+    public:
+        MappedFile(const char *path);
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const unsigned char *data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+    private:
+        const unsigned char *m_data;
+        std::size_t m_size;
+    };
+
+    // Writes a file from memory and from byte ranges of other files, in
+    // order. Large ranges are copied by the kernel where it can, with
+    // copy_file_range on Linux (which shares extents on filesystems with
+    // reflinks), small ones and other platforms go through a buffer.
+    class FileAssembler
+    {
+    public:
+        // creates or truncates path
+        explicit FileAssembler(const std::string &path);
+        ~FileAssembler();
+        FileAssembler(const FileAssembler &) = delete;
+        FileAssembler &operator=(const FileAssembler &) = delete;
+
+        // opens a file to copy from and returns its index for copy()
+        std::size_t addSource(const std::string &path);
+        void write(const void *data, std::size_t size);
+        void copy(std::size_t source, std::int64_t offset, std::int64_t length);
+        // writes what is buffered and closes the file, failures throw
+        void finish();
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
+
+    struct WritePart
+    {
+        const void *data;
+        std::size_t size;
+    };
+
+#ifndef _WIN32
+    struct DirectoryHandle
+    {
+        explicit DirectoryHandle(int fd) : fd(fd) { }
+        ~DirectoryHandle();
+        DirectoryHandle(const DirectoryHandle &) = delete;
+        DirectoryHandle &operator=(const DirectoryHandle &) = delete;
+
+        int fd;
+    };
+#endif
+
+    // Creates directories and files below a root relative to open handles
+    // of their parent directories (mkdirat/openat), so that each path
+    // component is resolved once instead of on every call. Handles are
+    // cached up to a limit. Paths are relative to the root and separated
+    // by '/'. Safe to use from several threads.
+    class DirectoryCache
+    {
+    public:
+        // creates root if it does not exist
+        explicit DirectoryCache(const std::string &root);
+        ~DirectoryCache();
+        DirectoryCache(const DirectoryCache &) = delete;
+        DirectoryCache &operator=(const DirectoryCache &) = delete;
+
+        // root followed by a path separator
+        const std::string &root() const;
+        // path relative to the root if path is below it, empty otherwise
+        std::string relative(const std::string &path) const;
+
+        // creates the directory and all missing parents, existing ones are fine
+        void createDirectories(const std::string &path);
+        // creates or truncates the file at path and writes all parts to it;
+        // its directory must have been created
+        void writeFile(const std::string &path, const WritePart *parts, int partCount);
+#ifndef _WIN32
+        // handle of the directory containing path, with leaf set to the
+        // file name within it
+        std::shared_ptr<DirectoryHandle> parentOf(const std::string &path, std::string &leaf);
+#endif
+    private:
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
 }
@@ -1,38 +1,57 @@
 #include "pack.h"
+#include "codec.h"
 #include "native.h"
 #include "wav.h"
+#include "trace.h"
+#include "memtrack.h"
+#include "progress.h"
+#include "texture.h"
+#include "audio.h"
+#include "font.h"
 #include <stdexcept>
 #include <set>
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
 #include <cstring>
+#include <cstdlib>
+#include <algorithm>
 #include <iostream>
+#include <memory>
 
 #include "stb/stb_image.h"
 #include "stb/stb_image_write.h"
 #include "stb/stb_image_resize.h"
+#include "tinyxml2/tinyxml2.h"
 
 
 namespace scpak
 {
-    int calcMipmapSize(int width, int height, int level = 0);
-    int generateMipmap(int width, int height, int level, unsigned char *image);
-
-    template<void old_packer(const std::string &inputDir, PakItem &output)>
-    void packer_wrapper(const std::string &inputDir, PakItem &output, const std::string &meta)
+    std::vector<std::string> readAccessOrder(const std::string &path)
     {
-        old_packer(inputDir, output);
+        std::ifstream fin(path);
+        if (!fin)
+            throw std::runtime_error("cannot open " + path);
+        std::vector<std::string> names;
+        std::string line;
+        while (std::getline(fin, line))
+        {
+            if (!line.empty() && *line.rbegin() == '\r')
+                line.erase(line.length() - 1);
+            if (!line.empty())
+                names.push_back(line);
+        }
+        return names;
     }
 
-
-    PakFile pack(const std::string &dirPath, const std::map<std::string, packer_type> &packers, const packer_type &default_packer)
+    std::vector<ManifestEntry> readManifest(const std::string &dirPath)
     {
-        PakFile pak;
-        std::vector<PakItem> contents = pak.contents();
+        TraceScope scope("phase", "manifest parse");
         std::string dirPathSafe = dirPath;
         if (*dirPathSafe.rbegin() != pathsep)
             dirPathSafe += pathsep;
+        std::vector<ManifestEntry> entries;
         std::ifstream fPakInfo(dirPathSafe + PakInfoFileName);
         if (!fPakInfo)
             throw std::runtime_error("cannot open " + dirPathSafe + PakInfoFileName);
@@ -53,40 +72,126 @@ namespace scpak
             std::string extraInfo;
             if (split2 != std::string::npos)
                 extraInfo = line.substr(split2 + 1, std::string::npos);
-            PakItem item;
-            item.name = name;
-            item.type = type;
+            ManifestEntry entry;
+            entry.item.name = name;
+            entry.item.type = type;
+            entry.item.typeId = internItemType(type);
+            entry.meta = extraInfo;
+            entries.push_back(std::move(entry));
+            ++lineNumber;
+        }
+        return entries;
+    }
 
-            auto it = packers.find(item.type);
+    namespace
+    {
+        // parses the manifest, then hands every item to dispatch, which
+        // returns false to leave it out
+        template<typename Dispatch>
+        PakFile packItems(const std::string &dirPath, const Dispatch &dispatch)
+        {
+            PakFile pak;
+            std::string dirPathSafe = dirPath;
+            if (*dirPathSafe.rbegin() != pathsep)
+                dirPathSafe += pathsep;
+            std::vector<ManifestEntry> entries = readManifest(dirPath);
+            // packed sizes are not known up front
+            ProgressOperation progress("pack", entries.size(), 0);
+            for (ManifestEntry &entry : entries)
+            {
+                PakItem &item = entry.item;
+                TraceScope itemScope("item", item.name.c_str(), item.type.c_str());
+                ItemMemoryScope memoryScope(item.name.c_str());
+                {
+                    ProgressItem itemProgress("pack", item.name, item.type);
+                    TraceScope packerScope("packer", item.type.c_str());
+                    if (!dispatch(dirPathSafe, item, entry.meta))
+                        continue;
+                    itemProgress.setBytes(item.length);
+                }
+                pak.addItem(std::move(item));
+            }
+            return pak;
+        }
+    }
+
+
+    PakFile pack(const std::string &dirPath, const std::map<std::string, packer_type> &packers, const packer_type &default_packer)
+    {
+        return packItems(dirPath, [&](const std::string &inputDir, PakItem &item, const std::string &meta)
+        {
+            auto it = packers.find(item.type.str());
             if (it != packers.end())
-                it->second(dirPathSafe, item, extraInfo);
+                it->second(inputDir, item, meta);
             else
-                default_packer(dirPathSafe, item, extraInfo);
+                default_packer(inputDir, item, meta);
+            return true;
+        });
+    }
 
-            pak.addItem(std::move(item));
-            ++lineNumber;
+    PakFile pack(const std::string &dirPath, bool packText, bool packTexture, bool packFont, bool packSound)
+    {
+        PackOptions options;
+        options.packText = packText;
+        options.packTexture = packTexture;
+        options.packFont = packFont;
+        options.packSound = packSound;
+        return pack(dirPath, options);
+    }
+
+    PakFile pack(const std::string &dirPath, const PackOptions &options)
+    {
+        std::unordered_map<PakString, const PakItem*> reference;
+        if (options.reference != nullptr)
+        {
+            for (const PakItem &item : options.reference->contents())
+                reference.emplace(item.name, &item);
         }
-        fPakInfo.close();
-        return pak;
+        return packItems(dirPath, [&](const std::string &inputDir, PakItem &item, const std::string &meta)
+        {
+            if (options.filter.matches(item.name, item.type))
+            {
+                // the pak is saved before the tree can change, so raw
+                // items may point into their mapped source files
+                packItem(inputDir, item, meta, options, mappedFileSource());
+                return true;
+            }
+            if (options.reference == nullptr)
+                return false;
+            auto it = reference.find(item.name);
+            if (it == reference.end() || it->second->type != item.type)
+                throw std::runtime_error(item.name + " is not selected and not in the reference pak");
+            const PakItem &source = *it->second;
+            if (source.view == nullptr && source.data.size() < static_cast<std::size_t>(source.length))
+                throw std::runtime_error("payload of " + item.name + " was not loaded from the reference pak");
+            TrackedBytes itemBytes(MemoryCategory::ItemBuffer, source.length);
+            item.length = source.length;
+            item.data.assign(source.payload(), source.payload() + source.length);
+            return true;
+        });
     }
 
-    PakFile pack(const std::string &dirPath, bool packText, bool packTexture, bool packFont, bool packSound)
+    void packItem(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options)
     {
-        std::map<std::string, packer_type> packers;
-        if (packText)
+        packItem(inputDir, item, meta, options, diskFileSource());
+    }
+
+    void packItem(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source)
+    {
+        const ItemCodec &codec = itemCodec(item.typeId);
+        if (codec.pack != nullptr)
         {
-            packers.insert(std::pair<std::string, packer_type>("System.String", packer_wrapper<pack_string>));
-            packers.insert(std::pair<std::string, packer_type>("System.Xml.Linq.XElement", packer_wrapper<pack_string>));
+            if (options.*codec.packEnabled)
+                codec.pack(inputDir, item, meta, options, source);
+            else
+                pack_raw(inputDir, item, source);
+            return;
         }
-        if (packTexture)
-            packers.insert(std::pair<std::string, packer_type>("Engine.Graphics.Texture2D", pack_texture));
-        if (packFont)
-            packers.insert(std::pair<std::string, packer_type>("Engine.Media.BitmapFont", packer_wrapper<pack_bitmapFont>));
-        if (packSound)
-            packers.insert(std::pair<std::string, packer_type>("Engine.Audio.SoundBuffer", packer_wrapper<pack_soundBuffer>));
-
-        packer_type default_packer = packer_wrapper<pack_raw>;
-        return pack(dirPath, packers, default_packer);
+        auto it = options.customPackers.find(item.type.str());
+        if (it != options.customPackers.end())
+            it->second(inputDir, item, meta);
+        else
+            pack_raw(inputDir, item, source);
     }
 
     PakFile packAll(const std::string & dirPath)
@@ -95,67 +200,272 @@ namespace scpak
     }
     
 
-    void pack_raw(const std::string & inputDir, PakItem & item)
+    void pack_raw(const std::string &inputDir, PakItem &item)
+    {
+        pack_raw(inputDir, item, diskFileSource());
+    }
+
+    // pak lengths are signed 32-bit on disk, refuse anything larger
+    // before it is read or allocated
+    static void checkItemSize(std::int64_t size, const PakString &name)
+    {
+        if (size > maxPakOffset)
+            throw std::runtime_error("too large for a pak item (" + std::to_string(size) + " bytes): " + name);
+    }
+
+    // the file mapped if source can, read into buffer otherwise
+    static FileView viewFile(FileSource &source, const std::string &path, std::vector<byte> &buffer)
+    {
+        FileView view;
+        if (!source.map(path, view))
+        {
+            buffer = source.read(path);
+            view.data = buffer.data();
+            view.size = buffer.size();
+        }
+        return view;
+    }
+
+    void pack_raw(const std::string &inputDir, PakItem &item, FileSource &source)
     {
-        std::string filePath = inputDir + item.name;
-        int fileSize = getFileSize(filePath.c_str());
-        std::ifstream file(filePath, std::ios::binary);
-        item.data.resize(fileSize);
-        item.length = fileSize;
-        file.read(reinterpret_cast<char*>(item.data.data()), fileSize);
+        std::string fileName = inputDir + item.name;
+        checkItemSize(source.size(fileName), item.name);
+        // raw payloads are written out as they are, so a mapped file is
+        // saved straight from the page cache
+        FileView mapped;
+        if (source.map(fileName, mapped))
+        {
+            item.view = mapped.data;
+            item.owner = std::move(mapped.owner);
+            item.length = static_cast<std::int64_t>(mapped.size);
+            return;
+        }
+        std::vector<byte> data = source.read(fileName);
+        TrackedBytes itemBytes(MemoryCategory::ItemBuffer, data.size());
+        item.length = static_cast<std::int64_t>(data.size());
+        item.data = std::move(data);
     }
 
     void pack_string(const std::string &inputDir, PakItem &item)
+    {
+        pack_string(inputDir, item, diskFileSource());
+    }
+
+    void pack_string(const std::string &inputDir, PakItem &item, FileSource &source)
     {
         std::string fileName = inputDir + item.name;
-        if (item.type == "System.String")
+        ItemType type = item.typeId != ItemType::Other ? item.typeId : internItemType(item.type.data(), item.type.size());
+        if (type == ItemType::String)
             fileName += ".txt";
-        else if (item.type == "System.Xml.Linq.XElement")
+        else if (type == ItemType::XElement)
             fileName += ".xml";
         else
             throw std::runtime_error("wrong item type");
 
-        std::ifstream fin;
-        fin.open(fileName, std::ios::binary);
-        fin.seekg(0, std::ios::beg);
-        int offsetBeg = fin.tellg();
-        fin.seekg(0, std::ios::end);
-        int offsetEnd = fin.tellg();
-        int fileSize = offsetEnd - offsetBeg;
-        fin.seekg(0, std::ios::beg);
+        checkItemSize(source.size(fileName) + 5, item.name);
+        // the text is copied once, behind its length prefix
+        std::vector<byte> buffer;
+        FileView text = viewFile(source, fileName, buffer);
+        int fileSize = static_cast<int>(text.size);
 
+        TrackedBytes itemBytes(MemoryCategory::ItemBuffer, fileSize + 5);
         item.data.resize(fileSize + 5);
         MemoryBinaryWriter writer(item.data.data());
         writer.write7BitEncodedInt(fileSize);
         item.length = fileSize + writer.position;
-        fin.read(reinterpret_cast<char*>(item.data.data() + writer.position), fileSize);
-        fin.close();
+        std::copy(text.data, text.data + text.size, item.data.begin() + writer.position);
+    }
+
+    static void removeComments(tinyxml2::XMLNode *node)
+    {
+        tinyxml2::XMLNode *child = node->FirstChild();
+        while (child != nullptr)
+        {
+            tinyxml2::XMLNode *next = child->NextSibling();
+            if (child->ToComment() != nullptr)
+                node->DeleteChild(child);
+            else
+                removeComments(child);
+            child = next;
+        }
+    }
+
+    // tinyxml2 prints every attribute value in double quotes and, with
+    // entities left as written, without escaping them
+    static bool hasQuoteInAttribute(const tinyxml2::XMLNode *node)
+    {
+        for (const tinyxml2::XMLNode *child = node->FirstChild(); child != nullptr; child = child->NextSibling())
+        {
+            if (const tinyxml2::XMLElement *element = child->ToElement())
+            {
+                for (const tinyxml2::XMLAttribute *attribute = element->FirstAttribute(); attribute != nullptr; attribute = attribute->Next())
+                    if (std::strchr(attribute->Value(), '"') != nullptr)
+                        return true;
+            }
+            if (hasQuoteInAttribute(child))
+                return true;
+        }
+        return false;
+    }
+
+    void pack_xmlMinified(const std::string &inputDir, PakItem &item, std::ostream *report)
+    {
+        pack_xmlMinified(inputDir, item, report, diskFileSource());
+    }
+
+    void pack_xmlMinified(const std::string &inputDir, PakItem &item, std::ostream *report, FileSource &source)
+    {
+        pack_string(inputDir, item, source);
+        MemoryBinaryReader reader(item.data.data());
+        std::string original = reader.readString();
+
+        TraceScope scope("codec", "minify");
+        // entities are kept as written, so text and attribute values only
+        // change in their line breaks, which tinyxml2 turns into LF as any
+        // XML parser reading them would
+        tinyxml2::XMLDocument document(false, tinyxml2::PRESERVE_WHITESPACE);
+        // whenever minifying is not safe the item is left exactly as
+        // pack_string produced it
+        const char *verbatimReason = nullptr;
+        if (document.Parse(original.data(), original.length()) != tinyxml2::XML_SUCCESS)
+            verbatimReason = document.ErrorName();
+        else if (hasQuoteInAttribute(&document))
+            verbatimReason = "attribute value containing '\"'";
+        tinyxml2::XMLPrinter printer(nullptr, true);
+        int compactSize = 0;
+        if (verbatimReason == nullptr)
+        {
+            removeComments(&document);
+            document.Print(&printer);
+            compactSize = printer.CStrSize() - 1; // CStrSize() counts the terminating null
+            // the game parses the result at startup, it has to be well-formed
+            tinyxml2::XMLDocument check(false, tinyxml2::PRESERVE_WHITESPACE);
+            if (check.Parse(printer.CStr(), compactSize) != tinyxml2::XML_SUCCESS)
+                verbatimReason = "minified text does not parse";
+        }
+        if (verbatimReason != nullptr)
+        {
+            if (report != nullptr)
+                *report << "minify " << item.name << ": kept verbatim, " << verbatimReason << std::endl;
+            return;
+        }
+        TrackedBytes printerBytes(MemoryCategory::ItemBuffer, compactSize);
+
+        item.data.resize(compactSize + 5);
+        MemoryBinaryWriter writer(item.data.data());
+        writer.write7BitEncodedInt(compactSize);
+        std::memcpy(item.data.data() + writer.position, printer.CStr(), compactSize);
+        item.length = compactSize + writer.position;
+
+        if (report != nullptr)
+        {
+            long long sourceSize = original.length();
+            *report << "minify " << item.name << ": " << sourceSize << " -> " << compactSize << " bytes";
+            if (sourceSize != 0)
+                *report << " (" << (compactSize - sourceSize) * 100 / sourceSize << "%)";
+            *report << std::endl;
+        }
     }
 
     void pack_bitmapFont(const std::string &inputDir, PakItem &item)
+    {
+        pack_bitmapFont(inputDir, item, diskFileSource());
+    }
+
+    // Fills a mip chain of width x height by resampling every level from
+    // the source image, as generateMipmap() does, so that the levels match
+    // those of the unscaled chain below its dropped top levels.
+    static void resampleMipmaps(const unsigned char *source, int sourceWidth, int sourceHeight,
+        int width, int height, int levels, unsigned char *chain)
+    {
+        std::int64_t chainBytes = calcMipmapSize(width, height, levels) * 4;
+        for (int level = 0; level < levels; ++level)
+        {
+            MipmapLevelRange range = mipmapLevelRange(width, height, level);
+            if (range.offset >= chainBytes)
+                break;
+            stbir_resize_uint8(source, sourceWidth, sourceHeight, 0,
+                chain + range.offset, range.width, range.height, 0, 4);
+            if (range.width == 1 && range.height == 1)
+                break;
+        }
+    }
+
+    void pack_bitmapFont(const std::string &inputDir, PakItem &item, FileSource &source, int textureScale, bool compact)
     {
         std::string listFileName = inputDir + item.name + ".lst";
         std::string textureFileName = inputDir + item.name + ".tga";
 
-        std::ifstream fList;
-        fList.open(listFileName);
+        std::vector<byte> list = source.read(listFileName);
+        std::istringstream fList(std::string(list.begin(), list.end()));
         int glyphCount;
         fList >> glyphCount;
-
-        int width, height, comp;
-        unsigned char *data = stbi_load(textureFileName.c_str(), &width, &height, &comp, 4);
-        item.data.resize(sizeof(GlyphInfo) * glyphCount + 50 + width*height * 4);
-
-        MemoryBinaryWriter writer(item.data.data());
-        writer.writeInt(glyphCount);
-        for (int i = 0; i < glyphCount; ++i)
+        if (!fList || glyphCount < 0 || static_cast<std::size_t>(glyphCount) > list.size())
+            throw std::runtime_error("invalid glyph count: " + listFileName);
+        std::vector<GlyphInfo> glyphs(glyphCount);
+        for (GlyphInfo &glyph : glyphs)
         {
-            GlyphInfo glyph;
             fList >> glyph.unicode
                 >> glyph.texCoord1.x >> glyph.texCoord1.y
                 >> glyph.texCoord2.x >> glyph.texCoord2.y
                 >> glyph.offset.x >> glyph.offset.y
                 >> glyph.width;
+        }
+        float glyphHeight; fList >> glyphHeight;
+        Vector2f spacing; fList >> spacing.x >> spacing.y;
+        float scale; fList >> scale;
+        int fallbackCode; fList >> fallbackCode;
+
+        int width, height, comp;
+        std::unique_ptr<unsigned char, void(*)(void*)> data(nullptr, stbi_image_free);
+        {
+            checkItemSize(source.size(textureFileName), item.name);
+            std::vector<byte> buffer;
+            FileView file = viewFile(source, textureFileName, buffer);
+            TraceScope scope("codec", "decode image");
+            data.reset(stbi_load_from_memory(file.data, static_cast<int>(file.size), &width, &height, &comp, 4));
+        }
+        if (data == nullptr)
+            throw std::runtime_error("cannot load image file: " + textureFileName);
+        const unsigned char *pixels = data.get();
+        FontAtlas compacted;
+        if (compact)
+        {
+            TraceScope scope("codec", "compact atlas");
+            if (compactAtlas(glyphs, pixels, width, height, compacted))
+            {
+                pixels = compacted.pixels.data();
+                width = compacted.width;
+                height = compacted.height;
+            }
+        }
+        // texture coordinates are normalized and glyph metrics are in layout
+        // units, so only the atlas itself changes
+        if (textureScale > 1)
+        {
+            int scaledWidth = std::max(1, width / textureScale);
+            int scaledHeight = std::max(1, height / textureScale);
+            std::size_t scaledBytes = static_cast<std::size_t>(scaledWidth) * scaledHeight * 4;
+            unsigned char *scaled = static_cast<unsigned char*>(std::malloc(scaledBytes));
+            if (scaled == nullptr)
+                throw std::bad_alloc();
+            stbir_resize_uint8(pixels, width, height, 0, scaled, scaledWidth, scaledHeight, 0, 4);
+            data.reset(scaled);
+            pixels = scaled;
+            width = scaledWidth;
+            height = scaledHeight;
+        }
+        std::size_t pixelBytes = static_cast<std::size_t>(width) * height * 4;
+        std::size_t capacity = sizeof(GlyphInfo) * glyphCount + 50 + pixelBytes;
+        checkItemSize(static_cast<std::int64_t>(capacity), item.name);
+        TrackedBytes imageBytes(MemoryCategory::ImageBuffer, pixelBytes);
+        TrackedBytes itemBytes(MemoryCategory::ItemBuffer, capacity);
+        item.data.resize(capacity);
+
+        MemoryBinaryWriter writer(item.data.data());
+        writer.writeInt(glyphCount);
+        for (const GlyphInfo &glyph : glyphs)
+        {
             writer.writeUtf8Char(glyph.unicode);
             writer.writeFloat(glyph.texCoord1.x);
             writer.writeFloat(glyph.texCoord1.y);
@@ -165,147 +475,210 @@ namespace scpak
             writer.writeFloat(glyph.offset.y);
             writer.writeFloat(glyph.width);
         }
-        float glyphHeight; fList >> glyphHeight;
-        Vector2f spacing; fList >> spacing.x >> spacing.y;
-        float scale; fList >> scale;
-        int fallbackCode; fList >> fallbackCode;
         writer.writeFloat(glyphHeight);
         writer.writeFloat(spacing.x);
         writer.writeFloat(spacing.y);
         writer.writeFloat(scale);
         writer.writeUtf8Char(fallbackCode);
-        fList.close();
 
         writer.writeBoolean(0);
         writer.writeInt(width);
         writer.writeInt(height);
         writer.writeInt(1);
-        std::memcpy(item.data.data() + writer.position, data, width*height * 4);
-        item.length = writer.position + width*height * 4;
+        std::memcpy(item.data.data() + writer.position, pixels, pixelBytes);
+        item.length = static_cast<std::int64_t>(writer.position + pixelBytes);
+    }
 
-        stbi_image_free(data);
+    void pack_texture(const std::string &inputDir, PakItem &item, const std::string &meta)
+    {
+        pack_texture(inputDir, item, meta, diskFileSource());
     }
 
-    void pack_texture(const std::string & inputDir, PakItem & item, const std::string &meta)
+    void pack_texture(const std::string &inputDir, PakItem &item, const std::string &meta, FileSource &source, int textureScale)
     {
         std::string filePathRaw = inputDir + item.name;
         std::string fileName = filePathRaw;
-        if (pathExists((filePathRaw + ".tga").c_str()))
+        if (source.exists(filePathRaw + ".tga"))
             fileName += ".tga";
-        else if (pathExists((filePathRaw + ".png").c_str()))
+        else if (source.exists(filePathRaw + ".png"))
             fileName += ".png";
-        else if (pathExists((filePathRaw + ".bmp").c_str()))
+        else if (source.exists(filePathRaw + ".bmp"))
             fileName += ".bmp";
-        else if (pathExists(filePathRaw.c_str()))
+        else if (source.exists(filePathRaw))
         {
-            pack_raw(inputDir, item);
+            pack_raw(inputDir, item, source);
             return;
         }
         else
             throw std::runtime_error("cannot find image file: " + item.name);
         int width, height, comp;
-        unsigned char *data = stbi_load(fileName.c_str(), &width, &height, &comp, 0);
+        std::unique_ptr<unsigned char, void(*)(void*)> data(nullptr, stbi_image_free);
+        {
+            checkItemSize(source.size(fileName), item.name);
+            std::vector<byte> buffer;
+            FileView file = viewFile(source, fileName, buffer);
+            TraceScope scope("codec", "decode image");
+            data.reset(stbi_load_from_memory(file.data, static_cast<int>(file.size), &width, &height, &comp, 0));
+        }
         if (data == nullptr)
             throw std::runtime_error("cannot load image file: " + item.name);
         if (comp != 4)
             throw std::runtime_error("image must have 4 components in every pixel: " + item.name);
+        std::size_t pixelBytes = static_cast<std::size_t>(width) * height * comp;
+        TrackedBytes imageBytes(MemoryCategory::ImageBuffer, pixelBytes);
 
         bool keepSourceImageInTag = std::stoi(meta);
         int mipmapLevel = std::stoi(meta.substr(meta.find(' ')));
 
-        item.length = 1 + sizeof(int) * 3 + calcMipmapSize(width, height, mipmapLevel) * comp;
-        item.data.resize(item.length);
+        int scaledWidth = std::max(1, width / textureScale);
+        int scaledHeight = std::max(1, height / textureScale);
+        if (textureScale > 1 && mipmapLevel > 1)
+        {
+            if (!isPowerOfTwo(width) || !isPowerOfTwo(height))
+                throw std::runtime_error("generating mipmaps for non-power of 2 images not supported");
+            // the chain keeps its smaller levels, the top ones are dropped
+            for (int factor = textureScale; factor > 1 && mipmapLevel > 1; factor /= 2)
+                --mipmapLevel;
+        }
+
+        item.length = TextureHeader::size + calcMipmapSize(scaledWidth, scaledHeight, mipmapLevel) * comp;
+        checkItemSize(item.length, item.name);
+        TrackedBytes itemBytes(MemoryCategory::ItemBuffer, static_cast<std::size_t>(item.length));
+        item.data.resize(static_cast<std::size_t>(item.length));
         MemoryBinaryWriter writer(item.data.data());
         writer.writeBoolean(keepSourceImageInTag);
-        writer.writeInt(width);
-        writer.writeInt(height);
+        writer.writeInt(scaledWidth);
+        writer.writeInt(scaledHeight);
         writer.writeInt(mipmapLevel);
-        std::copy(data, data + width*height*comp, item.data.begin() + writer.position);
-        stbi_image_free(data);
-        int offset = generateMipmap(width, height, mipmapLevel, item.data.data() + sizeof(int) * 3);
+        if (textureScale > 1)
+        {
+            TraceScope scope("codec", "resample image");
+            resampleMipmaps(data.get(), width, height, scaledWidth, scaledHeight, mipmapLevel,
+                item.data.data() + TextureHeader::size);
+            return;
+        }
+        std::copy(data.get(), data.get() + pixelBytes, item.data.begin() + writer.position);
+        data.reset();
+        imageBytes.reset();
+        TraceScope scope("codec", "generate mipmap");
+        generateMipmap(width, height, mipmapLevel, item.data.data() + TextureHeader::size);
     }
 
     void pack_soundBuffer(const std::string &inputDir, PakItem &item)
+    {
+        pack_soundBuffer(inputDir, item, diskFileSource());
+    }
+
+    void pack_soundBuffer(const std::string &inputDir, PakItem &item, FileSource &source, int sampleRate, bool mono)
     {
         std::string inputFilePathBase = inputDir + item.name;
-        if (pathExists(inputFilePathBase.c_str()))
-        {
-            int fileSize = getFileSize(inputFilePathBase.c_str());
-            std::ifstream file(inputFilePathBase, std::ios::binary);
-            item.data.resize(fileSize);
-            item.length = fileSize;
-            file.read(reinterpret_cast<char*>(item.data.data()), fileSize);
-            file.close();
-        }
-        else if (pathExists((inputFilePathBase + ".wav").c_str()))
+        if (source.exists(inputFilePathBase))
+            pack_raw(inputDir, item, source);
+        else if (source.exists(inputFilePathBase + ".wav"))
         {
             static const int bitsPerSample = 16;
 
             std::string fileName = inputFilePathBase + ".wav";
-            std::ifstream fin(fileName, std::ios::binary);
+            checkItemSize(source.size(fileName), item.name);
+            std::vector<byte> buffer;
+            FileView file = viewFile(source, fileName, buffer);
             WavHeader header;
-            fin.read(reinterpret_cast<char*>(&header), sizeof(header));
-            item.data.resize(header.subchunk2Size + 13);
-            MemoryBinaryWriter writer(item.data.data());
-            writer.writeBoolean(false);
-            writer.writeInt(header.channelCount);
-            writer.writeInt(header.sampleRate);
-            writer.writeInt(header.subchunk2Size);
-
-            if (header.bitsPerSample != 16)
+            if (file.size < sizeof(header))
+                throw std::runtime_error("WAV-" + fileName + ": truncated header.");
+            std::memcpy(&header, file.data, sizeof(header));
+            if (header.subchunk2Size > file.size - sizeof(header))
+                throw std::runtime_error("WAV-" + fileName + ": truncated sample data.");
+            if (header.bitsPerSample != bitsPerSample)
             {
                 throw std::runtime_error("WAV-" + fileName + ": bitsPerSample must be 16.");
             }
+            const byte *samples = file.data + sizeof(header);
+
+            int channelCount = header.channelCount;
+            int rate = static_cast<int>(header.sampleRate);
+            bool downmix = mono && channelCount > 1;
+            bool resample = sampleRate > 0 && sampleRate != rate;
+            std::vector<std::int16_t> converted;
+            if (downmix || resample)
+            {
+                if (channelCount <= 0 || rate <= 0)
+                    throw std::runtime_error("WAV-" + fileName + ": invalid format.");
+                TraceScope scope("codec", "convert sound");
+                std::size_t frameCount = header.subchunk2Size / (2 * channelCount);
+                converted.resize(frameCount * channelCount);
+                std::memcpy(converted.data(), samples, converted.size() * 2);
+                if (downmix)
+                {
+                    converted = downmixToMono(converted.data(), frameCount, channelCount);
+                    channelCount = 1;
+                }
+                if (resample)
+                {
+                    Resampler resampler(rate, sampleRate);
+                    std::vector<std::int16_t> output(resampler.outputFrames(frameCount) * channelCount);
+                    resampler.process(converted.data(), frameCount, channelCount, output.data());
+                    converted.swap(output);
+                    rate = sampleRate;
+                }
+                samples = reinterpret_cast<const byte*>(converted.data());
+            }
+            std::size_t sampleBytes = downmix || resample ? converted.size() * 2 : header.subchunk2Size;
 
-            fin.read(reinterpret_cast<char*>(item.data.data() + writer.position), header.subchunk2Size);
-            fin.close();
-            item.length = item.data.size();
+            TrackedBytes itemBytes(MemoryCategory::ItemBuffer, sampleBytes + 13);
+            item.data.resize(sampleBytes + 13);
+            MemoryBinaryWriter writer(item.data.data());
+            writer.writeBoolean(false);
+            writer.writeInt(channelCount);
+            writer.writeInt(rate);
+            writer.writeInt(static_cast<int>(sampleBytes));
+            std::memcpy(item.data.data() + writer.position, samples, sampleBytes);
+            item.length = static_cast<std::int64_t>(item.data.size());
         }
     }
 
 
-    int calcMipmapSize(int width, int height, int level)
+    std::int64_t calcMipmapSize(int width, int height, int level)
     {
         if (level == 1)
-            return width * height;
+            return static_cast<std::int64_t>(width) * height;
         if (!isPowerOfTwo(width) || !isPowerOfTwo(height))
             throw std::runtime_error("generating mipmaps for non-power of 2 images not supported");
 
-        int size = width * height;
+        std::int64_t size = static_cast<std::int64_t>(width) * height;
         while (width != 1 && height != 1 && level > 1)
         {
             width /= 2;
             height /= 2;
             --level;
-            size += width * height;
+            size += static_cast<std::int64_t>(width) * height;
         }
         if (width == 1 && height != 1)
             while (height != 1 && level > 1)
             {
                 height /= 2;
                 --level;
-                size += width * height;
+                size += static_cast<std::int64_t>(width) * height;
             }
         else if (height == 1 && width != 1)
             while (width != 1 && level > 1)
             {
                 width /= 2;
                 --level;
-                size += width*height;
+                size += static_cast<std::int64_t>(width) * height;
             }
         return size;
     }
 
-    int generateMipmap(int width, int height, int level, unsigned char *image)
+    std::size_t generateMipmap(int width, int height, int level, unsigned char *image)
     {
         const int comp = 4;
 
         if (level == 1)
-            return width * height * comp;
+            return static_cast<std::size_t>(width) * height * comp;
         if (!isPowerOfTwo(width) || !isPowerOfTwo(height))
             throw std::runtime_error("generating mipmaps for non-power of 2 images not supported");
 
-        int offset = width * height * comp;
+        std::size_t offset = static_cast<std::size_t>(width) * height * comp;
         int w = width, h = height;
         while (w != 1 && h % 2 != 1 && level > 1)
         {
@@ -315,7 +688,7 @@ namespace scpak
             stbir_resize_uint8(image, width, height, 0,
                 image + offset, w, h, 0,
                 comp);
-            offset += w * h * comp;
+            offset += static_cast<std::size_t>(w) * h * comp;
         }
         if (w == 1 && h != 1)
             while (h != 1 && level > 1)
@@ -325,7 +698,7 @@ namespace scpak
                 stbir_resize_uint8(image, width, height, 0,
                     image + offset, w, h, 0,
                     comp);
-                offset += w * h * comp;
+                offset += static_cast<std::size_t>(w) * h * comp;
             }
         else if (h == 1 && w != 1)
             while (w != 1 && level > 1)
@@ -335,7 +708,7 @@ namespace scpak
                 stbir_resize_uint8(image, width, height, 0,
                     image + offset, w, h, 0,
                     comp);
-                offset += w * h * comp;
+                offset += static_cast<std::size_t>(w) * h * comp;
             }
         return offset;
     }
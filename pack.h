@@ -1,12 +1,57 @@
 #pragma once
 #include "pakfile.h"
+#include "filesource.h"
 #include <string>
 #include <functional>
 #include <map>
+#include <ostream>
+#include <vector>
 
 namespace scpak
 {
     typedef std::function<void(const std::string &inputDir, PakItem &output, const std::string &meta)> packer_type;
+
+    struct PackOptions
+    {
+        bool packText = false;
+        bool packTexture = false;
+        bool packFont = false;
+        bool packSound = false;
+        // re-emit XElement items without comments and insignificant whitespace
+        bool minifyXml = false;
+        // divides the size of textures and font atlases, a power of 2; mip
+        // chains lose their top levels, single images are resampled
+        int textureScale = 1;
+        // re-pack the glyphs of font atlases into the smallest atlas they fit
+        bool compactFonts = false;
+        // sample rate sounds are resampled to, 0 keeps that of the source
+        int sampleRate = 0;
+        // downmix sounds with several channels to one
+        bool monoSound = false;
+        // where to report per-item results of optional passes, may be null
+        std::ostream *report = nullptr;
+        // used for types without a built-in codec, keyed by type name
+        std::map<std::string, packer_type> customPackers;
+        // payload placement when the packed pak is saved
+        PakLayout layout;
+        // items listed in the manifest but not selected are copied from
+        // reference (by name and type), or left out without one
+        ItemFilter filter;
+        const PakFile *reference = nullptr;
+    };
+
+    struct ManifestEntry
+    {
+        PakItem item; // name, type and typeId only
+        std::string meta;
+    };
+
+    // reads item names for PakLayout::accessOrder, one per line
+    std::vector<std::string> readAccessOrder(const std::string &path);
+
+    // parses the manifest (PakInfoFileName) of an unpacked directory
+    std::vector<ManifestEntry> readManifest(const std::string &dirPath);
+
     PakFile pack(const std::string &dirPath,
         const std::map<std::string, packer_type> &packers,
         const packer_type &default_packer);
@@ -15,12 +60,34 @@ namespace scpak
         bool packTexture = false,
         bool packFont = false,
         bool packSound = false);
+    PakFile pack(const std::string &dirPath, const PackOptions &options);
     PakFile packAll(const std::string &dirPath);
+    // packs one item the way pack(dirPath, options) does; inputDir ends with pathsep
+    void packItem(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options);
+    // the same, built-in packers reading their files from source
+    void packItem(const std::string &inputDir, PakItem &item, const std::string &meta, const PackOptions &options, FileSource &source);
 
     void pack_raw(const std::string &inputDir, PakItem &item);
     void pack_string(const std::string &inputDir, PakItem &item);
+    void pack_xmlMinified(const std::string &inputDir, PakItem &item, std::ostream *report);
     void pack_bitmapFont(const std::string &inputDir, PakItem &item);
     void pack_texture(const std::string &inputDir, PakItem &item, const std::string &meta);
     void pack_soundBuffer(const std::string &inputDir, PakItem &item);
+
+    // read their input files from source instead of the filesystem
+    void pack_raw(const std::string &inputDir, PakItem &item, FileSource &source);
+    void pack_string(const std::string &inputDir, PakItem &item, FileSource &source);
+    void pack_xmlMinified(const std::string &inputDir, PakItem &item, std::ostream *report, FileSource &source);
+    // textureScale and compact as PackOptions::textureScale and compactFonts
+    void pack_bitmapFont(const std::string &inputDir, PakItem &item, FileSource &source, int textureScale = 1,
+        bool compact = false);
+    void pack_texture(const std::string &inputDir, PakItem &item, const std::string &meta, FileSource &source, int textureScale = 1);
+    // sampleRate and mono as PackOptions::sampleRate and monoSound
+    void pack_soundBuffer(const std::string &inputDir, PakItem &item, FileSource &source, int sampleRate = 0, bool mono = false);
+
+    // pixels in the whole mip chain, 64-bit so that large atlases do not overflow
+    std::int64_t calcMipmapSize(int width, int height, int level = 0);
+    // bytes of the whole mip chain
+    std::size_t generateMipmap(int width, int height, int level, unsigned char *image);
 }
 
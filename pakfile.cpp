@@ -1,9 +1,14 @@
 #include "pakfile.h"
+#include "trace.h"
+#include "native.h"
+#include "progress.h"
 
 #include <stdexcept>
 #include <iterator>
 #include <algorithm>
 #include <cstring>
+#include <map>
+#include <unordered_map>
 
 
 namespace scpak
@@ -18,37 +23,462 @@ namespace scpak
     }
 
 
-    void PakFile::load(std::istream &stream)
+    namespace
+    {
+        // gaps up to this size are read through instead of seeked over
+        const std::int64_t maxReadGap = 64 << 10;
+        // nearby payloads are read together up to this size
+        const std::int64_t maxReadRun = 1 << 20;
+        // payloads this large are read straight into their item
+        const std::int64_t directReadSize = 256 << 10;
+        const std::int64_t readAheadWindow = 8 << 20;
+
+        // Hints the payloads of the items in read order up to a window past
+        // the one being read, ranges close to each other as one.
+        class ReadAheadWindow
+        {
+        public:
+            ReadAheadWindow(ReadAhead *readAhead, std::int64_t contentOffset, const std::vector<PakItem> &contents,
+                const std::vector<std::size_t> &order) :
+                m_readAhead(readAhead), m_contentOffset(contentOffset), m_contents(contents), m_order(order)
+            { }
+
+            // before reading the item at position in the order
+            void advance(std::size_t position)
+            {
+                if (m_readAhead == nullptr)
+                    return;
+                std::int64_t limit = m_contents[m_order[position]].offset + readAheadWindow;
+                std::int64_t begin = 0, end = 0;
+                for (; m_next < m_order.size() && (m_next <= position || m_contents[m_order[m_next]].offset < limit); ++m_next)
+                {
+                    const PakItem &item = m_contents[m_order[m_next]];
+                    if (end > begin && item.offset >= begin && item.offset - end <= maxReadGap)
+                    {
+                        end = std::max(end, item.offset + item.length);
+                        continue;
+                    }
+                    m_readAhead->willNeed(m_contentOffset + begin, end - begin);
+                    begin = item.offset;
+                    end = item.offset + item.length;
+                }
+                m_readAhead->willNeed(m_contentOffset + begin, end - begin);
+            }
+        private:
+            ReadAhead *m_readAhead;
+            std::int64_t m_contentOffset;
+            const std::vector<PakItem> &m_contents;
+            const std::vector<std::size_t> &m_order;
+            std::size_t m_next = 0;
+        };
+
+        // type as the static interned name where it is a known one
+        PakString internedType(ItemType id, const PakString &type)
+        {
+            const char *name = itemTypeName(id);
+            if (name == nullptr || type != name)
+                return type;
+            return PakString::borrow(name, std::strlen(name));
+        }
+
+        // Appends count entries of the directory held by block. Each string
+        // is moved to the front of its entry and NUL-terminated in place, so
+        // the items point into block rather than owning their strings; the
+        // write position never passes the read position as every string has
+        // a length prefix of at least one byte.
+        void parseDirectory(const std::shared_ptr<std::vector<char>> &block, int count, std::vector<PakItem> &contents)
+        {
+            char *base = block->data();
+            MemoryBinaryReader reader(reinterpret_cast<const byte*>(base), block->size());
+            std::size_t written = 0;
+            auto readString = [&]()
+            {
+                std::int32_t length = reader.read7BitEncodedInt();
+                if (length < 0 || static_cast<std::size_t>(length) > block->size() - reader.position)
+                    throw BadPakException("truncated pak directory");
+                std::memmove(base + written, base + reader.position, length);
+                base[written + length] = '\0';
+                PakString value(base + written, static_cast<std::size_t>(length), block);
+                written += length + 1;
+                reader.position += length;
+                return value;
+            };
+            contents.reserve(contents.size() + count);
+            for (int i = 0; i < count; ++i)
+            {
+                PakItem item;
+                item.name = readString();
+                item.type = readString();
+                item.typeId = internItemType(item.type.data(), item.type.size());
+                item.type = internedType(item.typeId, item.type);
+                item.offset = reader.readInt32();
+                item.length = reader.readInt32();
+                contents.push_back(std::move(item));
+            }
+        }
+
+        // moves the stream from position to offset, both relative to the
+        // content; position is -1 where unknown
+        void moveTo(std::istream &stream, std::int64_t contentOffset, std::int64_t position, std::int64_t offset)
+        {
+            if (position >= 0 && offset >= position && offset - position <= maxReadGap)
+                stream.ignore(static_cast<std::streamsize>(offset - position));
+            else
+                stream.seekg(static_cast<std::streamoff>(contentOffset + offset), std::ios::beg);
+        }
+    }
+
+    void PakFile::load(std::istream &stream, bool arena)
+    {
+        load(stream, arena, nullptr);
+    }
+
+    void PakFile::load(std::istream &stream, const ItemFilter &filter)
+    {
+        load(stream, filter, nullptr);
+    }
+
+    void PakFile::load(const std::string &path, bool arena)
+    {
+        std::ifstream fin(path, std::ios::binary);
+        if (!fin)
+            throw std::runtime_error("cannot open " + path);
+        ReadAhead readAhead(path);
+        load(fin, arena, &readAhead);
+    }
+
+    void PakFile::load(const std::string &path, const ItemFilter &filter)
+    {
+        std::ifstream fin(path, std::ios::binary);
+        if (!fin)
+            throw std::runtime_error("cannot open " + path);
+        ReadAhead readAhead(path);
+        load(fin, filter, &readAhead);
+    }
+
+    void PakFile::load(std::istream &stream, bool arena, ReadAhead *readAhead)
     {
         // read header
+        TraceScope scope("phase", "load");
         PakHeader header;
         stream.read(reinterpret_cast<char*>(&header), sizeof(header));
         if (!header.checkMagic())
             throw BadPakException("invalid pak header");
-        StreamBinaryReader reader(&stream);
-        // read content dictionary
-        for (int i = 0; i<header.contentCount; ++i)
-        {
-            PakItem item;
-            item.name = reader.readString();
-            item.type = reader.readString();
-            item.offset = reader.readInt32();
-            item.length = reader.readInt32();
-            addItem(std::move(item));
-        }
-        // read all contents
-        for (PakItem &item : m_contents)
+        if (arena)
+        {
+            loadArena(stream, header, readAhead);
+            return;
+        }
+        std::size_t first = m_contents.size();
+        readDirectory(stream, header);
+        for (std::size_t i = first; i < m_contents.size(); ++i)
+        {
+            if (m_contents[i].offset < 0 || m_contents[i].length < 0)
+                throw BadPakException("invalid item range in pak directory");
+        }
+        // read all contents in file order, so that edited or merged paks
+        // whose directory order differs from it are not read at random
+        TraceScope contentScope("phase", "load contents");
+        ProgressOperation progress("load", m_contents.size() - first, Progress::observer() != nullptr ? totalLength(first) : 0);
+        std::vector<std::size_t> order;
+        order.reserve(m_contents.size() - first);
+        for (std::size_t i = first; i < m_contents.size(); ++i)
+            order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b)
+        {
+            return m_contents[a].offset < m_contents[b].offset;
+        });
+        ReadAheadWindow window(readAhead, header.contentOffset, m_contents, order);
+        std::vector<byte> run;
+        std::int64_t position = -1;
+        for (std::size_t i = 0; i < order.size();)
+        {
+            // small payloads close to each other are read with one call and
+            // copied out, the gaps between them (at least the DEADBEEF
+            // markers) are read along
+            std::int64_t begin = m_contents[order[i]].offset;
+            std::int64_t end = begin + m_contents[order[i]].length;
+            std::size_t last = i + 1;
+            if (end - begin < directReadSize)
+            {
+                for (; last < order.size(); ++last)
+                {
+                    const PakItem &next = m_contents[order[last]];
+                    std::int64_t nextEnd = std::max(end, next.offset + next.length);
+                    if (next.length >= directReadSize || next.offset - end > maxReadGap || nextEnd - begin > maxReadRun)
+                        break;
+                    end = nextEnd;
+                }
+            }
+            window.advance(i);
+            moveTo(stream, header.contentOffset, position, begin);
+            const byte *source = nullptr;
+            if (last != i + 1)
+            {
+                TraceScope readScope("io", "read run");
+                run.resize(static_cast<std::size_t>(end - begin));
+                if (!stream.read(reinterpret_cast<char*>(run.data()), end - begin))
+                    throw BadPakException("truncated pak contents");
+                source = run.data();
+            }
+            for (; i < last; ++i)
+            {
+                PakItem &item = m_contents[order[i]];
+                ProgressItem itemProgress("load", item.name, item.type, item.length);
+                ItemMemoryScope memoryScope(item.name.c_str());
+                m_memory.add(static_cast<std::size_t>(item.length));
+                item.data.resize(static_cast<std::size_t>(item.length));
+                if (source != nullptr)
+                    std::copy(source + (item.offset - begin), source + (item.offset - begin) + item.length, item.data.begin());
+                else if (!stream.read(reinterpret_cast<char*>(item.data.data()), item.length))
+                    throw BadPakException("truncated pak contents");
+                item.offset = -1; // we will not be able to access the stream
+            }
+            position = end;
+        }
+    }
+
+    void PakFile::readDirectory(std::istream &stream, const PakHeader &header)
+    {
+        // the dictionary sits between the header and the content region
+        std::streamoff directorySize = header.contentOffset - static_cast<std::streamoff>(sizeof(header));
+        if (header.contentCount < 0 || directorySize < 0)
+            throw BadPakException("invalid pak header");
+        TraceScope directoryScope("phase", "load directory");
+        std::shared_ptr<std::vector<char>> directory = std::make_shared<std::vector<char>>(static_cast<std::size_t>(directorySize));
+        if (!stream.read(directory->data(), directorySize))
+            throw BadPakException("truncated pak directory");
+        parseDirectory(directory, header.contentCount, m_contents);
+    }
+
+
+    void PakFile::loadArena(std::istream &stream, const PakHeader &header, ReadAhead *readAhead)
+    {
+        readDirectory(stream, header);
+
+        TraceScope contentScope("phase", "load contents");
+        std::size_t first = m_contents.size() - header.contentCount;
+        std::int64_t contentSize = 0;
+        for (std::size_t i = first; i < m_contents.size(); ++i)
+        {
+            const PakItem &item = m_contents[i];
+            if (item.offset < 0 || item.length < 0)
+                throw BadPakException("invalid item range in pak directory");
+            contentSize = std::max(contentSize, item.offset + item.length);
+        }
+        ProgressOperation progress("load", header.contentCount, Progress::observer() != nullptr ? totalLength(first) : 0);
+        m_memory.add(static_cast<std::size_t>(contentSize));
+        std::shared_ptr<std::vector<byte>> buffer = std::make_shared<std::vector<byte>>(static_cast<std::size_t>(contentSize));
+        stream.seekg(header.contentOffset, std::ios::beg);
+        if (readAhead != nullptr)
+            readAhead->sequential();
+        if (!stream.read(reinterpret_cast<char*>(buffer->data()), contentSize))
+            throw BadPakException("truncated pak contents");
+        // read in one go, so items can only be reported afterwards
+        for (std::size_t i = first; i < m_contents.size(); ++i)
+        {
+            PakItem &item = m_contents[i];
+            ProgressItem itemProgress("load", item.name, item.type, item.length);
+            item.view = buffer->data() + item.offset;
+            item.offset = -1;
+        }
+        m_buffers.push_back(buffer);
+    }
+
+    void PakFile::load(std::istream &stream, const ItemFilter &filter, ReadAhead *readAhead)
+    {
+        TraceScope scope("phase", "load");
+        PakHeader header;
+        stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!header.checkMagic())
+            throw BadPakException("invalid pak header");
+        std::size_t first = m_contents.size();
+        readDirectory(stream, header);
+
+        TraceScope contentScope("phase", "load contents");
+        std::vector<std::size_t> selected;
+        std::size_t contentSize = 0;
+        for (std::size_t i = first; i < m_contents.size(); ++i)
         {
-            stream.seekg(header.contentOffset + item.offset, std::ios::beg);
-            item.data.resize(item.length);
-            stream.read(reinterpret_cast<char*>(item.data.data()), item.length);
-            item.offset = -1; // we will not be able to access the stream
+            PakItem &item = m_contents[i];
+            if (item.offset < 0 || item.length < 0)
+                throw BadPakException("invalid item range in pak directory");
+            if (filter.matches(item.name, item.type))
+            {
+                selected.push_back(i);
+                contentSize += static_cast<std::size_t>(item.length);
+            }
+            else
+                item.offset = -1;
         }
+        // excluded payloads are skipped over, never read
+        std::sort(selected.begin(), selected.end(), [&](std::size_t a, std::size_t b)
+        {
+            return m_contents[a].offset < m_contents[b].offset;
+        });
+        ProgressOperation progress("load", selected.size(), static_cast<std::int64_t>(contentSize));
+        m_memory.add(contentSize);
+        std::shared_ptr<std::vector<byte>> buffer = std::make_shared<std::vector<byte>>(contentSize);
+        ReadAheadWindow window(readAhead, header.contentOffset, m_contents, selected);
+        byte *position = buffer->data();
+        std::int64_t streamPosition = -1;
+        for (std::size_t i = 0; i < selected.size(); ++i)
+        {
+            PakItem &item = m_contents[selected[i]];
+            ProgressItem itemProgress("load", item.name, item.type, item.length);
+            window.advance(i);
+            moveTo(stream, header.contentOffset, streamPosition, item.offset);
+            if (!stream.read(reinterpret_cast<char*>(position), item.length))
+                throw BadPakException("truncated pak contents");
+            streamPosition = item.offset + item.length;
+            item.view = position;
+            item.offset = -1;
+            position += item.length;
+        }
+        m_buffers.push_back(buffer);
+    }
+
+    void PakFile::loadDirectory(std::istream &stream)
+    {
+        TraceScope scope("phase", "load");
+        PakHeader header;
+        stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!header.checkMagic())
+            throw BadPakException("invalid pak header");
+        std::size_t first = m_contents.size();
+        readDirectory(stream, header);
+        for (std::size_t i = first; i < m_contents.size(); ++i)
+        {
+            if (m_contents[i].offset < 0 || m_contents[i].length < 0)
+                throw BadPakException("invalid item range in pak directory");
+        }
+        m_contentOffset = header.contentOffset;
+    }
+
+    void PakFile::readRange(std::istream &stream, const PakItem &item, std::int64_t offset, byte *buffer, std::size_t size) const
+    {
+        if (offset < 0 || offset + static_cast<std::int64_t>(size) > item.length)
+            throw BadPakException(("range outside the payload of " + item.name).c_str());
+        if (size == 0)
+            return;
+        if (item.view != nullptr || item.data.size() >= static_cast<std::size_t>(item.length))
+        {
+            std::memcpy(buffer, item.payload() + offset, size);
+            return;
+        }
+        if (item.offset < 0)
+            throw BadPakException(("payload of " + item.name + " was not loaded").c_str());
+        TraceScope scope("io", "read range", item.name.c_str());
+        stream.clear();
+        stream.seekg(m_contentOffset + item.offset + offset, std::ios::beg);
+        if (!stream.read(reinterpret_cast<char*>(buffer), size))
+            throw BadPakException("truncated pak contents");
+    }
+
+    void PakFile::loadMapped(const std::string &path)
+    {
+        // mapped pages belong to the page cache, so they are not tracked
+        std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>(path.c_str());
+        loadView(mapping->data(), mapping->size(), mapping);
+    }
+
+    void PakFile::loadView(const byte *data, std::size_t size, std::shared_ptr<const void> owner)
+    {
+        TraceScope scope("phase", "load");
+        PakHeader header;
+        if (size < sizeof(header))
+            throw BadPakException("invalid pak header");
+        std::memcpy(&header, data, sizeof(header));
+        if (!header.checkMagic())
+            throw BadPakException("invalid pak header");
+        if (header.contentCount < 0 || header.contentOffset < static_cast<std::int32_t>(sizeof(header))
+            || static_cast<std::size_t>(header.contentOffset) > size)
+            throw BadPakException("invalid pak header");
+
+        TraceScope directoryScope("phase", "load directory");
+        // the strings are terminated in a copy, the view stays untouched
+        std::shared_ptr<std::vector<char>> directory = std::make_shared<std::vector<char>>(
+            reinterpret_cast<const char*>(data) + sizeof(header), reinterpret_cast<const char*>(data) + header.contentOffset);
+        std::size_t first = m_contents.size();
+        parseDirectory(directory, header.contentCount, m_contents);
+        for (std::size_t i = first; i < m_contents.size(); ++i)
+        {
+            PakItem &item = m_contents[i];
+            if (item.offset < 0 || item.length < 0
+                || static_cast<std::uint64_t>(header.contentOffset + item.offset + item.length) > size)
+                throw BadPakException("invalid item range in pak directory");
+            item.view = data + header.contentOffset + item.offset;
+            item.offset = -1;
+        }
+        m_buffers.push_back(owner);
     }
 
     void PakFile::save(std::ostream &stream)
     {
+        save(stream, PakLayout());
+    }
+
+    std::vector<std::size_t> PakFile::payloadOrder(const PakLayout &layout) const
+    {
+        std::vector<std::size_t> order;
+        order.reserve(m_contents.size());
+        std::vector<bool> placed(m_contents.size(), false);
+        if (!layout.accessOrder.empty())
+        {
+            std::unordered_map<PakString, std::size_t> indexes;
+            for (std::size_t i = 0; i < m_contents.size(); ++i)
+                indexes.emplace(m_contents[i].name, i);
+            for (const std::string &name : layout.accessOrder)
+            {
+                auto it = indexes.find(PakString::borrow(name));
+                if (it == indexes.end() || placed[it->second])
+                    continue;
+                order.push_back(it->second);
+                placed[it->second] = true;
+            }
+        }
+        if (layout.groupByType)
+        {
+            std::map<PakString, std::size_t> groupIndexes;
+            std::vector<std::vector<std::size_t>> groups;
+            for (std::size_t i = 0; i < m_contents.size(); ++i)
+            {
+                if (placed[i])
+                    continue;
+                auto it = groupIndexes.emplace(m_contents[i].type, groups.size()).first;
+                if (it->second == groups.size())
+                    groups.emplace_back();
+                groups[it->second].push_back(i);
+            }
+            for (const std::vector<std::size_t> &group : groups)
+                order.insert(order.end(), group.begin(), group.end());
+        }
+        else
+        {
+            for (std::size_t i = 0; i < m_contents.size(); ++i)
+                if (!placed[i])
+                    order.push_back(i);
+        }
+        return order;
+    }
+
+    void PakFile::save(std::ostream &stream, const PakLayout &layout)
+    {
+        // catch what cannot fit the 32-bit offsets before writing anything,
+        // padding and the directory are checked while writing
+        std::int64_t contentSize = 0;
+        for (const PakItem &item : m_contents)
+        {
+            if (item.length < 0 || item.length > maxPakOffset)
+                throw BadPakException(("payload of " + item.name + " does not fit a pak").c_str());
+            if (item.view == nullptr && item.data.size() < static_cast<std::size_t>(item.length))
+                throw BadPakException(("payload of " + item.name + " was not loaded").c_str());
+            contentSize += 4 + item.length;
+        }
+        if (contentSize > maxPakOffset + 4)
+            throw BadPakException("contents too large for a pak, offsets are 32-bit");
         // write file header for the first time
+        TraceScope scope("phase", "save");
         PakHeader header;
         header.contentCount = m_contents.size();
         StreamBinaryWriter writer(&stream);
@@ -58,23 +488,43 @@ namespace scpak
         // write content dictionary for the first time
         for (const PakItem &item : m_contents)
         {
-            writer.writeString(item.name);
-            writer.writeString(item.type);
-            writer.writeInt(item.offset); // should be -1
-            writer.writeInt(item.length);
+            writer.writeString(item.name.data(), item.name.size());
+            writer.writeString(item.type.data(), item.type.size());
+            writer.writeInt(-1);
+            writer.writeInt(static_cast<int>(item.length));
         }
-        header.contentOffset = stream.tellp();
+        ProgressOperation progress("save", m_contents.size(), contentSize - 4 * static_cast<std::int64_t>(m_contents.size()));
+        std::streamoff contentOffset = stream.tellp();
+        if (contentOffset > maxPakOffset)
+            throw BadPakException("pak directory too large, offsets are 32-bit");
+        header.contentOffset = static_cast<std::int32_t>(contentOffset);
         // write content items
-        for (PakItem &item : m_contents)
+        static const char padding[4096] = {};
+        for (std::size_t i : payloadOrder(layout))
         {
+            PakItem &item = m_contents[i];
+            ProgressItem itemProgress("save", item.name, item.type, item.length);
+            if (layout.alignment != 0 && static_cast<std::size_t>(item.length) >= layout.alignment)
+            {
+                std::uint64_t position = static_cast<std::uint64_t>(stream.tellp()) + 4;
+                std::size_t remaining = static_cast<std::size_t>((layout.alignment - position % layout.alignment) % layout.alignment);
+                while (remaining != 0)
+                {
+                    std::size_t count = std::min(remaining, sizeof(padding));
+                    stream.write(padding, count);
+                    remaining -= count;
+                }
+            }
             // there is a magic number before every content data in origin Content.pak
             // it's DEADBEEF
             stream.put(0xDE);
             stream.put(0xAD);
             stream.put(0xBE);
             stream.put(0xEF);
-            item.offset = static_cast<int>(stream.tellp()) - header.contentOffset;
-            stream.write(reinterpret_cast<char*>(item.data.data()), item.length);
+            item.offset = static_cast<std::int64_t>(stream.tellp()) - contentOffset;
+            if (item.offset > maxPakOffset)
+                throw BadPakException("contents too large for a pak, offsets are 32-bit");
+            stream.write(reinterpret_cast<const char*>(item.payload()), item.length);
         }
         // write the header again
         stream.seekp(0, std::ios::beg);
@@ -82,14 +532,22 @@ namespace scpak
         // write content dictionary again
         for (PakItem &item : m_contents)
         {
-            writer.writeString(item.name);
-            writer.writeString(item.type);
-            writer.writeInt(item.offset);
-            writer.writeInt(item.length);
+            writer.writeString(item.name.data(), item.name.size());
+            writer.writeString(item.type.data(), item.type.size());
+            writer.writeInt(static_cast<int>(item.offset));
+            writer.writeInt(static_cast<int>(item.length));
             item.offset = -1; // as items can be modified, it is meaningless to keep a offset
         }
     }
 
+    std::int64_t PakFile::totalLength(std::size_t first) const
+    {
+        std::int64_t total = 0;
+        for (std::size_t i = first; i < m_contents.size(); ++i)
+            total += m_contents[i].length;
+        return total;
+    }
+
     const std::vector<PakItem>& PakFile::contents() const
     {
         return m_contents;
@@ -97,11 +555,20 @@ namespace scpak
 
     void PakFile::addItem(const PakItem &item)
     {
+        m_memory.add(item.data.size());
         m_contents.push_back(item);
+        PakItem &added = m_contents.back();
+        if (added.typeId == ItemType::Other)
+            added.typeId = internItemType(added.type.data(), added.type.size());
+        added.type = internedType(added.typeId, added.type);
     }
 
     void PakFile::addItem(PakItem &&item)
     {
+        m_memory.add(item.data.size());
+        if (item.typeId == ItemType::Other)
+            item.typeId = internItemType(item.type.data(), item.type.size());
+        item.type = internedType(item.typeId, item.type);
         m_contents.push_back(std::move(item));
     }
 
@@ -112,6 +579,7 @@ namespace scpak
 
     void PakFile::removeItem(std::size_t where)
     {
+        m_memory.sub(m_contents.at(where).data.size());
         m_contents.erase(m_contents.begin() + where);
     }
 }
@@ -2,12 +2,21 @@
 
 #include <fstream>
 #include <vector>
+#include <memory>
+#include <cstdint>
+#include <limits>
 
 #include "scpak.h"
 #include "binaryio.h"
+#include "memtrack.h"
+#include "itemtype.h"
+#include "itemfilter.h"
+#include "pakstring.h"
 
 namespace scpak
 {
+    class ReadAhead;
+
     class BadPakException : public BaseException
     {
     public:
@@ -33,25 +42,101 @@ namespace scpak
 
     typedef struct // PakItem
     {
-        std::string name;
-        std::string type;
-        int offset = -1;
-        int length = -1;
+        // loaded items share the directory block, known types the
+        // static type names
+        PakString name;
+        PakString type;
+        ItemType typeId = ItemType::Other; // interned from type by load() and addItem()
+        std::int64_t offset = -1;
+        std::int64_t length = -1;
         std::vector<byte> data;
+        // set instead of data by arena loads, points into the PakFile's arena;
+        // reset it to nullptr before giving the item its own data
+        const byte *view = nullptr;
+        // keeps view valid when it points outside the PakFile, e.g. into a
+        // mapped source file
+        std::shared_ptr<const void> owner;
+
+        const byte *payload() const
+        {
+            return view != nullptr ? view : data.data();
+        }
     } PakItem;
 
+    // offsets and lengths are 64-bit in memory but signed 32-bit on disk,
+    // so no payload, content offset or directory may go past this
+    const std::int64_t maxPakOffset = std::numeric_limits<std::int32_t>::max();
+
+    // Where save() places payloads. The directory keeps the item order,
+    // only the payload offsets change, so readers need no changes.
+    struct PakLayout
+    {
+        // payloads of the same type next to each other, types in the order
+        // they first appear
+        bool groupByType = false;
+        // item names in the order they are read, e.g. by the game; their
+        // payloads come first and in this order, unknown names are ignored
+        std::vector<std::string> accessOrder;
+        // if not 0, payloads of at least this many bytes start at a file
+        // offset that is a multiple of it, zero padding goes before the
+        // DEADBEEF marker
+        std::size_t alignment = 0;
+    };
+
     class PakFile
     {
     public:
-        void load(std::istream &stream);
+        // with arena set, the directory is read at once and all payloads are
+        // read into one shared buffer that items only point into; otherwise
+        // payloads are read in file order, nearby ones with a single read
+        void load(std::istream &stream, bool arena = false);
+        // reads the whole directory but only the payloads of the items
+        // filter selects, in file order into one arena; the other items
+        // keep their length but have no payload and cannot be saved
+        void load(std::istream &stream, const ItemFilter &filter);
+        // open path and load it as above, with read-ahead hints for the
+        // payloads after the one being read
+        void load(const std::string &path, bool arena = false);
+        void load(const std::string &path, const ItemFilter &filter);
+        // reads the directory only; items keep their offsets but get no
+        // payload, readRange() fetches parts of them from the stream later
+        void loadDirectory(std::istream &stream);
+        // maps the file and lets every item point into the mapping
+        void loadMapped(const std::string &path);
+        // parses a whole pak held in memory; items point into data, which
+        // must stay valid for as long as owner is alive
+        void loadView(const byte *data, std::size_t size, std::shared_ptr<const void> owner);
         void save(std::ostream &stream);
+        void save(std::ostream &stream, const PakLayout &layout);
+        // copies size bytes from offset into the payload of item; payloads
+        // that were not loaded are read from stream, which must be the one
+        // loadDirectory() read (and is not shared between threads)
+        void readRange(std::istream &stream, const PakItem &item, std::int64_t offset, byte *buffer, std::size_t size) const;
         const std::vector<PakItem>& contents() const;
+        // file offset item offsets of the last loadDirectory() count from
+        std::int64_t contentOffset() const { return m_contentOffset; }
         void addItem(const PakItem &item);
         void addItem(PakItem &&item);
         PakItem& getItem(std::size_t where);
         void removeItem(std::size_t where);
     private:
+        void load(std::istream &stream, bool arena, ReadAhead *readAhead);
+        void load(std::istream &stream, const ItemFilter &filter, ReadAhead *readAhead);
+        void loadArena(std::istream &stream, const PakHeader &header, ReadAhead *readAhead);
+        // appends the directory entries, offsets relative to the content
+        void readDirectory(std::istream &stream, const PakHeader &header);
+        // indexes into m_contents in the order their payloads are written
+        std::vector<std::size_t> payloadOrder(const PakLayout &layout) const;
+        // summed payload lengths of the items from first on
+        std::int64_t totalLength(std::size_t first) const;
+
         std::vector<PakItem> m_contents;
+        // of the last loadDirectory(), item offsets are relative to it
+        std::int64_t m_contentOffset = 0;
+        // arenas and mappings item views point into, shared so that copies
+        // of the PakFile keep the views valid
+        std::vector<std::shared_ptr<const void>> m_buffers;
+        TrackedBytes m_memory{ MemoryCategory::PakFile };
     };
 }
 
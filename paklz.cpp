@@ -0,0 +1,269 @@
+#include "paklz.h"
+#include "lz.h"
+#include "hash.h"
+#include "pakfile.h"
+#include "trace.h"
+#include "memtrack.h"
+#include "parallel.h"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+
+namespace scpak
+{
+    namespace
+    {
+        const byte lzMagic[4] = { byte('P'), byte('L'), byte('Z'), byte('\0') };
+        const std::uint32_t lzVersion = 1;
+        const std::uint32_t storedRawFlag = 0x80000000u;
+        const std::size_t headerSize = 12;
+        const std::size_t blockHeaderSize = 16;
+        const std::size_t maxBlockSize = std::size_t(1) << 30;
+        // blocks handed to each thread per batch, so that a slow block
+        // does not leave the others idle
+        const std::size_t blocksPerThread = 4;
+
+        void put32(byte *p, std::uint32_t value)
+        {
+            for (int i = 0; i < 4; ++i)
+                p[i] = static_cast<byte>(value >> (8 * i));
+        }
+
+        void put64(byte *p, std::uint64_t value)
+        {
+            for (int i = 0; i < 8; ++i)
+                p[i] = static_cast<byte>(value >> (8 * i));
+        }
+
+        std::uint32_t get32(const byte *p)
+        {
+            std::uint32_t value = 0;
+            for (int i = 0; i < 4; ++i)
+                value |= static_cast<std::uint32_t>(p[i]) << (8 * i);
+            return value;
+        }
+
+        std::uint64_t get64(const byte *p)
+        {
+            std::uint64_t value = 0;
+            for (int i = 0; i < 8; ++i)
+                value |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+            return value;
+        }
+    }
+
+    bool isPakLz(const std::string &path)
+    {
+        std::ifstream fin(path, std::ios::binary);
+        byte magic[sizeof(lzMagic)];
+        if (!fin.read(reinterpret_cast<char*>(magic), sizeof(magic)))
+            return false;
+        return std::memcmp(magic, lzMagic, sizeof(magic)) == 0;
+    }
+
+    void compressPak(std::istream &in, std::ostream &out, const LzOptions &options)
+    {
+        TraceScope scope("phase", "compress");
+        if (options.blockSize == 0 || options.blockSize > maxBlockSize)
+            throw std::runtime_error("invalid compression block size");
+        unsigned threads = threadCount(options.threads);
+        std::size_t blockSize = options.blockSize;
+        std::size_t batchBlocks = threads * blocksPerThread;
+
+        byte header[headerSize];
+        std::memcpy(header, lzMagic, sizeof(lzMagic));
+        put32(header + 4, lzVersion);
+        put32(header + 8, static_cast<std::uint32_t>(blockSize));
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+        struct Block
+        {
+            std::vector<byte> stored;
+            std::size_t storedSize;
+            std::size_t rawSize;
+            std::uint64_t hash;
+        };
+        TrackedBytes memory(MemoryCategory::ImageBuffer, batchBlocks * (blockSize + lzCompressBound(blockSize)));
+        std::vector<byte> raw(batchBlocks * blockSize);
+        std::vector<Block> blocks(batchBlocks);
+        std::uint64_t total = 0;
+        while (true)
+        {
+            in.read(reinterpret_cast<char*>(raw.data()), raw.size());
+            std::size_t length = static_cast<std::size_t>(in.gcount());
+            if (in.bad())
+                throw std::runtime_error("failed to read the pak to compress");
+            if (length == 0)
+                break;
+
+            std::size_t count = (length + blockSize - 1) / blockSize;
+            parallelFor(count, threads, [&](std::size_t i)
+            {
+                Block &block = blocks[i];
+                const byte *data = raw.data() + i * blockSize;
+                block.rawSize = std::min(blockSize, length - i * blockSize);
+                block.hash = hashBytes(data, block.rawSize);
+                block.stored.resize(lzCompressBound(blockSize));
+                // blocks that do not shrink are stored as they are
+                block.storedSize = lzCompress(data, block.rawSize, block.stored.data(), block.rawSize - 1);
+            });
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                const Block &block = blocks[i];
+                byte blockHeader[blockHeaderSize];
+                bool stored = block.storedSize == 0;
+                put32(blockHeader, stored ? static_cast<std::uint32_t>(block.rawSize) | storedRawFlag : static_cast<std::uint32_t>(block.storedSize));
+                put32(blockHeader + 4, static_cast<std::uint32_t>(block.rawSize));
+                put64(blockHeader + 8, block.hash);
+                out.write(reinterpret_cast<const char*>(blockHeader), sizeof(blockHeader));
+                if (stored)
+                    out.write(reinterpret_cast<const char*>(raw.data() + i * blockSize), block.rawSize);
+                else
+                    out.write(reinterpret_cast<const char*>(block.stored.data()), block.storedSize);
+            }
+            total += length;
+            if (length < raw.size())
+                break;
+        }
+
+        byte end[blockHeaderSize] = {};
+        put64(end + 8, total);
+        out.write(reinterpret_cast<const char*>(end), sizeof(end));
+        if (!out)
+            throw std::runtime_error("failed to write the compressed pak");
+    }
+
+    void decompressPak(std::istream &in, std::ostream &out, unsigned threads)
+    {
+        TraceScope scope("phase", "decompress");
+        LzStreamBuffer buffer(in, threads);
+        std::vector<char> chunk(std::size_t(4) << 20);
+        std::streamsize length;
+        while ((length = buffer.sgetn(chunk.data(), chunk.size())) > 0)
+            out.write(chunk.data(), length);
+        if (!out)
+            throw std::runtime_error("failed to write the decompressed pak");
+    }
+
+    LzStreamBuffer::LzStreamBuffer(std::istream &source, unsigned threads) :
+        m_source(source), m_threads(threadCount(threads)), m_position(0), m_finished(false)
+    {
+        byte header[headerSize];
+        if (!m_source.read(reinterpret_cast<char*>(header), sizeof(header)) || std::memcmp(header, lzMagic, sizeof(lzMagic)) != 0)
+            throw BadPakException("not a compressed pak");
+        if (get32(header + 4) != lzVersion)
+            throw BadPakException("unsupported compressed pak version");
+        m_blockSize = get32(header + 8);
+        if (m_blockSize == 0 || m_blockSize > maxBlockSize)
+            throw BadPakException("invalid compressed pak block size");
+    }
+
+    bool LzStreamBuffer::nextBatch()
+    {
+        m_position += egptr() - eback();
+        setg(nullptr, nullptr, nullptr);
+        if (m_finished)
+            return false;
+
+        struct Block
+        {
+            std::size_t storedOffset;
+            std::size_t storedSize;
+            std::size_t rawOffset;
+            std::size_t rawSize;
+            bool stored;
+            std::uint64_t hash;
+        };
+        std::vector<Block> blocks;
+        std::size_t storedTotal = 0;
+        std::size_t rawTotal = 0;
+        while (blocks.size() < m_threads * blocksPerThread)
+        {
+            byte header[blockHeaderSize];
+            if (!m_source.read(reinterpret_cast<char*>(header), sizeof(header)))
+                throw BadPakException("truncated compressed pak");
+            Block block;
+            std::uint32_t storedSize = get32(header);
+            block.rawSize = get32(header + 4);
+            block.hash = get64(header + 8);
+            if (storedSize == 0 && block.rawSize == 0)
+            {
+                if (block.hash != m_position + rawTotal)
+                    throw BadPakException("compressed pak size mismatch");
+                m_finished = true;
+                break;
+            }
+            block.stored = (storedSize & storedRawFlag) != 0;
+            block.storedSize = storedSize & ~storedRawFlag;
+            if (block.rawSize == 0 || block.rawSize > m_blockSize
+                || (block.stored ? block.storedSize != block.rawSize : block.storedSize >= block.rawSize))
+                throw BadPakException("invalid compressed pak block");
+            block.storedOffset = storedTotal;
+            block.rawOffset = rawTotal;
+            storedTotal += block.storedSize;
+            rawTotal += block.rawSize;
+            m_stored.resize(storedTotal);
+            if (!m_source.read(reinterpret_cast<char*>(m_stored.data() + block.storedOffset), block.storedSize))
+                throw BadPakException("truncated compressed pak");
+            blocks.push_back(block);
+        }
+
+        m_batch.resize(rawTotal);
+        parallelFor(blocks.size(), m_threads, [&](std::size_t i)
+        {
+            const Block &block = blocks[i];
+            byte *raw = reinterpret_cast<byte*>(m_batch.data()) + block.rawOffset;
+            if (block.stored)
+                std::memcpy(raw, m_stored.data() + block.storedOffset, block.rawSize);
+            else
+                lzDecompress(m_stored.data() + block.storedOffset, block.storedSize, raw, block.rawSize);
+            if (hashBytes(raw, block.rawSize) != block.hash)
+                throw BadPakException("checksum mismatch in compressed pak");
+        });
+        setg(m_batch.data(), m_batch.data(), m_batch.data() + rawTotal);
+        return rawTotal > 0;
+    }
+
+    LzStreamBuffer::int_type LzStreamBuffer::underflow()
+    {
+        if (gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if (!nextBatch())
+            return traits_type::eof();
+        return traits_type::to_int_type(*gptr());
+    }
+
+    LzStreamBuffer::pos_type LzStreamBuffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+    {
+        off_type current = static_cast<off_type>(m_position + (gptr() - eback()));
+        if (dir == std::ios_base::cur)
+            return seekpos(pos_type(current + off), which);
+        if (dir == std::ios_base::beg)
+            return seekpos(pos_type(off), which);
+        return pos_type(off_type(-1));
+    }
+
+    LzStreamBuffer::pos_type LzStreamBuffer::seekpos(pos_type pos, std::ios_base::openmode which)
+    {
+        off_type target = pos;
+        if (!(which & std::ios_base::in) || target < 0 || static_cast<std::uint64_t>(target) < m_position)
+            return pos_type(off_type(-1));
+        while (static_cast<std::uint64_t>(target) > m_position + (egptr() - eback()))
+        {
+            if (!nextBatch())
+                return pos_type(off_type(-1));
+        }
+        setg(eback(), eback() + (target - m_position), egptr());
+        return pos;
+    }
+
+    LzInputStream::LzInputStream(std::istream &source, unsigned threads) :
+        std::istream(nullptr), m_buffer(source, threads)
+    {
+        rdbuf(&m_buffer);
+        // let decompression errors through instead of a bare failed read
+        exceptions(std::ios::badbit);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "scpak.h"
+
+namespace scpak
+{
+    // .pak.lz is a transport wrapper around a raw pak (or any file): the
+    // bytes are cut into blocks that are compressed independently, so both
+    // directions run on all cores. Little endian layout:
+    //   header: "PLZ\0", u32 version (1), u32 block size
+    //   block:  u32 stored size (high bit set: stored uncompressed),
+    //           u32 raw size, u64 hashBytes of the raw bytes, stored bytes
+    //   end:    u32 0, u32 0, u64 total raw size
+    struct LzOptions
+    {
+        std::size_t blockSize = std::size_t(1) << 20;
+        // 0 for one thread per core
+        unsigned threads = 0;
+    };
+
+    // whether the file starts with the .pak.lz magic
+    bool isPakLz(const std::string &path);
+
+    void compressPak(std::istream &in, std::ostream &out, const LzOptions &options = LzOptions());
+    void decompressPak(std::istream &in, std::ostream &out, unsigned threads = 0);
+
+    // Decompresses a .pak.lz while it is read, a batch of blocks at a time
+    // and in parallel. Seeking only works forwards (and within the current
+    // batch), which is all PakFile::load needs.
+    class LzStreamBuffer : public std::streambuf
+    {
+    public:
+        explicit LzStreamBuffer(std::istream &source, unsigned threads = 0);
+    protected:
+        int_type underflow() override;
+        pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override;
+        pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+    private:
+        bool nextBatch();
+
+        std::istream &m_source;
+        unsigned m_threads;
+        std::size_t m_blockSize;
+        // raw offset of the start of m_batch
+        std::uint64_t m_position;
+        bool m_finished;
+        std::vector<char> m_batch;
+        std::vector<byte> m_stored;
+    };
+
+    class LzInputStream : public std::istream
+    {
+    public:
+        explicit LzInputStream(std::istream &source, unsigned threads = 0);
+    private:
+        LzStreamBuffer m_buffer;
+    };
+}
@@ -0,0 +1,415 @@
+#include "pakstats.h"
+#include "texture.h"
+#include "binaryio.h"
+#include "hash.h"
+#include "progress.h"
+#include "trace.h"
+#include <algorithm>
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+
+
+namespace scpak
+{
+    namespace
+    {
+        // bytes hashed at the start, middle and end of possible duplicates
+        const std::int64_t sampleWindow = 1024;
+        // chunks in which matching samples are confirmed by a full hash
+        const std::size_t hashChunk = 1 << 20;
+
+        void writeJsonString(std::ostream &out, const std::string &value)
+        {
+            static const char *hex = "0123456789abcdef";
+            out << '"';
+            for (char ch : value)
+            {
+                if (ch == '"' || ch == '\\')
+                    out << '\\' << ch;
+                else if (static_cast<unsigned char>(ch) < 0x20)
+                    out << "\\u00" << hex[(ch >> 4) & 15] << hex[ch & 15];
+                else
+                    out << ch;
+            }
+            out << '"';
+        }
+
+        std::vector<byte> readPrefix(const PakFile &pak, std::istream &stream, const PakItem &item, std::int64_t size)
+        {
+            std::vector<byte> data(static_cast<std::size_t>(std::min(size, item.length)));
+            pak.readRange(stream, item, 0, data.data(), data.size());
+            return data;
+        }
+
+        void readTexture(const PakFile &pak, std::istream &stream, const PakItem &item, ItemStats &result, PakStats &stats)
+        {
+            TextureHeader header = readTextureHeader(pak, stream, item);
+            std::int64_t levelZero = static_cast<std::int64_t>(header.width) * header.height * 4;
+            result.memoryBytes = item.length - TextureHeader::size;
+            std::ostringstream detail;
+            detail << header.width << 'x' << header.height << ", " << std::max(1, header.mipmapLevel)
+                << (header.mipmapLevel > 1 ? " levels" : " level");
+            result.detail = detail.str();
+            ++stats.textures;
+            stats.textureMemoryBytes += result.memoryBytes;
+            stats.mipmapBytes += std::max<std::int64_t>(0, result.memoryBytes - levelZero);
+        }
+
+        void readSound(const PakFile &pak, std::istream &stream, const PakItem &item, ItemStats &result, PakStats &stats)
+        {
+            std::vector<byte> data = readPrefix(pak, stream, item, 13);
+            MemoryBinaryReader reader(data.data(), data.size());
+            ++stats.sounds;
+            if (reader.readBoolean())
+            {
+                result.detail = "ogg";
+                ++stats.compressedSounds;
+                return;
+            }
+            int channels = reader.readInt32();
+            int rate = reader.readInt32();
+            int bytes = reader.readInt32();
+            if (channels <= 0 || rate <= 0 || bytes < 0)
+                throw std::runtime_error("invalid sound header");
+            double seconds = static_cast<double>(bytes) / (2.0 * channels * rate);
+            result.memoryBytes = bytes;
+            std::ostringstream detail;
+            detail << channels << " ch, " << rate << " Hz, " << std::fixed << std::setprecision(1) << seconds << " s";
+            result.detail = detail.str();
+            stats.pcmBytes += bytes;
+            stats.soundSeconds += seconds;
+        }
+
+        void readFont(const PakFile &pak, std::istream &stream, const PakItem &item, ItemStats &result, PakStats &stats)
+        {
+            std::vector<byte> count = readPrefix(pak, stream, item, 4);
+            MemoryBinaryReader countReader(count.data(), count.size());
+            int glyphCount = countReader.readInt32();
+            if (glyphCount < 0 || glyphCount > item.length / 29)
+                throw std::runtime_error("invalid glyph count");
+            // glyphs take 29 to 32 bytes, the metrics 17 to 20
+            std::vector<byte> data = readPrefix(pak, stream, item, 4 + 32 * static_cast<std::int64_t>(glyphCount) + 20 + TextureHeader::size);
+            MemoryBinaryReader reader(data.data(), data.size());
+            reader.position = 4;
+            for (int i = 0; i < glyphCount; ++i)
+            {
+                reader.readUtf8Char();
+                reader.position += 7 * 4;
+            }
+            reader.position += 4 * 4;
+            reader.readUtf8Char();
+            if (reader.position > data.size())
+                throw std::runtime_error("truncated font");
+            TextureHeader atlas = readTextureHeader(data.data() + reader.position, data.size() - reader.position);
+            result.memoryBytes = static_cast<std::int64_t>(atlas.width) * atlas.height * 4;
+            std::ostringstream detail;
+            detail << glyphCount << " glyphs, " << atlas.width << 'x' << atlas.height << " atlas";
+            result.detail = detail.str();
+            ++stats.fonts;
+            stats.glyphs += glyphCount;
+            stats.atlasBytes += result.memoryBytes;
+        }
+
+        std::uint64_t sampleHash(const PakFile &pak, std::istream &stream, const PakItem &item)
+        {
+            std::vector<byte> sample;
+            if (item.length <= 3 * sampleWindow)
+                sample = readPrefix(pak, stream, item, item.length);
+            else
+            {
+                sample.resize(static_cast<std::size_t>(3 * sampleWindow));
+                std::int64_t starts[] = { 0, (item.length - sampleWindow) / 2, item.length - sampleWindow };
+                for (int i = 0; i < 3; ++i)
+                    pak.readRange(stream, item, starts[i], sample.data() + i * sampleWindow, static_cast<std::size_t>(sampleWindow));
+            }
+            return hashBytes(sample.data(), sample.size());
+        }
+
+        std::uint64_t payloadHash(const PakFile &pak, std::istream &stream, const PakItem &item)
+        {
+            std::vector<byte> chunk(static_cast<std::size_t>(std::min<std::int64_t>(item.length, hashChunk)));
+            std::uint64_t hash = 0;
+            for (std::int64_t offset = 0; offset < item.length; offset += chunk.size())
+            {
+                std::size_t size = static_cast<std::size_t>(std::min<std::int64_t>(item.length - offset, chunk.size()));
+                pak.readRange(stream, item, offset, chunk.data(), size);
+                hash = hashBytes(chunk.data(), size, hash);
+            }
+            return hash;
+        }
+
+        template<typename Stats>
+        void sortBySize(std::vector<Stats> &list)
+        {
+            std::stable_sort(list.begin(), list.end(), [](const Stats &a, const Stats &b)
+            {
+                return a.bytes > b.bytes;
+            });
+        }
+    }
+
+    PakStats analyzePak(const PakFile &pak, std::istream &stream, const PakStatsOptions &options)
+    {
+        TraceScope scope("phase", "stats");
+        PakStats stats;
+        std::vector<const PakItem*> items;
+        for (const PakItem &item : pak.contents())
+            if (options.filter.matches(item.name, item.type))
+                items.push_back(&item);
+
+        std::map<PakString, std::size_t> typeIndexes;
+        std::map<std::string, std::size_t> directoryIndexes;
+        std::vector<ItemStats> all;
+        all.reserve(items.size());
+        for (const PakItem *item : items)
+        {
+            ItemStats result;
+            result.name = item->name.str();
+            result.type = item->type.str();
+            result.bytes = item->length;
+            result.memoryBytes = item->length;
+            // a bad header costs the item its details, not the report
+            try
+            {
+                switch (item->typeId)
+                {
+                case ItemType::Texture2D:
+                    readTexture(pak, stream, *item, result, stats);
+                    break;
+                case ItemType::SoundBuffer:
+                    readSound(pak, stream, *item, result, stats);
+                    break;
+                case ItemType::BitmapFont:
+                    readFont(pak, stream, *item, result, stats);
+                    break;
+                default:
+                    break;
+                }
+            }
+            catch (const std::exception &)
+            {
+                result.memoryBytes = item->length;
+                ++stats.unreadableHeaders;
+            }
+            catch (const BaseException &)
+            {
+                result.memoryBytes = item->length;
+                ++stats.unreadableHeaders;
+            }
+
+            ++stats.items;
+            stats.payloadBytes += item->length;
+            auto type = typeIndexes.emplace(item->type, stats.types.size());
+            if (type.second)
+            {
+                stats.types.emplace_back();
+                stats.types.back().type = item->type.str();
+            }
+            TypeStats &typeStats = stats.types[type.first->second];
+            ++typeStats.items;
+            typeStats.bytes += item->length;
+            typeStats.memoryBytes += result.memoryBytes;
+
+            const char *slash = std::strchr(item->name.c_str(), '/');
+            std::string directory = slash != nullptr ? std::string(item->name.c_str(), slash) : std::string();
+            auto dir = directoryIndexes.emplace(directory, stats.directories.size());
+            if (dir.second)
+            {
+                stats.directories.emplace_back();
+                stats.directories.back().directory = directory;
+            }
+            ++stats.directories[dir.first->second].items;
+            stats.directories[dir.first->second].bytes += item->length;
+            all.push_back(std::move(result));
+        }
+        sortBySize(stats.types);
+        sortBySize(stats.directories);
+        std::size_t top = std::min(options.topCount, all.size());
+        std::partial_sort(all.begin(), all.begin() + top, all.end(), [](const ItemStats &a, const ItemStats &b)
+        {
+            return a.bytes > b.bytes;
+        });
+        stats.largest.assign(all.begin(), all.begin() + top);
+
+        // only items sharing type and size are sampled
+        std::map<std::pair<PakString, std::int64_t>, std::vector<const PakItem*>> sameSize;
+        for (const PakItem *item : items)
+            if (item->length > 0)
+                sameSize[std::make_pair(item->type, item->length)].push_back(item);
+        for (const auto &candidates : sameSize)
+        {
+            if (candidates.second.size() < 2)
+                continue;
+            std::map<std::uint64_t, std::vector<const PakItem*>> sameSample;
+            for (const PakItem *item : candidates.second)
+                sameSample[sampleHash(pak, stream, *item)].push_back(item);
+            // samples cover small payloads in full; larger ones may agree
+            // only there, like sounds starting and ending in silence, and
+            // are read in full if asked to
+            std::vector<std::vector<const PakItem*>> sameContent;
+            for (const auto &group : sameSample)
+            {
+                if (group.second.size() < 2)
+                    continue;
+                if (!options.verifyDuplicates || candidates.first.second <= 3 * sampleWindow)
+                {
+                    sameContent.push_back(group.second);
+                    continue;
+                }
+                std::map<std::uint64_t, std::vector<const PakItem*>> sameHash;
+                std::map<std::int64_t, std::uint64_t> hashes; // by offset, shared payloads are read once
+                for (const PakItem *item : group.second)
+                {
+                    auto known = item->offset >= 0 ? hashes.find(item->offset) : hashes.end();
+                    std::uint64_t hash = known != hashes.end() ? known->second : payloadHash(pak, stream, *item);
+                    if (item->offset >= 0)
+                        hashes[item->offset] = hash;
+                    sameHash[hash].push_back(item);
+                }
+                for (const auto &same : sameHash)
+                    sameContent.push_back(same.second);
+            }
+            for (const auto &group : sameContent)
+            {
+                if (group.size() < 2)
+                    continue;
+                DuplicateGroup duplicate;
+                duplicate.type = candidates.first.first.str();
+                duplicate.bytes = candidates.first.second;
+                // items pointing at the same payload already share it
+                std::vector<std::int64_t> offsets;
+                std::size_t copies = 0;
+                for (const PakItem *item : group)
+                {
+                    duplicate.names.push_back(item->name.str());
+                    if (item->offset < 0 || std::find(offsets.begin(), offsets.end(), item->offset) == offsets.end())
+                        ++copies;
+                    offsets.push_back(item->offset);
+                }
+                stats.duplicateBytes += static_cast<std::int64_t>(copies - 1) * duplicate.bytes;
+                stats.duplicates.push_back(std::move(duplicate));
+            }
+        }
+        stats.duplicatesVerified = options.verifyDuplicates;
+        std::stable_sort(stats.duplicates.begin(), stats.duplicates.end(), [](const DuplicateGroup &a, const DuplicateGroup &b)
+        {
+            return a.bytes * static_cast<std::int64_t>(a.names.size()) > b.bytes * static_cast<std::int64_t>(b.names.size());
+        });
+        return stats;
+    }
+
+    void writeStatsTable(std::ostream &out, const PakStats &stats)
+    {
+        std::ios::fmtflags flags = out.flags();
+        out << stats.items << " items, " << formatBytes(static_cast<double>(stats.payloadBytes)) << " of payloads" << std::endl;
+        out << std::endl << std::left << std::setw(40) << "type" << std::right << std::setw(8) << "items"
+            << std::setw(12) << "size" << std::setw(12) << "memory" << std::endl;
+        for (const TypeStats &type : stats.types)
+            out << std::left << std::setw(40) << type.type << std::right << std::setw(8) << type.items
+                << std::setw(12) << formatBytes(static_cast<double>(type.bytes))
+                << std::setw(12) << formatBytes(static_cast<double>(type.memoryBytes)) << std::endl;
+        out << std::endl << std::left << std::setw(40) << "directory" << std::right << std::setw(8) << "items"
+            << std::setw(12) << "size" << std::endl;
+        for (const DirectoryStats &directory : stats.directories)
+            out << std::left << std::setw(40) << (directory.directory.empty() ? "." : directory.directory)
+                << std::right << std::setw(8) << directory.items
+                << std::setw(12) << formatBytes(static_cast<double>(directory.bytes)) << std::endl;
+        out << std::endl << "largest items:" << std::endl;
+        for (const ItemStats &item : stats.largest)
+        {
+            out << std::right << std::setw(12) << formatBytes(static_cast<double>(item.bytes)) << "  " << item.name;
+            if (!item.detail.empty())
+                out << " (" << item.detail << ")";
+            out << std::endl;
+        }
+        out << std::endl;
+        out << "textures: " << stats.textures << ", " << formatBytes(static_cast<double>(stats.textureMemoryBytes))
+            << " of GPU memory as RGBA8, " << formatBytes(static_cast<double>(stats.mipmapBytes)) << " of it mip levels" << std::endl;
+        out << "fonts: " << stats.fonts << ", " << stats.glyphs << " glyphs, "
+            << formatBytes(static_cast<double>(stats.atlasBytes)) << " of atlas GPU memory" << std::endl;
+        out << "sounds: " << stats.sounds << ", " << formatBytes(static_cast<double>(stats.pcmBytes)) << " of PCM, "
+            << std::fixed << std::setprecision(1) << stats.soundSeconds << " s";
+        out.flags(flags);
+        if (stats.compressedSounds != 0)
+            out << ", " << stats.compressedSounds << " ogg compressed";
+        out << std::endl;
+        out << (stats.duplicatesVerified ? "duplicates: " : "probable duplicates: ") << stats.duplicates.size() << " groups, "
+            << formatBytes(static_cast<double>(stats.duplicateBytes)) << " stored more than once";
+        if (!stats.duplicatesVerified && !stats.duplicates.empty())
+            out << " (same samples, --verify-duplicates compares them in full)";
+        out << std::endl;
+        for (const DuplicateGroup &group : stats.duplicates)
+        {
+            out << std::right << std::setw(12) << formatBytes(static_cast<double>(group.bytes)) << " ";
+            for (std::size_t i = 0; i < group.names.size(); ++i)
+                out << (i == 0 ? " " : ", ") << group.names[i];
+            out << std::endl;
+        }
+        if (stats.unreadableHeaders != 0)
+            out << stats.unreadableHeaders << " items with unreadable headers are counted by size only" << std::endl;
+        out.flags(flags);
+    }
+
+    void writeStatsJson(std::ostream &out, const PakStats &stats)
+    {
+        out << "{\n  \"items\": " << stats.items << ", \"payload_bytes\": " << stats.payloadBytes << ",\n";
+        out << "  \"types\": [";
+        for (std::size_t i = 0; i < stats.types.size(); ++i)
+        {
+            const TypeStats &type = stats.types[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"type\": ";
+            writeJsonString(out, type.type);
+            out << ", \"items\": " << type.items << ", \"bytes\": " << type.bytes
+                << ", \"memory_bytes\": " << type.memoryBytes << "}";
+        }
+        out << "\n  ],\n  \"directories\": [";
+        for (std::size_t i = 0; i < stats.directories.size(); ++i)
+        {
+            const DirectoryStats &directory = stats.directories[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"directory\": ";
+            writeJsonString(out, directory.directory);
+            out << ", \"items\": " << directory.items << ", \"bytes\": " << directory.bytes << "}";
+        }
+        out << "\n  ],\n  \"largest\": [";
+        for (std::size_t i = 0; i < stats.largest.size(); ++i)
+        {
+            const ItemStats &item = stats.largest[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+            writeJsonString(out, item.name);
+            out << ", \"type\": ";
+            writeJsonString(out, item.type);
+            out << ", \"bytes\": " << item.bytes << ", \"memory_bytes\": " << item.memoryBytes << ", \"detail\": ";
+            writeJsonString(out, item.detail);
+            out << "}";
+        }
+        out << "\n  ],\n";
+        out << "  \"textures\": {\"count\": " << stats.textures << ", \"memory_bytes\": " << stats.textureMemoryBytes
+            << ", \"mipmap_bytes\": " << stats.mipmapBytes << "},\n";
+        out << "  \"fonts\": {\"count\": " << stats.fonts << ", \"glyphs\": " << stats.glyphs
+            << ", \"atlas_bytes\": " << stats.atlasBytes << "},\n";
+        out << "  \"sounds\": {\"count\": " << stats.sounds << ", \"compressed\": " << stats.compressedSounds
+            << ", \"pcm_bytes\": " << stats.pcmBytes << ", \"seconds\": " << stats.soundSeconds << "},\n";
+        out << "  \"duplicates\": {\"verified\": " << (stats.duplicatesVerified ? "true" : "false")
+            << ", \"bytes\": " << stats.duplicateBytes << ", \"groups\": [";
+        for (std::size_t i = 0; i < stats.duplicates.size(); ++i)
+        {
+            const DuplicateGroup &group = stats.duplicates[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"type\": ";
+            writeJsonString(out, group.type);
+            out << ", \"bytes\": " << group.bytes << ", \"names\": [";
+            for (std::size_t j = 0; j < group.names.size(); ++j)
+            {
+                if (j != 0)
+                    out << ", ";
+                writeJsonString(out, group.names[j]);
+            }
+            out << "]}";
+        }
+        out << (stats.duplicates.empty() ? "]},\n" : "\n  ]},\n");
+        out << "  \"unreadable_headers\": " << stats.unreadableHeaders << "\n}" << std::endl;
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+#include "pakfile.h"
+#include "itemfilter.h"
+
+namespace scpak
+{
+    struct PakStatsOptions
+    {
+        // how many of the largest items to list
+        std::size_t topCount = 10;
+        ItemFilter filter;
+        // read the payloads whose samples match in full and hash them, so
+        // only true duplicates are reported
+        bool verifyDuplicates = false;
+    };
+
+    struct TypeStats
+    {
+        std::string type;
+        std::size_t items = 0;
+        std::int64_t bytes = 0;
+        // estimated size once loaded by the game, see ItemStats::memoryBytes
+        std::int64_t memoryBytes = 0;
+    };
+
+    struct DirectoryStats
+    {
+        std::string directory; // first component of the item names
+        std::size_t items = 0;
+        std::int64_t bytes = 0;
+    };
+
+    struct ItemStats
+    {
+        std::string name;
+        std::string type;
+        std::int64_t bytes = 0;
+        // RGBA8 pixels of textures and font atlases, PCM samples of
+        // uncompressed sounds, the payload size for everything else
+        std::int64_t memoryBytes = 0;
+        // what the header says, e.g. "512x512, 10 levels"
+        std::string detail;
+    };
+
+    struct DuplicateGroup
+    {
+        std::string type;
+        std::int64_t bytes = 0; // of each payload
+        std::vector<std::string> names;
+    };
+
+    struct PakStats
+    {
+        std::size_t items = 0;
+        std::int64_t payloadBytes = 0;
+        std::vector<TypeStats> types; // largest first
+        std::vector<DirectoryStats> directories; // largest first
+        std::vector<ItemStats> largest;
+
+        std::size_t textures = 0;
+        std::int64_t textureMemoryBytes = 0;
+        // pixels of all levels but the first
+        std::int64_t mipmapBytes = 0;
+
+        std::size_t sounds = 0;
+        std::size_t compressedSounds = 0; // ogg, their decoded size is unknown
+        std::int64_t pcmBytes = 0;
+        double soundSeconds = 0;
+
+        std::size_t fonts = 0;
+        std::size_t glyphs = 0;
+        std::int64_t atlasBytes = 0;
+
+        // same type, size and samples (content if duplicatesVerified),
+        // payloads probably stored more than once
+        std::vector<DuplicateGroup> duplicates;
+        bool duplicatesVerified = false;
+        // what storing every duplicate once would save
+        std::int64_t duplicateBytes = 0;
+
+        // items whose header could not be read, counted by size only
+        std::size_t unreadableHeaders = 0;
+    };
+
+    // Sizes and estimated runtime memory of the items options.filter
+    // selects. Only the directory and the few header bytes of textures,
+    // sounds and fonts (their glyph table) are needed, read through
+    // PakFile::readRange, so pak may come from loadDirectory(). Duplicates
+    // are found by comparing 3 KiB samples of the payloads of items with
+    // the same type and size, so they are probable unless
+    // options.verifyDuplicates has the matching payloads read in full.
+    PakStats analyzePak(const PakFile &pak, std::istream &stream, const PakStatsOptions &options = PakStatsOptions());
+
+    void writeStatsTable(std::ostream &out, const PakStats &stats);
+    void writeStatsJson(std::ostream &out, const PakStats &stats);
+}
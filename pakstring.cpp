@@ -0,0 +1,59 @@
+#include "pakstring.h"
+#include "hash.h"
+
+#include <algorithm>
+
+
+namespace scpak
+{
+    PakString::PakString() :
+        m_data(""), m_size(0)
+    { }
+
+    PakString::PakString(const std::string &value)
+    {
+        copy(value.c_str(), value.length());
+    }
+
+    PakString::PakString(const char *value)
+    {
+        copy(value, std::strlen(value));
+    }
+
+    PakString::PakString(const char *data, std::size_t size, std::shared_ptr<const void> owner) :
+        m_data(data), m_size(size), m_owner(std::move(owner))
+    { }
+
+    PakString PakString::borrow(const char *data, std::size_t size)
+    {
+        return PakString(data, size, nullptr);
+    }
+
+    PakString PakString::borrow(const std::string &value)
+    {
+        return PakString(value.c_str(), value.length(), nullptr);
+    }
+
+    void PakString::copy(const char *data, std::size_t size)
+    {
+        std::shared_ptr<char> buffer(new char[size + 1], std::default_delete<char[]>());
+        std::memcpy(buffer.get(), data, size);
+        buffer.get()[size] = '\0';
+        m_data = buffer.get();
+        m_size = size;
+        m_owner = std::move(buffer);
+    }
+
+    int PakString::compare(const char *data, std::size_t size) const
+    {
+        int result = std::memcmp(m_data, data, std::min(m_size, size));
+        if (result != 0)
+            return result;
+        return m_size < size ? -1 : m_size > size ? 1 : 0;
+    }
+}
+
+std::size_t std::hash<scpak::PakString>::operator()(const scpak::PakString &value) const
+{
+    return static_cast<std::size_t>(scpak::hashBytes(value.data(), value.size()));
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <ostream>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+
+
+namespace scpak
+{
+    // Immutable, NUL-terminated text for item names and types. Strings a pak
+    // directory holds point into one shared block of the directory, type
+    // names into the static interned names, so loading a pak costs no
+    // allocation per item; copies only share the owner.
+    class PakString
+    {
+    public:
+        PakString();
+        // own a copy of value
+        PakString(const std::string &value);
+        PakString(const char *value);
+        // size bytes at data followed by a NUL, kept valid by owner
+        PakString(const char *data, std::size_t size, std::shared_ptr<const void> owner);
+
+        // refers to data without copying or owning it, e.g. a static name
+        // or a key only used while data is alive
+        static PakString borrow(const char *data, std::size_t size);
+        static PakString borrow(const std::string &value);
+
+        const char *c_str() const { return m_data; }
+        const char *data() const { return m_data; }
+        std::size_t size() const { return m_size; }
+        std::size_t length() const { return m_size; }
+        bool empty() const { return m_size == 0; }
+        std::string str() const { return std::string(m_data, m_size); }
+
+        int compare(const char *data, std::size_t size) const;
+        int compare(const PakString &other) const { return compare(other.m_data, other.m_size); }
+    private:
+        void copy(const char *data, std::size_t size);
+
+        const char *m_data;
+        std::size_t m_size;
+        std::shared_ptr<const void> m_owner;
+    };
+
+    inline bool operator==(const PakString &a, const PakString &b)
+    {
+        return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+    }
+    inline bool operator==(const PakString &a, const std::string &b)
+    {
+        return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size()) == 0;
+    }
+    inline bool operator==(const std::string &a, const PakString &b) { return b == a; }
+    inline bool operator==(const PakString &a, const char *b) { return a.compare(b, std::strlen(b)) == 0; }
+    inline bool operator==(const char *a, const PakString &b) { return b == a; }
+    inline bool operator!=(const PakString &a, const PakString &b) { return !(a == b); }
+    inline bool operator!=(const PakString &a, const std::string &b) { return !(a == b); }
+    inline bool operator!=(const std::string &a, const PakString &b) { return !(b == a); }
+    inline bool operator!=(const PakString &a, const char *b) { return !(a == b); }
+    inline bool operator!=(const char *a, const PakString &b) { return !(b == a); }
+    inline bool operator<(const PakString &a, const PakString &b) { return a.compare(b) < 0; }
+
+    inline std::string operator+(const std::string &a, const PakString &b) { return std::string(a).append(b.data(), b.size()); }
+    inline std::string operator+(std::string &&a, const PakString &b) { return std::move(a.append(b.data(), b.size())); }
+    inline std::string operator+(const char *a, const PakString &b) { return std::string(a).append(b.data(), b.size()); }
+    inline std::string operator+(const PakString &a, const std::string &b) { return a.str().append(b); }
+    inline std::string operator+(const PakString &a, const char *b) { return a.str().append(b); }
+    inline std::string operator+(const PakString &a, char b) { return a.str().append(1, b); }
+
+    inline std::ostream& operator<<(std::ostream &out, const PakString &value)
+    {
+        return out << value.c_str();
+    }
+}
+
+namespace std
+{
+    template<>
+    struct hash<scpak::PakString>
+    {
+        std::size_t operator()(const scpak::PakString &value) const;
+    };
+}
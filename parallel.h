@@ -0,0 +1,55 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace scpak
+{
+    // threads, or one per core for 0
+    inline unsigned threadCount(unsigned threads)
+    {
+        if (threads == 0)
+            threads = std::thread::hardware_concurrency();
+        return std::max(1u, threads);
+    }
+
+    // runs function(i) for every i below count on up to threads threads,
+    // the calling one included; rethrows the first exception
+    template <typename Function>
+    void parallelFor(std::size_t count, unsigned threads, Function function)
+    {
+        std::atomic<std::size_t> next(0);
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto run = [&]()
+        {
+            std::size_t i;
+            while ((i = next++) < count)
+            {
+                try
+                {
+                    function(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error)
+                        error = std::current_exception();
+                    next = count;
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (std::size_t i = 1; i < std::min<std::size_t>(threads, count); ++i)
+            workers.emplace_back(run);
+        run();
+        for (std::thread &worker : workers)
+            worker.join();
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,206 @@
+#include "progress.h"
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+
+namespace scpak
+{
+    namespace
+    {
+        long long now()
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        double seconds(long long microseconds)
+        {
+            return microseconds / 1e6;
+        }
+
+        ProgressTypeStats &statsFor(std::vector<ProgressTypeStats> &types, const std::string &type)
+        {
+            for (ProgressTypeStats &stats : types)
+                if (stats.type == type)
+                    return stats;
+            types.emplace_back();
+            types.back().type = type;
+            return types.back();
+        }
+    }
+
+    std::atomic<ProgressObserver*> Progress::s_observer(nullptr);
+
+    void Progress::setObserver(ProgressObserver *observer)
+    {
+        s_observer = observer;
+    }
+
+    ProgressOperation::ProgressOperation(const char *operation, std::size_t itemCount, std::int64_t totalBytes) :
+        m_observer(Progress::observer()), m_operation(operation)
+    {
+        if (m_observer != nullptr)
+            m_observer->operationStarted(operation, itemCount, totalBytes);
+    }
+
+    ProgressOperation::~ProgressOperation()
+    {
+        if (m_observer != nullptr)
+            m_observer->operationFinished(m_operation);
+    }
+
+    ProgressItem::ProgressItem(const char *operation, const PakString &name, const PakString &type, std::int64_t bytes) :
+        m_observer(Progress::observer()), m_operation(operation), m_bytes(bytes)
+    {
+        if (m_observer != nullptr)
+        {
+            m_name = name.str();
+            m_type = type.str();
+            m_observer->itemStarted(operation, m_name, m_type);
+        }
+    }
+
+    ProgressItem::~ProgressItem()
+    {
+        if (m_observer != nullptr)
+            m_observer->itemFinished(m_operation, m_name, m_type, m_bytes);
+    }
+
+    void ProgressTracker::operationStarted(const char *operation, std::size_t itemCount, std::int64_t totalBytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_current = ProgressSnapshot();
+            m_current.operation = operation;
+            m_current.itemCount = itemCount;
+            m_current.totalBytes = totalBytes;
+            m_begin = now();
+            m_running.clear();
+        }
+        changed();
+    }
+
+    void ProgressTracker::itemStarted(const char *, const std::string &name, const std::string &)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running.push_back(RunningItem{ name, now() });
+        }
+        changed();
+    }
+
+    void ProgressTracker::itemFinished(const char *, const std::string &name, const std::string &type, std::int64_t bytes)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            long long end = now();
+            long long begin = end;
+            auto it = std::find_if(m_running.begin(), m_running.end(), [&](const RunningItem &item)
+            {
+                return item.name == name;
+            });
+            if (it != m_running.end())
+            {
+                begin = it->begin;
+                m_running.erase(it);
+            }
+            ++m_current.itemsDone;
+            m_current.bytesDone += bytes;
+            ProgressTypeStats &stats = statsFor(m_current.types, type);
+            ++stats.items;
+            stats.bytes += bytes;
+            stats.seconds += seconds(end - begin);
+        }
+        changed();
+    }
+
+    void ProgressTracker::operationFinished(const char *)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ProgressSnapshot snapshot = snapshotLocked();
+            snapshot.finished = true;
+            snapshot.eta = 0;
+            snapshot.current.clear();
+            m_finished.push_back(snapshot);
+            m_current = snapshot;
+            m_running.clear();
+        }
+        changed();
+    }
+
+    ProgressSnapshot ProgressTracker::snapshot() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return snapshotLocked();
+    }
+
+    ProgressSnapshot ProgressTracker::snapshotLocked() const
+    {
+        ProgressSnapshot snapshot = m_current;
+        if (snapshot.finished)
+            return snapshot;
+        long long current = now();
+        snapshot.elapsed = seconds(current - m_begin);
+        if (snapshot.totalBytes > 0 && snapshot.bytesDone > 0)
+            snapshot.eta = snapshot.elapsed * std::max<std::int64_t>(0, snapshot.totalBytes - snapshot.bytesDone) / snapshot.bytesDone;
+        else if (snapshot.itemCount > snapshot.itemsDone && snapshot.itemsDone > 0)
+            snapshot.eta = snapshot.elapsed * (snapshot.itemCount - snapshot.itemsDone) / snapshot.itemsDone;
+        // items are appended as they start, the first one has run longest
+        if (!m_running.empty())
+            snapshot.current = m_running.front().name;
+        return snapshot;
+    }
+
+    std::vector<ProgressSnapshot> ProgressTracker::finished() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_finished;
+    }
+
+    void ProgressTracker::report(std::ostream &out) const
+    {
+        std::ios::fmtflags flags = out.flags();
+        std::streamsize precision = out.precision();
+        for (const ProgressSnapshot &snapshot : finished())
+        {
+            out << snapshot.operation << ": " << snapshot.itemsDone << " items, " << formatBytes(snapshot.bytesDone)
+                << " in " << std::fixed << std::setprecision(2) << snapshot.elapsed << " s";
+            if (snapshot.elapsed > 0)
+                out << " (" << formatBytes(snapshot.bytesDone / snapshot.elapsed) << "/s)";
+            out << std::endl;
+            std::vector<ProgressTypeStats> types = snapshot.types;
+            std::sort(types.begin(), types.end(), [](const ProgressTypeStats &a, const ProgressTypeStats &b)
+            {
+                return a.seconds > b.seconds;
+            });
+            for (const ProgressTypeStats &stats : types)
+            {
+                out << "  " << stats.type << ": " << stats.items << " items, " << formatBytes(stats.bytes)
+                    << ", " << std::setprecision(3) << stats.seconds << " s";
+                // items reported after a bulk read take no measurable time
+                if (stats.seconds >= 0.001)
+                    out << " (" << formatBytes(stats.bytes / stats.seconds) << "/s)";
+                out << std::endl;
+            }
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+    std::string formatBytes(double bytes)
+    {
+        static const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+        int unit = 0;
+        while (bytes >= 1024 && unit < 4)
+        {
+            bytes /= 1024;
+            ++unit;
+        }
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes << ' ' << units[unit];
+        return out.str();
+    }
+}
@@ -0,0 +1,145 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+#include "pakstring.h"
+
+namespace scpak
+{
+    // Receives item level progress of PakFile::load and save, pack, unpack,
+    // roundTrip and mergePaks. Items of one operation may be reported from
+    // several threads at once, so implementations must be thread-safe.
+    class ProgressObserver
+    {
+    public:
+        virtual ~ProgressObserver() { }
+
+        // operation is "load", "save", "pack", "unpack", "round trip" or "merge";
+        // totalBytes is 0 where it is not known up front, e.g. for pack
+        virtual void operationStarted(const char *operation, std::size_t itemCount, std::int64_t totalBytes) = 0;
+        virtual void itemStarted(const char *operation, const std::string &name, const std::string &type) = 0;
+        // also called for items that failed; bytes is the payload size
+        virtual void itemFinished(const char *operation, const std::string &name, const std::string &type,
+            std::int64_t bytes) = 0;
+        virtual void operationFinished(const char *operation) = 0;
+    };
+
+    // The observer every operation reports to.
+    // While none is attached a report costs a single relaxed atomic load.
+    class Progress
+    {
+    public:
+        static ProgressObserver *observer()
+        {
+            return s_observer.load(std::memory_order_relaxed);
+        }
+
+        // observer must outlive the operations it sees, nullptr detaches
+        static void setObserver(ProgressObserver *observer);
+    private:
+        static std::atomic<ProgressObserver*> s_observer;
+    };
+
+    // reports an operation from construction to destruction
+    class ProgressOperation
+    {
+    public:
+        ProgressOperation(const char *operation, std::size_t itemCount, std::int64_t totalBytes);
+        ~ProgressOperation();
+
+        ProgressOperation(const ProgressOperation &) = delete;
+        ProgressOperation &operator=(const ProgressOperation &) = delete;
+    private:
+        ProgressObserver *m_observer;
+        const char *m_operation;
+    };
+
+    // reports an item from construction to destruction; name and type are
+    // only copied while an observer is attached
+    class ProgressItem
+    {
+    public:
+        ProgressItem(const char *operation, const PakString &name, const PakString &type, std::int64_t bytes = 0);
+        ~ProgressItem();
+
+        ProgressItem(const ProgressItem &) = delete;
+        ProgressItem &operator=(const ProgressItem &) = delete;
+
+        // for items whose size is only known once they are done
+        void setBytes(std::int64_t bytes) { m_bytes = bytes; }
+    private:
+        ProgressObserver *m_observer;
+        const char *m_operation;
+        std::string m_name;
+        std::string m_type;
+        std::int64_t m_bytes;
+    };
+
+    struct ProgressTypeStats
+    {
+        std::string type;
+        std::size_t items = 0;
+        std::int64_t bytes = 0;
+        // summed over items, so threads working side by side count twice
+        double seconds = 0;
+    };
+
+    struct ProgressSnapshot
+    {
+        std::string operation;
+        std::size_t itemCount = 0;
+        std::size_t itemsDone = 0;
+        std::int64_t totalBytes = 0;
+        std::int64_t bytesDone = 0;
+        double elapsed = 0;
+        // seconds left, estimated from bytes or else from items, -1 if unknown
+        double eta = -1;
+        // the item running the longest, empty if none is
+        std::string current;
+        std::vector<ProgressTypeStats> types;
+        bool finished = false;
+    };
+
+    // Observer that keeps counters, per-type throughput and an ETA for the
+    // running operation and the totals of finished ones.
+    class ProgressTracker : public ProgressObserver
+    {
+    public:
+        void operationStarted(const char *operation, std::size_t itemCount, std::int64_t totalBytes) override;
+        void itemStarted(const char *operation, const std::string &name, const std::string &type) override;
+        void itemFinished(const char *operation, const std::string &name, const std::string &type,
+            std::int64_t bytes) override;
+        void operationFinished(const char *operation) override;
+
+        // the running operation, or the last one once all are done
+        ProgressSnapshot snapshot() const;
+        std::vector<ProgressSnapshot> finished() const;
+        // items, bytes and throughput of every finished operation and type
+        void report(std::ostream &out) const;
+    protected:
+        // called after every change, outside the lock
+        virtual void changed() { }
+    private:
+        struct RunningItem
+        {
+            std::string name;
+            long long begin;
+        };
+
+        ProgressSnapshot snapshotLocked() const;
+
+        mutable std::mutex m_mutex;
+        ProgressSnapshot m_current;
+        long long m_begin = 0;
+        std::vector<RunningItem> m_running;
+        std::vector<ProgressSnapshot> m_finished;
+    };
+
+    // "1.5 MiB" and similar
+    std::string formatBytes(double bytes);
+}
@@ -0,0 +1,204 @@
+#include "roundtrip.h"
+#include "filewriter.h"
+#include "texture.h"
+#include "binaryio.h"
+#include "parallel.h"
+#include "trace.h"
+#include "progress.h"
+#include <sstream>
+#include <algorithm>
+
+
+namespace scpak
+{
+    namespace
+    {
+        std::string describeTexture(const byte *data, std::size_t size, long long offset, const char *what)
+        {
+            if (offset < TextureHeader::size)
+                return std::string(what) + " header";
+            TextureHeader header = readTextureHeader(data, size);
+            long long pixels = offset - TextureHeader::size;
+            for (int level = 0; level < std::max(1, header.mipmapLevel); ++level)
+            {
+                MipmapLevelRange range = mipmapLevelRange(header.width, header.height, level);
+                if (pixels >= range.offset + range.byteCount())
+                    continue;
+                long long pixel = (pixels - range.offset) / 4;
+                std::ostringstream out;
+                if (header.mipmapLevel > 1)
+                    out << "mip level " << level << ", ";
+                out << what << " pixel (" << pixel % range.width << ", " << pixel / range.width << ")";
+                return out.str();
+            }
+            return std::string("past the ") + what;
+        }
+
+        std::string describeBitmapFont(const byte *data, std::size_t size, long long offset)
+        {
+            static const char *glyphFields[] = {
+                "texCoord1.x", "texCoord1.y", "texCoord2.x", "texCoord2.y", "offset.x", "offset.y", "width"
+            };
+            static const char *fontFields[] = { "glyphHeight", "spacing.x", "spacing.y", "scale" };
+            MemoryBinaryReader reader(data, size);
+            if (offset < 4)
+                return "glyph count";
+            int glyphCount = reader.readInt32();
+            for (int i = 0; i < glyphCount; ++i)
+            {
+                reader.readUtf8Char();
+                long long fields = reader.position;
+                reader.position += 7 * 4;
+                if (offset >= reader.position)
+                    continue;
+                std::ostringstream out;
+                out << "glyph " << i << ", ";
+                if (offset < fields)
+                    out << "unicode";
+                else
+                    out << glyphFields[(offset - fields) / 4];
+                return out.str();
+            }
+            long long metrics = reader.position;
+            if (offset < metrics + 4 * 4)
+                return fontFields[(offset - metrics) / 4];
+            reader.position += 4 * 4;
+            reader.readUtf8Char();
+            if (offset < reader.position)
+                return "fallbackCode";
+            return describeTexture(data + reader.position, size - reader.position, offset - reader.position, "atlas");
+        }
+
+        std::string describeSoundBuffer(const byte *data, std::size_t size, long long offset)
+        {
+            if (offset < 13)
+                return "sound header";
+            MemoryBinaryReader reader(data, size);
+            if (reader.readBoolean())
+                return "ogg data";
+            int channels = std::max(1, reader.readInt32());
+            long long sample = (offset - 13) / 2;
+            std::ostringstream out;
+            out << "frame " << sample / channels << ", channel " << sample % channels;
+            return out.str();
+        }
+
+        std::string describeText(const byte *data, std::size_t size, long long offset)
+        {
+            MemoryBinaryReader reader(data, size);
+            reader.read7BitEncodedInt();
+            if (offset < reader.position)
+                return "length prefix";
+            std::ostringstream out;
+            out << "text byte " << offset - reader.position;
+            return out.str();
+        }
+
+        void roundTripItem(const PakItem &item, const UnpackOptions &unpackOptions, const PackOptions &packOptions,
+            RoundTripResult &result)
+        {
+            TraceScope itemScope("item", item.name.c_str(), item.type.c_str());
+            ItemMemoryScope memoryScope(item.name.c_str());
+            MemoryFileSource files;
+            MemoryFileWriter writer(files);
+            std::string meta;
+            {
+                TraceScope unpackerScope("unpacker", item.type.c_str());
+                meta = unpackItem(std::string(), item, unpackOptions, writer);
+            }
+            PakItem packed;
+            packed.name = item.name;
+            packed.type = item.type;
+            packed.typeId = item.typeId;
+            {
+                TraceScope packerScope("packer", item.type.c_str());
+                packItem(std::string(), packed, meta, packOptions, files);
+            }
+
+            result.length = packed.length;
+            const byte *original = item.payload();
+            const byte *repacked = packed.payload();
+            std::size_t common = static_cast<std::size_t>(std::min(item.length, packed.length));
+            std::size_t i = std::mismatch(original, original + common, repacked).first - original;
+            result.exact = i == common && item.length == packed.length;
+            if (!result.exact)
+            {
+                result.firstDifference = static_cast<long long>(i);
+                result.where = describePayloadOffset(item, result.firstDifference);
+            }
+        }
+    }
+
+    std::string describePayloadOffset(const PakItem &item, long long offset)
+    {
+        const byte *data = item.payload();
+        std::size_t size = static_cast<std::size_t>(item.length);
+        if (offset >= item.length)
+            return "end of payload";
+        try
+        {
+            switch (item.typeId)
+            {
+            case ItemType::String:
+            case ItemType::XElement:
+                return describeText(data, size, offset);
+            case ItemType::Texture2D:
+                return describeTexture(data, size, offset, "image");
+            case ItemType::BitmapFont:
+                return describeBitmapFont(data, size, offset);
+            case ItemType::SoundBuffer:
+                return describeSoundBuffer(data, size, offset);
+            default:
+                break;
+            }
+        }
+        catch (const std::exception &)
+        {
+        }
+        catch (const BaseException &)
+        {
+        }
+        std::ostringstream out;
+        out << "byte " << offset;
+        return out.str();
+    }
+
+    std::vector<RoundTripResult> roundTrip(const PakFile &pak, const UnpackOptions &unpackOptions,
+        const PackOptions &packOptions, unsigned threads)
+    {
+        TraceScope scope("phase", "round trip");
+        std::vector<const PakItem*> items;
+        for (const PakItem &item : pak.contents())
+            if (unpackOptions.filter.matches(item.name, item.type))
+                items.push_back(&item);
+
+        std::int64_t totalBytes = 0;
+        for (const PakItem *item : items)
+            totalBytes += item->length;
+        ProgressOperation progress("round trip", items.size(), totalBytes);
+        std::vector<RoundTripResult> results(items.size());
+        parallelFor(items.size(), threadCount(threads), [&](std::size_t i)
+        {
+            const PakItem &item = *items[i];
+            ProgressItem itemProgress("round trip", item.name, item.type, item.length);
+            RoundTripResult &result = results[i];
+            result.name = item.name.str();
+            result.type = item.type.str();
+            result.originalLength = item.length;
+            // a broken item is reported, it does not stop the others
+            try
+            {
+                roundTripItem(item, unpackOptions, packOptions, result);
+            }
+            catch (const std::exception &e)
+            {
+                result.error = e.what();
+            }
+            catch (const BaseException &e)
+            {
+                result.error = e.what();
+            }
+        });
+        return results;
+    }
+}
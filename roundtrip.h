@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "pakfile.h"
+#include "pack.h"
+#include "unpack.h"
+
+namespace scpak
+{
+    struct RoundTripResult
+    {
+        std::string name;
+        std::string type;
+        bool exact = false;
+        // why unpacking or packing again failed, empty otherwise
+        std::string error;
+        std::int64_t originalLength = 0;
+        std::int64_t length = 0;
+        // first byte that differs (or the end of the shorter payload), -1 if exact
+        long long firstDifference = -1;
+        // what the original payload holds there, e.g. "mip level 2, pixel (3, 1)"
+        std::string where;
+    };
+
+    // Unpacks every item unpackOptions.filter selects into memory, packs it
+    // again and compares the result with the original payload. Nothing is
+    // written to disk. Items are spread over threads (0 for one per core),
+    // results come in pak order.
+    std::vector<RoundTripResult> roundTrip(const PakFile &pak, const UnpackOptions &unpackOptions,
+        const PackOptions &packOptions, unsigned threads = 0);
+
+    // names the field of the item's payload at offset, e.g. "glyph 12, width"
+    std::string describePayloadOffset(const PakItem &item, long long offset);
+}
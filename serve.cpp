@@ -0,0 +1,584 @@
+#include "serve.h"
+#include "pack.h"
+#include "unpack.h"
+#include "native.h"
+#include "hash.h"
+#include <stdexcept>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/un.h>
+# include <unistd.h>
+# include <csignal>
+# include <cerrno>
+#endif
+
+
+namespace scpak
+{
+#ifndef _WIN32
+    namespace
+    {
+        // Keeps values until their total size exceeds the capacity, then
+        // drops the least recently used ones. Not synchronized.
+        template<typename Value>
+        class LruCache
+        {
+        public:
+            explicit LruCache(std::size_t capacity) : m_capacity(capacity), m_bytes(0) { }
+
+            std::shared_ptr<const Value> get(std::uint64_t key)
+            {
+                auto it = m_index.find(key);
+                if (it == m_index.end())
+                    return nullptr;
+                m_entries.splice(m_entries.begin(), m_entries, it->second);
+                return it->second->value;
+            }
+
+            void put(std::uint64_t key, std::shared_ptr<const Value> value, std::size_t bytes)
+            {
+                auto it = m_index.find(key);
+                if (it != m_index.end())
+                {
+                    m_bytes -= it->second->bytes;
+                    m_entries.erase(it->second);
+                    m_index.erase(it);
+                }
+                // values bigger than the whole cache are not worth keeping
+                if (bytes > m_capacity)
+                    return;
+                m_entries.push_front(Entry{ key, std::move(value), bytes });
+                m_index[key] = m_entries.begin();
+                m_bytes += bytes;
+                while (m_bytes > m_capacity)
+                {
+                    m_bytes -= m_entries.back().bytes;
+                    m_index.erase(m_entries.back().key);
+                    m_entries.pop_back();
+                }
+            }
+
+            std::size_t count() const { return m_entries.size(); }
+            std::size_t bytes() const { return m_bytes; }
+        private:
+            struct Entry
+            {
+                std::uint64_t key;
+                std::shared_ptr<const Value> value;
+                std::size_t bytes;
+            };
+
+            std::size_t m_capacity;
+            std::size_t m_bytes;
+            std::list<Entry> m_entries;
+            std::unordered_map<std::uint64_t, typename std::list<Entry>::iterator> m_index;
+        };
+
+        struct FileIdentity
+        {
+            long long size;
+            long long mtime;
+            long long inode;
+            std::uint64_t hash;
+        };
+
+        FileIdentity identify(const std::string &path)
+        {
+            struct stat statbuf;
+            if (stat(path.c_str(), &statbuf) < 0)
+                throw std::runtime_error("cannot open " + path);
+# ifdef __APPLE__
+            long long mtime = statbuf.st_mtimespec.tv_sec * 1000000000ll + statbuf.st_mtimespec.tv_nsec;
+# else
+            long long mtime = statbuf.st_mtim.tv_sec * 1000000000ll + statbuf.st_mtim.tv_nsec;
+# endif
+            return FileIdentity{ statbuf.st_size, mtime, static_cast<long long>(statbuf.st_ino), 0 };
+        }
+
+        std::shared_ptr<std::vector<byte>> readWholeFile(const std::string &path)
+        {
+            std::ifstream fin(path, std::ios::binary);
+            if (!fin)
+                throw std::runtime_error("cannot open " + path);
+            fin.seekg(0, std::ios::end);
+            std::shared_ptr<std::vector<byte>> buffer = std::make_shared<std::vector<byte>>(static_cast<std::size_t>(fin.tellg()));
+            fin.seekg(0, std::ios::beg);
+            fin.read(reinterpret_cast<char*>(buffer->data()), buffer->size());
+            if (!fin)
+                throw std::runtime_error("failed to read " + path);
+            return buffer;
+        }
+
+        // the built-in packers look for the item name with these appended
+        const char *inputSuffixes[] = { "", ".txt", ".xml", ".tga", ".png", ".bmp", ".lst", ".wav" };
+
+        std::uint64_t itemKey(const std::string &inputDir, const ManifestEntry &entry, const PackOptions &options)
+        {
+            std::uint64_t key = hashBytes(entry.item.type.data(), entry.item.type.size());
+            key = hashString(entry.meta, key);
+            byte flags[] = { options.packText, options.packTexture, options.packFont, options.packSound, options.minifyXml,
+                options.monoSound, options.compactFonts };
+            key = hashBytes(flags, sizeof(flags), key);
+            key = hashBytes(&options.textureScale, sizeof(options.textureScale), key);
+            key = hashBytes(&options.sampleRate, sizeof(options.sampleRate), key);
+            for (const char *suffix : inputSuffixes)
+            {
+                std::string path = inputDir + entry.item.name + suffix;
+                if (!pathExists(path.c_str()) || isDirectory(path.c_str()))
+                    continue;
+                std::shared_ptr<std::vector<byte>> content = readWholeFile(path);
+                key = hashString(suffix, key);
+                key = hashBytes(content->data(), content->size(), key);
+            }
+            return key;
+        }
+
+        const std::string &argument(const std::vector<std::string> &request, std::size_t index)
+        {
+            if (index >= request.size())
+                throw std::runtime_error("missing argument for " + request[0]);
+            return request[index];
+        }
+
+        class Server
+        {
+        public:
+            explicit Server(const ServeOptions &options) :
+                m_options(options), m_paks(options.cacheBytes / 2), m_items(options.cacheBytes / 2),
+                m_pakHits(0), m_pakMisses(0), m_itemHits(0), m_itemMisses(0)
+            {
+            }
+
+            void handle(int client)
+            {
+                std::string line;
+                char buffer[4096];
+                while (line.find('\n') == std::string::npos && line.length() < 65536)
+                {
+                    ssize_t length = recv(client, buffer, sizeof(buffer), 0);
+                    if (length <= 0)
+                        break;
+                    line.append(buffer, length);
+                }
+                std::vector<std::string> request;
+                std::size_t end = line.find('\n');
+                std::stringstream fields(line.substr(0, end));
+                std::string field;
+                while (std::getline(fields, field, '\t'))
+                    request.push_back(field);
+
+                std::ostringstream out;
+                std::ostringstream err;
+                int status = 1;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                if (end == std::string::npos || request.empty())
+                    err << "error: malformed request" << std::endl;
+                else
+                    status = run(request, out, err);
+                // connections without a request only check for a running server
+                if (m_options.log != nullptr && !line.empty())
+                {
+                    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    *m_options.log << (request.empty() ? std::string("?") : request[0]) << " -> " << status
+                        << " in " << static_cast<int>(milliseconds) << " ms" << std::endl;
+                }
+
+                std::string response = prefixLines("o ", out.str()) + prefixLines("e ", err.str()) + "= " + std::to_string(status) + "\n";
+                for (std::size_t sent = 0; sent < response.length(); )
+                {
+                    ssize_t length = send(client, response.data() + sent, response.length() - sent, 0);
+                    if (length <= 0)
+                        break;
+                    sent += static_cast<std::size_t>(length);
+                }
+                close(client);
+            }
+        private:
+            static std::string prefixLines(const char *prefix, const std::string &text)
+            {
+                std::string result;
+                std::stringstream lines(text);
+                std::string line;
+                while (std::getline(lines, line))
+                    result += prefix + line + '\n';
+                return result;
+            }
+
+            int run(const std::vector<std::string> &request, std::ostream &out, std::ostream &err)
+            {
+                try
+                {
+                    const std::string &command = request[0];
+                    PackOptions packOptions;
+                    packOptions.packText = packOptions.packTexture = packOptions.packFont = packOptions.packSound = true;
+                    UnpackOptions unpackOptions;
+                    unpackOptions.unpackText = unpackOptions.unpackBitmapFont = unpackOptions.unpackTexture = unpackOptions.unpackSound = true;
+                    ItemFilter filter;
+                    std::shared_ptr<const PakFile> reference;
+                    for (std::size_t i = 1; i < request.size(); ++i)
+                    {
+                        const std::string &option = request[i];
+                        if (option == "minify-xml")
+                        {
+                            packOptions.minifyXml = true;
+                            packOptions.report = &out;
+                        }
+                        else if (option.compare(0, 14, "texture-scale=") == 0)
+                            packOptions.textureScale = std::max(1, std::atoi(option.c_str() + 14));
+                        else if (option.compare(0, 12, "sample-rate=") == 0)
+                            packOptions.sampleRate = std::max(0, std::atoi(option.c_str() + 12));
+                        else if (option == "mono-sound")
+                            packOptions.monoSound = true;
+                        else if (option == "compact-fonts")
+                            packOptions.compactFonts = true;
+                        else if (option == "group-by-type")
+                            packOptions.layout.groupByType = true;
+                        else if (option.compare(0, 6, "align=") == 0)
+                            packOptions.layout.alignment = std::strtoull(option.c_str() + 6, nullptr, 10);
+                        else if (option.compare(0, 13, "access-order=") == 0)
+                            packOptions.layout.accessOrder = readAccessOrder(option.substr(13));
+                        else if (option.compare(0, 8, "include=") == 0)
+                            filter.includeNames.push_back(option.substr(8));
+                        else if (option.compare(0, 8, "exclude=") == 0)
+                            filter.excludeNames.push_back(option.substr(8));
+                        else if (option.compare(0, 5, "type=") == 0)
+                            filter.includeTypes.push_back(option.substr(5));
+                        else if (option.compare(0, 13, "exclude-type=") == 0)
+                            filter.excludeTypes.push_back(option.substr(13));
+                        else if (option.compare(0, 10, "reference=") == 0)
+                            reference = loadPak(option.substr(10));
+                        else if (option.compare(0, 14, "write-backend=") == 0)
+                        {
+                            if (!parseFileWriterBackend(option.substr(14), unpackOptions.writeBackend))
+                                throw std::runtime_error("unknown write backend " + option.substr(14));
+                        }
+                        else if (option.compare(0, 12, "write-queue=") == 0)
+                            unpackOptions.writeQueueDepth = std::max(1, std::atoi(option.c_str() + 12));
+                    }
+
+                    packOptions.filter = unpackOptions.filter = filter;
+                    packOptions.reference = reference.get();
+
+                    if (command == "pack")
+                        packDirectory(argument(request, 1), argument(request, 2), packOptions);
+                    else if (command == "unpack")
+                        unpack(*loadPak(argument(request, 1)), argument(request, 2), unpackOptions);
+                    else if (command == "list")
+                    {
+                        for (const PakItem &item : loadPak(argument(request, 1))->contents())
+                            if (filter.matches(item.name, item.type))
+                                out << item.name << '\t' << item.type << '\t' << item.length << std::endl;
+                    }
+                    else if (command == "extract")
+                        unpackItem(*loadPak(argument(request, 1)), argument(request, 2), argument(request, 3), unpackOptions);
+                    else if (command == "stats")
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        out << "paks: " << m_paks.count() << " cached, " << m_paks.bytes() << " bytes, "
+                            << m_pakHits << " hits, " << m_pakMisses << " misses" << std::endl;
+                        out << "items: " << m_items.count() << " cached, " << m_items.bytes() << " bytes, "
+                            << m_itemHits << " hits, " << m_itemMisses << " misses" << std::endl;
+                    }
+                    else
+                        throw std::runtime_error("unknown command " + command);
+                    return 0;
+                }
+                catch (const std::exception &e)
+                {
+                    err << "error: " << e.what() << std::endl;
+                }
+                catch (const BaseException &e)
+                {
+                    err << "error: " << e.what() << std::endl;
+                }
+                return 1;
+            }
+
+            std::shared_ptr<const PakFile> loadPak(const std::string &path)
+            {
+                FileIdentity identity = identify(path);
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    auto known = m_files.find(path);
+                    if (known != m_files.end() && known->second.size == identity.size
+                        && known->second.mtime == identity.mtime && known->second.inode == identity.inode)
+                    {
+                        std::shared_ptr<const PakFile> pak = m_paks.get(known->second.hash);
+                        if (pak)
+                        {
+                            ++m_pakHits;
+                            return pak;
+                        }
+                    }
+                }
+
+                std::shared_ptr<std::vector<byte>> buffer = readWholeFile(path);
+                identity.hash = hashBytes(buffer->data(), buffer->size());
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_files[path] = identity;
+                std::shared_ptr<const PakFile> pak = m_paks.get(identity.hash);
+                if (pak)
+                {
+                    ++m_pakHits;
+                    return pak;
+                }
+                ++m_pakMisses;
+                std::shared_ptr<PakFile> loaded = std::make_shared<PakFile>();
+                loaded->loadView(buffer->data(), buffer->size(), buffer);
+                m_paks.put(identity.hash, loaded, buffer->size());
+                return loaded;
+            }
+
+            void packDirectory(const std::string &dirPath, const std::string &pakPath, const PackOptions &options)
+            {
+                std::string inputDir = dirPath;
+                if (*inputDir.rbegin() != pathsep)
+                    inputDir += pathsep;
+                PakFile pak;
+                // the pak only points at cached items, which these keep alive
+                std::vector<std::shared_ptr<const PakItem>> packed;
+                std::unordered_map<PakString, const PakItem*> reference;
+                if (options.reference != nullptr)
+                {
+                    for (const PakItem &item : options.reference->contents())
+                        reference.emplace(item.name, &item);
+                }
+                for (ManifestEntry &entry : readManifest(dirPath))
+                {
+                    if (!options.filter.matches(entry.item.name, entry.item.type))
+                    {
+                        // taken as it is from the reference pak, which the
+                        // caller keeps alive
+                        if (options.reference == nullptr)
+                            continue;
+                        auto it = reference.find(entry.item.name);
+                        if (it == reference.end() || it->second->type != entry.item.type)
+                            throw std::runtime_error(entry.item.name + " is not selected and not in the reference pak");
+                        PakItem item;
+                        item.name = entry.item.name;
+                        item.type = entry.item.type;
+                        item.typeId = entry.item.typeId;
+                        item.length = it->second->length;
+                        item.view = it->second->payload();
+                        pak.addItem(std::move(item));
+                        continue;
+                    }
+                    std::uint64_t key = itemKey(inputDir, entry, options);
+                    std::shared_ptr<const PakItem> cached;
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        cached = m_items.get(key);
+                        ++(cached ? m_itemHits : m_itemMisses);
+                    }
+                    if (!cached)
+                    {
+                        ItemMemoryScope memoryScope(entry.item.name.c_str());
+                        std::shared_ptr<PakItem> item = std::make_shared<PakItem>(entry.item);
+                        packItem(inputDir, *item, entry.meta, options);
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_items.put(key, item, item->length);
+                        cached = item;
+                    }
+                    PakItem item;
+                    item.name = entry.item.name;
+                    item.type = entry.item.type;
+                    item.typeId = entry.item.typeId;
+                    item.length = cached->length;
+                    item.view = cached->payload();
+                    pak.addItem(std::move(item));
+                    packed.push_back(cached);
+                }
+                // the client only sees success once the whole pak is in place
+                std::string tempPath = pakPath + ".tmp";
+                try
+                {
+                    std::ofstream fout(tempPath, std::ios::binary);
+                    if (!fout)
+                        throw std::runtime_error("cannot open " + tempPath);
+                    pak.save(fout, options.layout);
+                    fout.close();
+                    if (!fout)
+                        throw std::runtime_error("failed to write " + tempPath);
+                }
+                catch (...)
+                {
+                    std::remove(tempPath.c_str());
+                    throw;
+                }
+                if (std::rename(tempPath.c_str(), pakPath.c_str()) != 0)
+                {
+                    std::remove(tempPath.c_str());
+                    throw std::runtime_error("cannot replace " + pakPath);
+                }
+            }
+
+            ServeOptions m_options;
+            std::mutex m_mutex;
+            LruCache<PakFile> m_paks;
+            LruCache<PakItem> m_items;
+            std::map<std::string, FileIdentity> m_files;
+            long long m_pakHits;
+            long long m_pakMisses;
+            long long m_itemHits;
+            long long m_itemMisses;
+        };
+
+        sockaddr_un socketAddress(const std::string &socketPath)
+        {
+            sockaddr_un address;
+            std::memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (socketPath.length() >= sizeof(address.sun_path))
+                throw std::runtime_error("socket path too long: " + socketPath);
+            std::strcpy(address.sun_path, socketPath.c_str());
+            return address;
+        }
+
+        int connectTo(const std::string &socketPath)
+        {
+            sockaddr_un address = socketAddress(socketPath);
+            int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd == -1)
+                throw std::runtime_error("cannot create socket: " + std::string(std::strerror(errno)));
+            if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1)
+            {
+                close(fd);
+                return -1;
+            }
+            return fd;
+        }
+    }
+
+    std::string defaultSocketPath()
+    {
+        const char *runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+        if (runtimeDir != nullptr && runtimeDir[0] != '\0')
+            return std::string(runtimeDir) + "/scpak.sock";
+        return "/tmp/scpak-" + std::to_string(getuid()) + ".sock";
+    }
+
+    void serve(const std::string &socketPath, const ServeOptions &options)
+    {
+        // clients going away mid-response must not kill the server
+        std::signal(SIGPIPE, SIG_IGN);
+
+        int existing = connectTo(socketPath);
+        if (existing != -1)
+        {
+            close(existing);
+            throw std::runtime_error("a server is already listening on " + socketPath);
+        }
+        unlink(socketPath.c_str());
+
+        sockaddr_un address = socketAddress(socketPath);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1)
+            throw std::runtime_error("cannot create socket: " + std::string(std::strerror(errno)));
+        // requests read and write files as this user, keep others out
+        mode_t oldMask = umask(0077);
+        int bound = bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+        umask(oldMask);
+        if (bound == -1 || listen(fd, 64) == -1)
+        {
+            std::string reason = std::strerror(errno);
+            close(fd);
+            throw std::runtime_error("cannot listen on " + socketPath + ": " + reason);
+        }
+        if (options.log != nullptr)
+            *options.log << "listening on " << socketPath << std::endl;
+
+        Server server(options);
+        while (true)
+        {
+            int client = accept(fd, nullptr, nullptr);
+            if (client == -1)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                std::string reason = std::strerror(errno);
+                close(fd);
+                throw std::runtime_error("accept failed: " + reason);
+            }
+            std::thread(&Server::handle, &server, client).detach();
+        }
+    }
+
+    int sendRequest(const std::string &socketPath, const std::vector<std::string> &request,
+        std::ostream &out, std::ostream &err)
+    {
+        std::string line;
+        for (const std::string &field : request)
+        {
+            if (field.find_first_of("\t\n") != std::string::npos)
+                throw std::runtime_error("tabs and line breaks cannot be sent to the server: " + field);
+            line += (line.empty() ? "" : "\t") + field;
+        }
+        line += '\n';
+
+        int fd = connectTo(socketPath);
+        if (fd == -1)
+            throw std::runtime_error("no scpak server listening on " + socketPath + " (start one with scpak serve)");
+        for (std::size_t sent = 0; sent < line.length(); )
+        {
+            ssize_t length = send(fd, line.data() + sent, line.length() - sent, 0);
+            if (length <= 0)
+            {
+                close(fd);
+                throw std::runtime_error("lost connection to " + socketPath);
+            }
+            sent += static_cast<std::size_t>(length);
+        }
+
+        std::string response;
+        char buffer[4096];
+        ssize_t length;
+        while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+            response.append(buffer, length);
+        close(fd);
+
+        std::stringstream lines(response);
+        while (std::getline(lines, line))
+        {
+            if (line.compare(0, 2, "o ") == 0)
+                out << line.substr(2) << std::endl;
+            else if (line.compare(0, 2, "e ") == 0)
+                err << line.substr(2) << std::endl;
+            else if (line.compare(0, 2, "= ") == 0)
+                return std::atoi(line.c_str() + 2);
+        }
+        throw std::runtime_error("lost connection to " + socketPath);
+    }
+#else
+    std::string defaultSocketPath()
+    {
+        return std::string();
+    }
+
+    void serve(const std::string &socketPath, const ServeOptions &options)
+    {
+        throw std::runtime_error("serve mode needs Unix domain sockets and is not available on this platform");
+    }
+
+    int sendRequest(const std::string &socketPath, const std::vector<std::string> &request,
+        std::ostream &out, std::ostream &err)
+    {
+        throw std::runtime_error("client mode needs Unix domain sockets and is not available on this platform");
+    }
+#endif
+}
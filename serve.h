@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <ostream>
+#include <cstddef>
+
+namespace scpak
+{
+    struct ServeOptions
+    {
+        // memory for cached paks and cached packed items, half each
+        std::size_t cacheBytes = std::size_t(512) << 20;
+        // one line per request, may be null
+        std::ostream *log = nullptr;
+    };
+
+    // $XDG_RUNTIME_DIR/scpak.sock, or /tmp/scpak-<uid>.sock without it
+    std::string defaultSocketPath();
+
+    // Answers requests on a Unix domain socket until the process is
+    // killed, one thread per connection. Loaded paks are cached by the hash
+    // of their contents (file size, mtime and inode tell when to re-hash),
+    // packed items by the hash of their type, manifest line, pack options
+    // and input files, both with least recently used eviction.
+    // Requests are a command and its arguments, paths must be absolute:
+    //   pack <dir> <pak> [minify-xml] [group-by-type] [align=N] [access-order=PATH] [reference=PAK]
+    //   unpack <pak> <dir> [write-backend=NAME] [write-queue=N]
+    //   list <pak>
+    // pack, unpack and list also take include=GLOB, exclude=GLOB, type=TYPE
+    // and exclude-type=TYPE, any number of times
+    //   extract <pak> <item> <dir>
+    //   stats
+    // Only available on POSIX systems.
+    void serve(const std::string &socketPath, const ServeOptions &options);
+
+    // sends one request to a server, copies its output to out and err and
+    // returns the exit status the command would have had when run locally
+    int sendRequest(const std::string &socketPath, const std::vector<std::string> &request,
+        std::ostream &out, std::ostream &err);
+}
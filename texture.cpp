@@ -0,0 +1,59 @@
+#include "texture.h"
+#include "binaryio.h"
+#include <stdexcept>
+#include <algorithm>
+
+
+namespace scpak
+{
+    TextureHeader readTextureHeader(const byte *data, std::size_t size)
+    {
+        MemoryBinaryReader reader(data, size);
+        TextureHeader header;
+        header.keepSourceImageInTag = reader.readBoolean();
+        header.width = reader.readInt32();
+        header.height = reader.readInt32();
+        header.mipmapLevel = reader.readInt32();
+        if (header.width <= 0 || header.height <= 0 || header.mipmapLevel <= 0)
+            throw std::runtime_error("invalid texture header");
+        return header;
+    }
+
+    MipmapLevelRange mipmapLevelRange(int width, int height, int level)
+    {
+        // same chain as generateMipmap: both sides halve until one reaches 1,
+        // then the other keeps halving
+        MipmapLevelRange range = { 0, width, height };
+        for (int i = 0; i < level; ++i)
+        {
+            if (range.width == 1 && range.height == 1)
+                throw std::runtime_error("mipmap level out of range");
+            range.offset += range.byteCount();
+            range.width = std::max(1, range.width / 2);
+            range.height = std::max(1, range.height / 2);
+        }
+        return range;
+    }
+
+    TextureHeader readTextureHeader(const PakFile &pak, std::istream &stream, const PakItem &item)
+    {
+        byte data[TextureHeader::size];
+        if (item.length < TextureHeader::size)
+            throw std::runtime_error("invalid texture header");
+        pak.readRange(stream, item, 0, data, sizeof(data));
+        return readTextureHeader(data, sizeof(data));
+    }
+
+    std::vector<byte> readMipmapLevel(const PakFile &pak, std::istream &stream, const PakItem &item,
+        const TextureHeader &header, int level)
+    {
+        if (level < 0 || level >= header.mipmapLevel)
+            throw std::runtime_error("mipmap level out of range");
+        MipmapLevelRange range = mipmapLevelRange(header.width, header.height, level);
+        if (TextureHeader::size + range.offset + range.byteCount() > item.length)
+            throw std::runtime_error("texture " + item.name + " is truncated");
+        std::vector<byte> pixels(static_cast<std::size_t>(range.byteCount()));
+        pak.readRange(stream, item, TextureHeader::size + range.offset, pixels.data(), pixels.size());
+        return pixels;
+    }
+}
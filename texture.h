@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <istream>
+#include <vector>
+
+#include "scpak.h"
+#include "pakfile.h"
+
+namespace scpak
+{
+    // header in front of the RGBA mip chain of Engine.Graphics.Texture2D
+    // items and of the atlas of Engine.Media.BitmapFont items
+    struct TextureHeader
+    {
+        static const int size = 13;
+
+        bool keepSourceImageInTag;
+        int width;
+        int height;
+        int mipmapLevel; // number of levels in the chain, 1 means no mipmaps
+    };
+
+    TextureHeader readTextureHeader(const byte *data, std::size_t size);
+
+    // position of one level inside the mip chain, offset is counted in bytes
+    // from the first pixel of level 0
+    struct MipmapLevelRange
+    {
+        long long offset;
+        int width;
+        int height;
+
+        long long byteCount() const { return static_cast<long long>(width) * height * 4; }
+    };
+
+    MipmapLevelRange mipmapLevelRange(int width, int height, int level);
+
+    // These go through PakFile::readRange, so with a pak loaded by
+    // loadDirectory() only the header and the one level are read, e.g. the
+    // smallest level (header.mipmapLevel - 1) for a thumbnail.
+    TextureHeader readTextureHeader(const PakFile &pak, std::istream &stream, const PakItem &item);
+    // RGBA pixels of one level, sized by mipmapLevelRange()
+    std::vector<byte> readMipmapLevel(const PakFile &pak, std::istream &stream, const PakItem &item,
+        const TextureHeader &header, int level);
+}
@@ -0,0 +1,174 @@
+#include "trace.h"
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+
+namespace scpak
+{
+    namespace
+    {
+        struct TraceEvent
+        {
+            const char *category;
+            std::string name;
+            std::string detail;
+            int thread;
+            long long begin;
+            long long end;
+        };
+
+        std::mutex traceMutex;
+        std::vector<TraceEvent> traceEvents;
+        std::vector<std::pair<int, std::string>> threadNames;
+        std::chrono::steady_clock::time_point traceEpoch = std::chrono::steady_clock::now();
+        std::atomic<int> nextThreadId(1);
+
+        int currentThreadId()
+        {
+            thread_local int id = nextThreadId++;
+            return id;
+        }
+
+        void writeJsonString(std::ostream &out, const std::string &value)
+        {
+            static const char *hex = "0123456789abcdef";
+            out << '"';
+            for (char ch : value)
+            {
+                if (ch == '"' || ch == '\\')
+                    out << '\\' << ch;
+                else if (static_cast<unsigned char>(ch) < 0x20)
+                    out << "\\u00" << hex[(ch >> 4) & 15] << hex[ch & 15];
+                else
+                    out << ch;
+            }
+            out << '"';
+        }
+    }
+
+    std::atomic<bool> Trace::s_enabled(false);
+
+    void Trace::start()
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceEvents.clear();
+        threadNames.clear();
+        traceEpoch = std::chrono::steady_clock::now();
+        s_enabled = true;
+    }
+
+    void Trace::stop()
+    {
+        s_enabled = false;
+    }
+
+    void Trace::save(const std::string &path)
+    {
+        std::ofstream fout(path);
+        if (!fout)
+            throw std::runtime_error("cannot open trace file: " + path);
+
+        std::lock_guard<std::mutex> lock(traceMutex);
+        fout << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto &thread : threadNames)
+        {
+            fout << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":"
+                << thread.first << ",\"args\":{\"name\":";
+            writeJsonString(fout, thread.second);
+            fout << "}}";
+            first = false;
+        }
+        for (const TraceEvent &event : traceEvents)
+        {
+            fout << (first ? "" : ",\n") << "{\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+                << ",\"ts\":" << event.begin << ",\"dur\":" << event.end - event.begin
+                << ",\"cat\":\"" << event.category << "\",\"name\":";
+            writeJsonString(fout, event.name);
+            if (!event.detail.empty())
+            {
+                fout << ",\"args\":{\"detail\":";
+                writeJsonString(fout, event.detail);
+                fout << "}";
+            }
+            fout << "}";
+            first = false;
+        }
+        fout << "\n]}\n";
+    }
+
+    void Trace::setThreadName(const std::string &name)
+    {
+        if (!enabled())
+            return;
+        int id = currentThreadId();
+        std::lock_guard<std::mutex> lock(traceMutex);
+        threadNames.push_back(std::make_pair(id, name));
+    }
+
+    long long Trace::now()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - traceEpoch).count();
+    }
+
+    void Trace::record(const char *category, const std::string &name, const std::string &detail,
+        long long begin, long long end)
+    {
+        TraceEvent event = { category, name, detail, currentThreadId(), begin, end };
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceEvents.push_back(std::move(event));
+    }
+
+
+    TraceScope::TraceScope(const char *category, const char *name) :
+        m_active(Trace::enabled()), m_category(category), m_begin(0)
+    {
+        if (m_active)
+        {
+            m_name = name;
+            m_begin = Trace::now();
+        }
+    }
+
+    TraceScope::TraceScope(const char *category, const std::string &name) :
+        m_active(Trace::enabled()), m_category(category), m_begin(0)
+    {
+        if (m_active)
+        {
+            m_name = name;
+            m_begin = Trace::now();
+        }
+    }
+
+    TraceScope::TraceScope(const char *category, const std::string &name, const std::string &detail) :
+        m_active(Trace::enabled()), m_category(category), m_begin(0)
+    {
+        if (m_active)
+        {
+            m_name = name;
+            m_detail = detail;
+            m_begin = Trace::now();
+        }
+    }
+
+    TraceScope::TraceScope(const char *category, const char *name, const char *detail) :
+        m_active(Trace::enabled()), m_category(category), m_begin(0)
+    {
+        if (m_active)
+        {
+            m_name = name;
+            m_detail = detail;
+            m_begin = Trace::now();
+        }
+    }
+
+    TraceScope::~TraceScope()
+    {
+        if (m_active)
+            Trace::record(m_category, m_name, m_detail, m_begin, Trace::now());
+    }
+}
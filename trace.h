@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <atomic>
+
+namespace scpak
+{
+    // Collects timed spans and writes them in the Chrome trace event format,
+    // which can be opened in chrome://tracing or Perfetto.
+    // While tracing is off a span costs a single relaxed atomic load.
+    class Trace
+    {
+    public:
+        static bool enabled()
+        {
+            return s_enabled.load(std::memory_order_relaxed);
+        }
+
+        static void start();
+        static void stop();
+        // writes every recorded span to path, tracing must be stopped
+        static void save(const std::string &path);
+        // names the calling thread in the trace view
+        static void setThreadName(const std::string &name);
+
+        static long long now();
+        static void record(const char *category, const std::string &name, const std::string &detail,
+            long long begin, long long end);
+    private:
+        static std::atomic<bool> s_enabled;
+    };
+
+    class TraceScope
+    {
+    public:
+        TraceScope(const char *category, const char *name);
+        TraceScope(const char *category, const std::string &name);
+        TraceScope(const char *category, const std::string &name, const std::string &detail);
+        TraceScope(const char *category, const char *name, const char *detail);
+        ~TraceScope();
+
+        TraceScope(const TraceScope &) = delete;
+        TraceScope &operator=(const TraceScope &) = delete;
+    private:
+        bool m_active;
+        const char *m_category;
+        std::string m_name;
+        std::string m_detail;
+        long long m_begin;
+    };
+}
@@ -1,12 +1,19 @@
 #include "unpack.h"
+#include "codec.h"
+#include "font.h"
+#include "texture.h"
 #include "native.h"
 #include "wav.h"
+#include "trace.h"
+#include "memtrack.h"
+#include "progress.h"
 #include <stdexcept>
-#include <set>
 #include <vector>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <memory>
+#include <cstring>
 
 #include "stb/stb_image.h"
 #include "stb/stb_image_write.h"
@@ -15,79 +22,140 @@
 
 namespace scpak
 {
-    void unpack(const PakFile &pak, const std::string &dirPath,
-        const std::map<std::string, unpacker_type> &unpackers,
-        const unpacker_type &default_unpacker)
+    namespace
     {
-        std::string dirPathSafe = dirPath;
-        if (*dirPathSafe.rbegin() != pathsep)
-            dirPathSafe += pathsep;
-        // find all the directories we possibly need to create
-        std::set<std::string> directoriesToCreate;
-        directoriesToCreate.insert(dirPath);
-        for (const PakItem &item : pak.contents())
+        // creates the directory tree, hands every item filter selects to
+        // dispatch and writes the manifest
+        template<typename Dispatch>
+        void unpackItems(const PakFile &pak, DirectoryCache &directories, const ItemFilter &filter, const Dispatch &dispatch)
         {
-            std::string filePath = item.name;
-            std::size_t pend = filePath.rfind('/');
-            if (pend == std::string::npos)
-                continue;
-            std::size_t p = 0;
-            while (p != pend)
+            const std::string &dirPathSafe = directories.root();
+            {
+                TraceScope scope("phase", "directory creation");
+                // items mostly come grouped by directory, skip repeats of the last one
+                std::string lastDirectory;
+                for (const PakItem &item : pak.contents())
+                {
+                    const char *pend = std::strrchr(item.name.c_str(), '/');
+                    if (pend == nullptr || lastDirectory.compare(0, std::string::npos, item.name.c_str(), pend - item.name.c_str()) == 0
+                        || !filter.matches(item.name, item.type))
+                        continue;
+                    lastDirectory.assign(item.name.c_str(), pend);
+                    directories.createDirectories(lastDirectory);
+                }
+            }
+            std::size_t selectedCount = 0;
+            std::int64_t selectedBytes = 0;
+            if (Progress::observer() != nullptr)
+            {
+                for (const PakItem &item : pak.contents())
+                    if (filter.matches(item.name, item.type))
+                    {
+                        ++selectedCount;
+                        selectedBytes += item.length;
+                    }
+            }
+            ProgressOperation progress("unpack", selectedCount, selectedBytes);
+            // unpack contents
+            std::vector<std::string> infoLines;
+            for (const PakItem &item : pak.contents())
             {
-                p = filePath.find('/', p + 1);
-                directoriesToCreate.insert(dirPathSafe + filePath.substr(0, p));
+                if (!filter.matches(item.name, item.type))
+                {
+                    infoLines.push_back(item.name + ':' + item.type + ':');
+                    continue;
+                }
+                ProgressItem itemProgress("unpack", item.name, item.type, item.length);
+                TraceScope itemScope("item", item.name.c_str(), item.type.c_str());
+                ItemMemoryScope memoryScope(item.name.c_str());
+                std::stringstream lineBuffer;
+                lineBuffer << item.name << ':' << item.type;
+                std::string meta;
+                {
+                    TraceScope unpackerScope("unpacker", item.type.c_str());
+                    meta = dispatch(dirPathSafe, item);
+                }
+                lineBuffer << ':' << meta;
+                infoLines.push_back(lineBuffer.str());
             }
+            // write info file - will be useful when re-packing
+            TraceScope manifestScope("phase", "manifest write");
+            std::ofstream fout(dirPathSafe + PakInfoFileName);
+            for (const std::string &line : infoLines)
+                fout << line << std::endl;
         }
-        // create directories if necessary
-        for (const std::string &dir : directoriesToCreate)
-            if (!pathExists(dir.c_str()))
-                createDirectory(dir.c_str());
-        // unpack contents
-        std::vector<std::string> infoLines;
-        for (const PakItem &item : pak.contents())
+    }
+
+    void unpack(const PakFile &pak, const std::string &dirPath,
+        const std::map<std::string, unpacker_type> &unpackers,
+        const unpacker_type &default_unpacker)
+    {
+        DirectoryCache directories(dirPath);
+        unpackItems(pak, directories, ItemFilter(), [&](const std::string &outputDir, const PakItem &item)
         {
-            std::stringstream lineBuffer;
-            lineBuffer << item.name << ':' << item.type;
-            std::string itemType = item.type;
-            auto it = unpackers.find(itemType);
-            std::string meta;
+            auto it = unpackers.find(item.type.str());
             if (it != unpackers.end())
-                meta = it->second(dirPathSafe, item);
+                return it->second(outputDir, item);
             else
-                meta = default_unpacker(dirPathSafe, item);
-            lineBuffer << ':' << meta;
-            infoLines.push_back(lineBuffer.str());
+                return default_unpacker(outputDir, item);
+        });
+    }
+
+    void unpack(const PakFile &pak, const std::string &dirPath, bool unpackText, bool unpackBitmapFont, bool unpackTexture, bool unpackSound)
+    {
+        UnpackOptions options;
+        options.unpackText = unpackText;
+        options.unpackBitmapFont = unpackBitmapFont;
+        options.unpackTexture = unpackTexture;
+        options.unpackSound = unpackSound;
+        unpack(pak, dirPath, options);
+    }
+
+    std::string unpackItem(const std::string &outputDir, const PakItem &item, const UnpackOptions &options, FileWriter &writer)
+    {
+        const ItemCodec &codec = itemCodec(item.typeId);
+        if (codec.unpack != nullptr)
+        {
+            if (options.*codec.unpackEnabled)
+                return codec.unpack(outputDir, item, options, writer);
+            unpack_raw(outputDir, item, writer);
+            return std::string();
         }
-        // write info file - will be useful when re-packing
-        std::ofstream fout(dirPathSafe + PakInfoFileName);
-        for (const std::string &line : infoLines)
-            fout << line << std::endl;
+        auto it = options.customUnpackers.find(item.type.str());
+        if (it != options.customUnpackers.end())
+            return it->second(outputDir, item);
+        unpack_raw(outputDir, item, writer);
+        return std::string();
     }
 
-    template<void old_unpacker(const std::string &outputPath, const PakItem &item)>
-    std::string unpacker_wrapper(const std::string &outputDir, const PakItem &item)
+    void unpack(const PakFile &pak, const std::string &dirPath, const UnpackOptions &options)
     {
-        old_unpacker(outputDir, item);
-        return "";
+        DirectoryCache directories(dirPath);
+        std::unique_ptr<FileWriter> writer = createFileWriter(options.writeBackend, options.writeQueueDepth, &directories);
+        unpackItems(pak, directories, options.filter, [&](const std::string &outputDir, const PakItem &item)
+        {
+            return unpackItem(outputDir, item, options, *writer);
+        });
+        TraceScope scope("phase", "flush output", writer->name());
+        writer->flush();
     }
 
-    void unpack(const PakFile &pak, const std::string &dirPath, bool unpackText, bool unpackBitmapFont, bool unpackTexture, bool unpackSound)
+    void unpackItem(const PakFile &pak, const std::string &name, const std::string &dirPath, const UnpackOptions &options)
     {
-        std::map<std::string, unpacker_type> unpackers;
-        if (unpackText)
+        for (const PakItem &item : pak.contents())
         {
-            unpackers.insert(std::pair<std::string, unpacker_type>("System.String", unpacker_wrapper<unpack_string>));
-            unpackers.insert(std::pair<std::string, unpacker_type>("System.Xml.Linq.XElement", unpacker_wrapper<unpack_string>));
+            if (item.name != name)
+                continue;
+            DirectoryCache directories(dirPath);
+            std::size_t slash = name.rfind('/');
+            if (slash != std::string::npos)
+                directories.createDirectories(name.substr(0, slash));
+            std::unique_ptr<FileWriter> writer = createFileWriter(FileWriterBackend::Sync, 1, &directories);
+            unpackItem(directories.root(), item, options, *writer);
+            writer->flush();
+            return;
         }
-        if (unpackTexture)
-            unpackers.insert(std::pair<std::string, unpacker_type>("Engine.Graphics.Texture2D", unpack_texture));
-        if (unpackBitmapFont)
-            unpackers.insert(std::pair<std::string, unpacker_type>("Engine.Media.BitmapFont", unpacker_wrapper<unpack_bitmapFont>));
-        if (unpackSound)
-            unpackers.insert(std::pair<std::string, unpacker_type>("Engine.Audio.SoundBuffer", unpacker_wrapper<unpack_soundBuffer>));
-        
-        unpacker_type defaultUnpacker = unpacker_wrapper<unpack_raw>;
-        unpack(pak, dirPath, unpackers, defaultUnpacker);
+        throw std::runtime_error("no item named " + name);
     }
 
     void unpackAll(const PakFile & pak, const std::string & dirPath)
@@ -95,131 +163,204 @@ namespace scpak
         unpack(pak, dirPath, true, true, true, true);
     }
 
-    
+    namespace
+    {
+        void appendBytes(void *context, void *data, int size)
+        {
+            std::vector<byte> &buffer = *static_cast<std::vector<byte>*>(context);
+            const byte *bytes = static_cast<const byte*>(data);
+            buffer.insert(buffer.end(), bytes, bytes + size);
+        }
+
+        OutputFile encodeTga(const std::string &fileName, int width, int height, const void *pixels)
+        {
+            TraceScope scope("codec", "encode image");
+            OutputFile file;
+            file.path = fileName;
+            stbi_write_tga_to_func(appendBytes, &file.data, width, height, 4, pixels);
+            file.memory.reset(file.data.size());
+            return file;
+        }
+
+        OutputFile textFile(const std::string &fileName, const std::string &text)
+        {
+            OutputFile file;
+            file.path = fileName;
+            file.data.assign(text.begin(), text.end());
+            file.memory.reset(file.data.size());
+            return file;
+        }
+
+        // runs an unpacker that takes a writer with one that writes at once
+        template<typename Unpacker>
+        auto unpackNow(const Unpacker &unpacker) -> decltype(unpacker(*static_cast<FileWriter*>(nullptr)))
+        {
+            std::unique_ptr<FileWriter> writer = createFileWriter(FileWriterBackend::Sync);
+            return unpacker(*writer);
+        }
+    }
+
+    void unpackTextureLevel(const PakFile &pak, std::istream &stream, const std::string &name,
+        const std::string &dirPath, int level)
+    {
+        for (const PakItem &item : pak.contents())
+        {
+            if (item.name != name)
+                continue;
+            if (item.typeId != ItemType::Texture2D)
+                throw std::runtime_error(name + " is not a texture");
+            TextureHeader header = readTextureHeader(pak, stream, item);
+            if (level < 0)
+                level += header.mipmapLevel;
+            std::vector<byte> pixels = readMipmapLevel(pak, stream, item, header, level);
+            MipmapLevelRange range = mipmapLevelRange(header.width, header.height, level);
+
+            DirectoryCache directories(dirPath);
+            std::size_t slash = name.rfind('/');
+            if (slash != std::string::npos)
+                directories.createDirectories(name.substr(0, slash));
+            std::unique_ptr<FileWriter> writer = createFileWriter(FileWriterBackend::Sync, 1, &directories);
+            writer->write(encodeTga(directories.root() + name + ".tga", range.width, range.height, pixels.data()));
+            writer->flush();
+            return;
+        }
+        throw std::runtime_error("no item named " + name);
+    }
+
     void unpack_raw(const std::string &outputPath, const PakItem &item)
     {
-        std::ofstream fout(outputPath + item.name, std::ios::binary);
-        fout.write(reinterpret_cast<const char*>(item.data.data()), item.length);
+        unpackNow([&](FileWriter &writer) { unpack_raw(outputPath, item, writer); });
+    }
+
+    void unpack_raw(const std::string &outputPath, const PakItem &item, FileWriter &writer)
+    {
+        OutputFile file;
+        file.path = outputPath + item.name;
+        file.view = item.payload();
+        file.viewSize = item.length;
+        writer.write(std::move(file));
     }
 
     void unpack_string(const std::string &outputPath, const PakItem &item)
     {
-        std::string fileName = outputPath + item.name;
-        if (item.type == "System.String")
-            fileName += ".txt";
-        else if (item.type == "System.Xml.Linq.XElement")
-            fileName += ".xml";
+        unpackNow([&](FileWriter &writer) { unpack_string(outputPath, item, writer); });
+    }
+
+    void unpack_string(const std::string &outputPath, const PakItem &item, FileWriter &writer)
+    {
+        OutputFile file;
+        file.path = outputPath + item.name;
+        ItemType type = item.typeId != ItemType::Other ? item.typeId : internItemType(item.type.data(), item.type.size());
+        if (type == ItemType::String)
+            file.path += ".txt";
+        else if (type == ItemType::XElement)
+            file.path += ".xml";
         else
             throw std::runtime_error("wrong item type");
 
-        std::ofstream fout;
-        fout.open(fileName, std::ios::binary);
-        MemoryBinaryReader reader(item.data.data());
-        std::string value = reader.readString();
-        fout.write(value.data(), value.length());
+        // the string bytes follow their length prefix, write them in place
+        MemoryBinaryReader reader(item.payload(), item.length);
+        int length = reader.read7BitEncodedInt();
+        if (length < 0 || static_cast<std::int64_t>(reader.position) + length > item.length)
+            throw std::runtime_error("read past end of buffer");
+        file.view = item.payload() + reader.position;
+        file.viewSize = length;
+        writer.write(std::move(file));
     }
 
     void unpack_bitmapFont(const std::string &outputDir, const PakItem &item)
+    {
+        unpackNow([&](FileWriter &writer) { unpack_bitmapFont(outputDir, item, writer); });
+    }
+
+    void unpack_bitmapFont(const std::string &outputDir, const PakItem &item, FileWriter &writer)
     {
         std::string listFileName = outputDir + item.name + ".lst";
         std::string textureFileName = outputDir + item.name + ".tga";
 
-        MemoryBinaryReader reader(item.data.data());
-        int glyphCount = reader.readInt32();
-        std::vector<GlyphInfo> glyphList;
-        glyphList.resize(glyphCount);
-        for (int i = 0; i < glyphCount; ++i)
-        {
-            GlyphInfo &glyph = glyphList[i];
-            glyph.unicode = reader.readUtf8Char();
-            glyph.texCoord1.x = reader.readSingle();
-            glyph.texCoord1.y = reader.readSingle();
-            glyph.texCoord2.x = reader.readSingle();
-            glyph.texCoord2.y = reader.readSingle();
-            glyph.offset.x = reader.readSingle();
-            glyph.offset.y = reader.readSingle();
-            glyph.width = reader.readSingle();
-        }
-        float glyphHeight = reader.readSingle();
-        Vector2f spacing;
-        spacing.x = reader.readSingle();
-        spacing.y = reader.readSingle();
-        float scale = reader.readSingle();
-        int fallbackCode = reader.readUtf8Char();
-
-        bool keepSourceImageInTag = reader.readBoolean();
-        int width = reader.readInt32();
-        int height = reader.readInt32();
-        int mipmapLevel = reader.readInt32();
-
-        stbi_write_tga(textureFileName.c_str(), width, height, 4, item.data.data() + reader.position);
-
-        std::ofstream fList;
-        fList.open(listFileName);
-        fList << glyphCount << std::endl;
-        for (int i = 0; i < glyphCount; ++i)
+        BitmapFont font = readBitmapFont(item.payload(), item.length);
+        writer.write(encodeTga(textureFileName, font.atlas.width, font.atlas.height, item.payload() + font.atlasOffset));
+
+        std::ostringstream fList;
+        fList << font.glyphs.size() << std::endl;
+        for (const GlyphInfo &glyph : font.glyphs)
         {
-            GlyphInfo &glyph = glyphList[i];
             fList << glyph.unicode << '\t'
                 << glyph.texCoord1.x << '\t' << glyph.texCoord1.y << '\t'
                 << glyph.texCoord2.x << '\t' << glyph.texCoord2.y << '\t'
                 << glyph.offset.x << '\t' << glyph.offset.y << '\t'
                 << glyph.width << std::endl;
         }
-        fList << glyphHeight << std::endl;
-        fList << spacing.x << '\t' << spacing.y << std::endl;
-        fList << scale << std::endl;
-        fList << fallbackCode << std::endl;
+        fList << font.glyphHeight << std::endl;
+        fList << font.spacing.x << '\t' << font.spacing.y << std::endl;
+        fList << font.scale << std::endl;
+        fList << font.fallbackCode << std::endl;
+        writer.write(textFile(listFileName, fList.str()));
     }
 
     std::string unpack_texture(const std::string &outputDir, const PakItem &item)
+    {
+        return unpackNow([&](FileWriter &writer) { return unpack_texture(outputDir, item, writer); });
+    }
+
+    std::string unpack_texture(const std::string &outputDir, const PakItem &item, FileWriter &writer)
     {
         std::string fileName = outputDir + item.name + ".tga";
-        MemoryBinaryReader reader(item.data.data());
-        bool keepSourceImageInTag = reader.readBoolean();
-        int width = reader.readInt32();
-        int height = reader.readInt32();
-        int mipmapLevel = reader.readInt32();
-        const void *imageData = reinterpret_cast<const void*>(item.data.data() + reader.position);
-        stbi_write_tga(fileName.c_str(), width, height, 4, imageData);
+        TextureHeader header = readTextureHeader(item.payload(), item.length);
+        writer.write(encodeTga(fileName, header.width, header.height, item.payload() + TextureHeader::size));
 
         std::string meta;
-        meta += keepSourceImageInTag ? '1' : '0';
+        meta += header.keepSourceImageInTag ? '1' : '0';
         meta += ' ';
-        meta += std::to_string(mipmapLevel);
+        meta += std::to_string(header.mipmapLevel);
         return meta;
     }
 
     void unpack_soundBuffer(const std::string &outputDir, const PakItem &item)
+    {
+        unpackNow([&](FileWriter &writer) { unpack_soundBuffer(outputDir, item, writer); });
+    }
+
+    void unpack_soundBuffer(const std::string &outputDir, const PakItem &item, FileWriter &writer)
     {
         static const int bitsPerSample = 16;
 
-        MemoryBinaryReader reader(item.data.data());
+        MemoryBinaryReader reader(item.payload(), item.length);
 
         bool oggCompressed = reader.readBoolean();
 
+        OutputFile file;
         if (!oggCompressed)
         {
-            std::string listFileName = outputDir + item.name + ".wav";
+            file.path = outputDir + item.name + ".wav";
             WavHeader header;
             WavHeader::SetMagicValues(header);
             header.channelCount = reader.readInt32();
             header.sampleRate = reader.readInt32();
             header.subchunk2Size = reader.readInt32();
+            if (static_cast<std::int64_t>(reader.position) + header.subchunk2Size > item.length)
+                throw std::runtime_error("read past end of buffer");
 
+            if (header.channelCount <= 0)
+                throw std::runtime_error("invalid channel count");
+
+            // packs may hold mono sounds, one frame is a sample per channel
             header.bitsPerSample = bitsPerSample;
-            header.byteRate = header.sampleRate * bitsPerSample / 8;
+            header.blockAlign = static_cast<std::uint16_t>(header.channelCount * bitsPerSample / 8);
+            header.byteRate = header.sampleRate * header.blockAlign;
             header.chunkSize = header.subchunk2Size + 36;
 
-            const byte *sound = item.data.data() + reader.position;
-            std::ofstream fout(listFileName, std::ios::binary);
-            fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
-            fout.write(reinterpret_cast<const char*>(sound), header.subchunk2Size);
+            const byte *headerBytes = reinterpret_cast<const byte*>(&header);
+            file.data.assign(headerBytes, headerBytes + sizeof(header));
+            file.view = item.payload() + reader.position;
+            file.viewSize = header.subchunk2Size;
         }
         else
         {
-            std::ofstream(outputDir + item.name, std::ios::binary).write(reinterpret_cast<const char*>(item.data.data()), item.data.size());
+            file.path = outputDir + item.name;
+            file.view = item.payload();
+            file.viewSize = item.length;
         }
+        writer.write(std::move(file));
     }
 }
-
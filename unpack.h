@@ -1,5 +1,6 @@
 #pragma once
 #include "pakfile.h"
+#include "filewriter.h"
 #include <string>
 #include <map>
 #include <functional>
@@ -8,6 +9,25 @@
 namespace scpak
 {
     typedef std::function<std::string(const std::string &outputDir, const PakItem &item)> unpacker_type;
+
+    struct UnpackOptions
+    {
+        bool unpackText = false;
+        bool unpackBitmapFont = false;
+        bool unpackTexture = false;
+        bool unpackSound = false;
+        // how built-in unpackers write their files; queued files are
+        // written by the time unpack() returns
+        FileWriterBackend writeBackend = FileWriterBackend::Sync;
+        int writeQueueDepth = 64;
+        // used for types without a built-in codec, keyed by type name
+        std::map<std::string, unpacker_type> customUnpackers;
+        // only selected items are written; the manifest still lists every
+        // item (without meta for the others) so that packing with the same
+        // filter can take them from the original pak
+        ItemFilter filter;
+    };
+
     void unpack(
         const PakFile &pak, const std::string &dirPath,
         const std::map<std::string, unpacker_type> &unpackers,
@@ -17,12 +37,30 @@ namespace scpak
         bool unpack_bitmapFont = false,
         bool unpack_texture = false,
         bool unpack_sound = false);
+    void unpack(const PakFile &pak, const std::string &dirPath, const UnpackOptions &options);
     void unpackAll(const PakFile &pak, const std::string &dirPath);
+    // unpacks one item the way unpack(pak, dirPath, options) does and
+    // returns its manifest meta; outputDir ends with pathsep
+    std::string unpackItem(const std::string &outputDir, const PakItem &item, const UnpackOptions &options, FileWriter &writer);
+    // unpacks only the item called name, without writing a manifest
+    void unpackItem(const PakFile &pak, const std::string &name, const std::string &dirPath, const UnpackOptions &options);
+    // writes one mip level of the texture called name as its .tga, reading
+    // only that level through PakFile::readRange; negative levels count
+    // from the smallest (-1)
+    void unpackTextureLevel(const PakFile &pak, std::istream &stream, const std::string &name,
+        const std::string &dirPath, int level);
 
     void unpack_raw(const std::string &outputDir, const PakItem &item);
     void unpack_string(const std::string &outputDir, const PakItem &item);
     void unpack_bitmapFont(const std::string &outputDir, const PakItem &item);
     std::string unpack_texture(const std::string &outputDir, const PakItem &item);
     void unpack_soundBuffer(const std::string &outputDir, const PakItem &item);
+
+    // queue their files on writer instead of writing them before returning
+    void unpack_raw(const std::string &outputDir, const PakItem &item, FileWriter &writer);
+    void unpack_string(const std::string &outputDir, const PakItem &item, FileWriter &writer);
+    void unpack_bitmapFont(const std::string &outputDir, const PakItem &item, FileWriter &writer);
+    std::string unpack_texture(const std::string &outputDir, const PakItem &item, FileWriter &writer);
+    void unpack_soundBuffer(const std::string &outputDir, const PakItem &item, FileWriter &writer);
 }
 
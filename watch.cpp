@@ -0,0 +1,338 @@
+#include "watch.h"
+#include "native.h"
+#include "trace.h"
+#include <fstream>
+#include <stdexcept>
+#include <chrono>
+#include <cstdio>
+
+#ifdef __linux__
+# include <sys/inotify.h>
+# include <poll.h>
+# include <dirent.h>
+# include <unistd.h>
+# include <cerrno>
+# include <cstring>
+# include <limits.h>
+#endif
+
+
+namespace scpak
+{
+    IncrementalPacker::IncrementalPacker(const std::string &dirPath, const PackOptions &options) :
+        m_dirPath(dirPath), m_options(options), m_manifestDirty(true)
+    {
+        if (m_dirPath.empty() || *m_dirPath.rbegin() != pathsep)
+            m_dirPath += pathsep;
+    }
+
+    bool IncrementalPacker::invalidate(const std::string &relativePath)
+    {
+        auto it = m_items.find(relativePath);
+        if (it == m_items.end())
+        {
+            // most items are stored with an extension added to their name
+            std::size_t dot = relativePath.rfind('.');
+            std::size_t slash = relativePath.rfind('/');
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+                return false;
+            it = m_items.find(relativePath.substr(0, dot));
+            if (it == m_items.end())
+                return false;
+        }
+        it->second.dirty = true;
+        return true;
+    }
+
+    void IncrementalPacker::invalidateDirectory(const std::string &relativePath)
+    {
+        std::string prefix = relativePath + '/';
+        for (auto it = m_items.lower_bound(prefix); it != m_items.end() && it->first.compare(0, prefix.length(), prefix) == 0; ++it)
+            it->second.dirty = true;
+    }
+
+    void IncrementalPacker::invalidateManifest()
+    {
+        m_manifestDirty = true;
+    }
+
+    void IncrementalPacker::invalidateAll()
+    {
+        m_manifestDirty = true;
+        for (auto &entry : m_items)
+            entry.second.dirty = true;
+    }
+
+    bool IncrementalPacker::dirty() const
+    {
+        if (m_manifestDirty)
+            return true;
+        for (const auto &entry : m_items)
+            if (entry.second.dirty)
+                return true;
+        return false;
+    }
+
+    std::size_t IncrementalPacker::update()
+    {
+        if (m_manifestDirty)
+        {
+            std::vector<ManifestEntry> manifest = readManifest(m_dirPath);
+            std::map<std::string, CachedItem> items;
+            m_order.clear();
+            for (ManifestEntry &entry : manifest)
+            {
+                std::string name = entry.item.name.str();
+                m_order.push_back(name);
+                auto old = m_items.find(name);
+                if (old != m_items.end() && old->second.item.type == entry.item.type && old->second.meta == entry.meta)
+                {
+                    items[name] = std::move(old->second);
+                    continue;
+                }
+                CachedItem &item = items[name];
+                item.item = std::move(entry.item);
+                item.meta = std::move(entry.meta);
+            }
+            m_items.swap(items);
+            m_manifestDirty = false;
+        }
+
+        std::size_t packed = 0;
+        for (const std::string &name : m_order)
+        {
+            CachedItem &cached = m_items[name];
+            if (!cached.dirty)
+                continue;
+            TraceScope itemScope("item", name.c_str(), cached.item.type.c_str());
+            ItemMemoryScope memoryScope(name.c_str());
+            PakItem item;
+            item.name = cached.item.name;
+            item.type = cached.item.type;
+            item.typeId = cached.item.typeId;
+            {
+                TraceScope packerScope("packer", item.type.c_str());
+                packItem(m_dirPath, item, cached.meta, m_options);
+            }
+            cached.item = std::move(item);
+            cached.dirty = false;
+            ++packed;
+        }
+        return packed;
+    }
+
+    void IncrementalPacker::save(const std::string &path) const
+    {
+        // the pak only points at the cached payloads
+        PakFile pak;
+        for (const std::string &name : m_order)
+        {
+            const PakItem &cached = m_items.at(name).item;
+            PakItem item;
+            item.name = cached.name;
+            item.type = cached.type;
+            item.typeId = cached.typeId;
+            item.length = cached.length;
+            item.view = cached.payload();
+            pak.addItem(std::move(item));
+        }
+
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream fout(tempPath, std::ios::binary);
+            if (!fout)
+                throw std::runtime_error("cannot open " + tempPath);
+            pak.save(fout, m_options.layout);
+            fout.close();
+            if (!fout)
+                throw std::runtime_error("failed to write " + tempPath);
+        }
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0)
+        {
+            std::remove(tempPath.c_str());
+            throw std::runtime_error("cannot replace " + path);
+        }
+    }
+
+#ifdef __linux__
+    namespace
+    {
+        const std::uint32_t watchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ONLYDIR;
+
+        class DirectoryWatch
+        {
+        public:
+            explicit DirectoryWatch(const std::string &root) : m_root(root)
+            {
+                m_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+                if (m_fd == -1)
+                    throw std::runtime_error("inotify_init1 failed: " + std::string(std::strerror(errno)));
+            }
+
+            ~DirectoryWatch()
+            {
+                close(m_fd);
+            }
+
+            DirectoryWatch(const DirectoryWatch &) = delete;
+            DirectoryWatch &operator=(const DirectoryWatch &) = delete;
+
+            // watches a directory below the root and all its subdirectories
+            void add(const std::string &relativePath)
+            {
+                std::string path = relativePath.empty() ? m_root : m_root + pathsep + relativePath;
+                int wd = inotify_add_watch(m_fd, path.c_str(), watchMask);
+                if (wd == -1)
+                {
+                    // gone again already, its parent reports that
+                    if (errno == ENOENT || errno == ENOTDIR)
+                        return;
+                    throw std::runtime_error("cannot watch " + path + ": " + std::strerror(errno));
+                }
+                m_directories[wd] = relativePath;
+                DIR *dir = opendir(path.c_str());
+                if (dir == nullptr)
+                    return;
+                while (dirent *entry = readdir(dir))
+                {
+                    std::string name = entry->d_name;
+                    if (name == "." || name == "..")
+                        continue;
+                    std::string child = relativePath.empty() ? name : relativePath + '/' + name;
+                    if (isDirectory((m_root + pathsep + child).c_str()))
+                        add(child);
+                }
+                closedir(dir);
+            }
+
+            // waits up to timeout milliseconds (-1 for ever) for events
+            bool wait(int timeout)
+            {
+                pollfd fds = { m_fd, POLLIN, 0 };
+                int result = poll(&fds, 1, timeout);
+                if (result == -1 && errno != EINTR)
+                    throw std::runtime_error("poll failed: " + std::string(std::strerror(errno)));
+                return result > 0;
+            }
+
+            // hands the pending events to packer, returns false if none
+            // of them concerned it
+            bool read(IncrementalPacker &packer)
+            {
+                alignas(inotify_event) char buffer[64 * (sizeof(inotify_event) + NAME_MAX + 1)];
+                bool relevant = false;
+                while (true)
+                {
+                    ssize_t length = ::read(m_fd, buffer, sizeof(buffer));
+                    if (length <= 0)
+                        break;
+                    for (char *p = buffer; p < buffer + length; )
+                    {
+                        const inotify_event *event = reinterpret_cast<const inotify_event*>(p);
+                        p += sizeof(inotify_event) + event->len;
+                        relevant |= handle(*event, packer);
+                    }
+                }
+                return relevant;
+            }
+        private:
+            bool handle(const inotify_event &event, IncrementalPacker &packer)
+            {
+                if (event.mask & IN_Q_OVERFLOW)
+                {
+                    packer.invalidateAll();
+                    return true;
+                }
+                auto it = m_directories.find(event.wd);
+                if (it == m_directories.end())
+                    return false;
+                if (event.mask & IN_IGNORED)
+                {
+                    m_directories.erase(it);
+                    return false;
+                }
+                if (event.len == 0)
+                    return false;
+                std::string name = event.name;
+                std::string path = it->second.empty() ? name : it->second + '/' + name;
+                if (event.mask & IN_ISDIR)
+                {
+                    // files may have landed in it before the watch was added
+                    if (event.mask & (IN_CREATE | IN_MOVED_TO))
+                        add(path);
+                    packer.invalidateDirectory(path);
+                    return true;
+                }
+                if (path == PakInfoFileName)
+                {
+                    packer.invalidateManifest();
+                    return true;
+                }
+                // a plain IN_CREATE is followed by IN_CLOSE_WRITE once written
+                if (event.mask == IN_CREATE)
+                    return false;
+                return packer.invalidate(path);
+            }
+
+            std::string m_root;
+            int m_fd;
+            std::map<int, std::string> m_directories;
+        };
+
+        double millisecondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    void watch(const std::string &dirPath, const std::string &pakPath, const WatchOptions &options)
+    {
+        std::string root = dirPath;
+        if (root.length() > 1 && *root.rbegin() == pathsep)
+            root.erase(root.length() - 1);
+        DirectoryWatch directoryWatch(root);
+        directoryWatch.add("");
+        IncrementalPacker packer(root, options.pack);
+
+        while (true)
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            try
+            {
+                TraceScope scope("phase", "rebuild");
+                std::size_t packed = packer.update();
+                packer.save(pakPath);
+                if (options.log != nullptr)
+                    *options.log << "packed " << packed << (packed == 1 ? " item" : " items") << ", wrote " << pakPath
+                        << " in " << static_cast<int>(millisecondsSince(start)) << " ms" << std::endl;
+            }
+            catch (const std::exception &e)
+            {
+                if (options.log != nullptr)
+                    *options.log << "error: " << e.what() << ", waiting for changes" << std::endl;
+            }
+            catch (const BaseException &e)
+            {
+                if (options.log != nullptr)
+                    *options.log << "error: " << e.what() << ", waiting for changes" << std::endl;
+            }
+
+            // sleep until something relevant changed, then let the burst
+            // of events (editors saving, copies) settle
+            bool changed = false;
+            while (!changed)
+            {
+                directoryWatch.wait(-1);
+                changed = directoryWatch.read(packer);
+            }
+            while (directoryWatch.wait(options.quietMilliseconds))
+                directoryWatch.read(packer);
+        }
+    }
+#else
+    void watch(const std::string &dirPath, const std::string &pakPath, const WatchOptions &options)
+    {
+        throw std::runtime_error("watch mode needs inotify and is only available on Linux");
+    }
+#endif
+}
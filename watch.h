@@ -0,0 +1,60 @@
+#pragma once
+#include "pack.h"
+#include <string>
+#include <map>
+#include <ostream>
+
+namespace scpak
+{
+    // Keeps the packed items of an unpacked directory in memory and only
+    // re-runs the packers of items whose files or manifest line changed.
+    class IncrementalPacker
+    {
+    public:
+        IncrementalPacker(const std::string &dirPath, const PackOptions &options);
+
+        // marks the item packed from a file below the directory as changed,
+        // returns false if no item uses that file
+        bool invalidate(const std::string &relativePath);
+        // marks every item packed from below a directory as changed
+        void invalidateDirectory(const std::string &relativePath);
+        void invalidateManifest();
+        void invalidateAll();
+        bool dirty() const;
+
+        // re-reads the manifest if needed and packs every changed item,
+        // returns how many were packed. Items stay changed until they pack
+        // successfully, so a failed update can simply be retried.
+        std::size_t update();
+        // writes the pak to a temporary file and renames it over path, so
+        // readers only ever see complete paks
+        void save(const std::string &path) const;
+    private:
+        struct CachedItem
+        {
+            PakItem item;
+            std::string meta;
+            bool dirty = true;
+        };
+
+        std::string m_dirPath;
+        PackOptions m_options;
+        bool m_manifestDirty;
+        std::vector<std::string> m_order;
+        std::map<std::string, CachedItem> m_items;
+    };
+
+    struct WatchOptions
+    {
+        PackOptions pack;
+        // events are collected until none arrived for this long
+        int quietMilliseconds = 100;
+        // progress and packer errors, may be null
+        std::ostream *log = nullptr;
+    };
+
+    // Packs dirPath into pakPath, then keeps rebuilding pakPath whenever
+    // files below dirPath change, until the process is interrupted.
+    // Needs inotify, so it is only available on Linux.
+    void watch(const std::string &dirPath, const std::string &pakPath, const WatchOptions &options);
+}
@@ -20,8 +20,8 @@ namespace scpak
         std::uint16_t audioFormat; // 1 - PCM
         std::uint16_t channelCount;
         std::uint32_t sampleRate;
-        std::uint32_t byteRate; // per channel
-        std::uint16_t blockAlign; // 4
+        std::uint32_t byteRate; // sampleRate * blockAlign
+        std::uint16_t blockAlign; // channelCount * bitsPerSample / 8, 4 for 16-bit stereo
         std::uint16_t bitsPerSample;
         
         char subchunk2Label[4]; // "data"
@@ -45,7 +45,7 @@ namespace scpak
                 subchunk1Label == subchunk1LabelMagic &&
                 subchunk1Size == subchunk1SizeMagic &&
                 audioFormat == audioFormatMagic &&
-                blockAlign == blockAlighMagic &&
+                blockAlign == channelCount * bitsPerSample / 8 &&
                 subchunk2Label == subchunk2LabelMagic;
         }
 